@@ -254,9 +254,8 @@ impl TestSession {
     }
 
     /// Wait for the child to exit and assert the exit code.
-    pub fn wait_exit(mut self, expected_code: i32) -> SessionOutput {
-        let status = self.child.wait().expect("failed to wait for child");
-        let code = status.code().unwrap_or(-1);
+    pub fn wait_exit(self, expected_code: i32) -> SessionOutput {
+        let (code, max_rss_kb) = wait_rusage(self.child.id());
 
         // Drop control fd to unblock any pending reads in the child
         drop(self.control);
@@ -274,7 +273,7 @@ impl TestSession {
             "expected exit code {expected_code}, got {code}\nstdout:\n{stdout}\nstderr:\n{stderr}"
         );
 
-        SessionOutput { stdout, stderr }
+        SessionOutput { stdout, stderr, max_rss_kb }
     }
 }
 
@@ -282,4 +281,27 @@ impl TestSession {
 pub struct SessionOutput {
     pub stdout: String,
     pub stderr: String,
+    /// Peak resident set size of the child, in kilobytes.
+    pub max_rss_kb: i64,
+}
+
+/// Wait for the child process `pid` to exit.  Returns its exit code
+/// (-1 if it was killed by a signal) and its peak resident set size in
+/// kilobytes.
+pub fn wait_rusage(pid: u32) -> (i32, i64) {
+    let mut status = 0;
+    let mut usage: libc::rusage = unsafe { std::mem::zeroed() };
+    loop {
+        let rc = unsafe {
+            libc::wait4(pid as libc::pid_t, &mut status, 0, &mut usage)
+        };
+        if rc != -1 {
+            break;
+        }
+        let err = std::io::Error::last_os_error();
+        assert!(err.kind() == std::io::ErrorKind::Interrupted,
+                "failed to wait for child: {err}");
+    }
+    let code = if libc::WIFEXITED(status) { libc::WEXITSTATUS(status) } else { -1 };
+    (code, usage.ru_maxrss as i64)
 }
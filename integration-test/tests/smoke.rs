@@ -1,6 +1,6 @@
 use std::fs;
 use std::io::Write;
-use std::process::Command;
+use std::process::{Command, Stdio};
 use std::sync::{Mutex, Once};
 use test_driver::TestSession;
 
@@ -981,6 +981,329 @@ fn ldif_import_base64_dn_no_padding() {
         .output();
 }
 
+// ── Pipelined commit ─────────────────────────────────────────
+
+/// Run `ldapvi --ldapmodify` on an LDIF string with extra arguments.
+/// glibc fills fresh allocations with junk here, so that fields left
+/// uninitialised show up instead of happening to be zero.
+fn ldapmodify_ldif(ldif: &str, extra: &[&str]) -> std::process::Output {
+    let tmpdir = tempfile::tempdir().expect("failed to create temp dir");
+    let input_path = tmpdir.path().join("input.ldif");
+    fs::write(&input_path, ldif).unwrap();
+    Command::new(ldapvi_binary())
+        .env("MALLOC_PERTURB_", "165")
+        .args(["--ldapmodify"])
+        .args(extra)
+        .args([
+            "--tls", "never",
+            "--bind", "simple",
+            "-h", &ldap_url(),
+            "-D", "cn=admin,dc=example,dc=com",
+            "-w", "secret",
+        ])
+        .arg(input_path.to_str().unwrap())
+        .output()
+        .expect("ldapvi --ldapmodify failed to execute")
+}
+
+fn ldapdelete(dns: &[&str]) {
+    let _ = Command::new(ldapvi_binary())
+        .args([
+            "--ldapdelete",
+            "--continue",
+            "--tls", "never",
+            "--bind", "simple",
+            "-h", &ldap_url(),
+            "-D", "cn=admin,dc=example,dc=com",
+            "-w", "secret",
+        ])
+        .args(dns)
+        .output();
+}
+
+#[test]
+fn pipelined_ldapmodify_keeps_hierarchy_order() {
+    let _lock = serial();
+    ensure_slapd();
+
+    let children = ["cn=p1,ou=pipe,dc=example,dc=com",
+                    "cn=p2,ou=pipe,dc=example,dc=com",
+                    "cn=p3,ou=pipe,dc=example,dc=com"];
+    ldapdelete(&children);
+    ldapdelete(&["ou=pipe,dc=example,dc=com"]);
+
+    // The parent must be created before its children, and the modify
+    // of p1 must not overtake its add, even with several operations
+    // in flight.
+    let mut ldif = String::from(
+        "dn: ou=pipe,dc=example,dc=com\n\
+         objectClass: organizationalUnit\n\
+         ou: pipe\n\n");
+    for (i, dn) in children.iter().enumerate() {
+        ldif.push_str(&format!(
+            "dn: {dn}\nobjectClass: person\ncn: p{}\nsn: Pipe\n\n", i + 1));
+    }
+    ldif.push_str(
+        "dn: cn=p1,ou=pipe,dc=example,dc=com\n\
+         changetype: modify\n\
+         replace: description\n\
+         description: pipelined\n\
+         -\n\n");
+
+    let output = ldapmodify_ldif(&ldif, &["--add", "--pipeline", "8"]);
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    assert!(output.status.success(), "pipelined ldapmodify failed:\n{stderr}");
+
+    let search_output = ldapsearch("(sn=Pipe)");
+    for i in 1..=3 {
+        assert!(search_output.contains(&format!("cn: p{i}")),
+                "p{i} should exist:\n{search_output}");
+    }
+    assert!(search_output.contains("description: pipelined"),
+            "modify should have been applied:\n{search_output}");
+
+    ldapdelete(&children);
+    ldapdelete(&["ou=pipe,dc=example,dc=com"]);
+}
+
+#[test]
+fn pipelined_ldapmodify_deletes_bottom_up() {
+    let _lock = serial();
+    ensure_slapd();
+
+    let parent = "ou=pipedel,dc=example,dc=com";
+    let children: Vec<String> =
+        (1..=4).map(|i| format!("cn=d{i},{parent}")).collect();
+    let child_refs: Vec<&str> = children.iter().map(|s| s.as_str()).collect();
+    ldapdelete(&child_refs);
+    ldapdelete(&[parent]);
+
+    let mut ldif = format!(
+        "dn: {parent}\nobjectClass: organizationalUnit\nou: pipedel\n\n");
+    for dn in children.iter() {
+        ldif.push_str(&format!(
+            "dn: {dn}\nobjectClass: person\ncn: d\nsn: PipeDelete\n\n"));
+    }
+    let output = ldapmodify_ldif(&ldif, &["--add"]);
+    assert!(output.status.success(), "setup failed:\n{}",
+            String::from_utf8_lossy(&output.stderr));
+
+    // The parent delete comes last and must wait for all of its
+    // children, although the window would let it go out at once.
+    let mut ldif = String::new();
+    for dn in children.iter() {
+        ldif.push_str(&format!("dn: {dn}\nchangetype: delete\n\n"));
+    }
+    ldif.push_str(&format!("dn: {parent}\nchangetype: delete\n\n"));
+    let output = ldapmodify_ldif(&ldif, &["--pipeline", "8"]);
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    assert!(output.status.success(), "pipelined deletes failed:\n{stderr}");
+
+    let search_output = ldapsearch("(|(sn=PipeDelete)(ou=pipedel))");
+    assert!(!search_output.contains("pipedel"),
+            "everything should be gone:\n{search_output}");
+}
+
+#[test]
+fn pipelined_ldapmodify_reports_each_error() {
+    let _lock = serial();
+    ensure_slapd();
+
+    // Two modifies of entries that do not exist: with --continue, both
+    // errors are reported, each naming its entry.
+    let ldif = "dn: cn=nonexistent1,dc=example,dc=com\n\
+                changetype: modify\n\
+                replace: sn\n\
+                sn: x\n\
+                -\n\n\
+                dn: cn=nonexistent2,dc=example,dc=com\n\
+                changetype: modify\n\
+                replace: sn\n\
+                sn: x\n\
+                -\n\n";
+    let output = ldapmodify_ldif(ldif, &["--continue", "--pipeline", "4"]);
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    assert!(output.status.success(), "--continue should succeed:\n{stderr}");
+    assert!(stderr.contains("entry: cn=nonexistent1,dc=example,dc=com"),
+            "stderr:\n{stderr}");
+    assert!(stderr.contains("entry: cn=nonexistent2,dc=example,dc=com"),
+            "stderr:\n{stderr}");
+    assert_eq!(stderr.matches("(error ignored)").count(), 2,
+               "stderr:\n{stderr}");
+}
+
+#[test]
+fn parallel_ldapmodify_over_several_connections() {
+    let _lock = serial();
+    ensure_slapd();
+
+    let parents = ["ou=par1,dc=example,dc=com", "ou=par2,dc=example,dc=com"];
+    let mut children = Vec::new();
+    for parent in parents.iter() {
+        for i in 1..=4 {
+            children.push(format!("cn=q{i},{parent}"));
+        }
+    }
+    let child_refs: Vec<&str> = children.iter().map(|s| s.as_str()).collect();
+    ldapdelete(&child_refs);
+    ldapdelete(&parents);
+
+    // Two independent subtrees, interleaved, so that both connections
+    // have work while each parent still precedes its children.
+    let mut ldif = String::new();
+    for (n, parent) in parents.iter().enumerate() {
+        ldif.push_str(&format!(
+            "dn: {parent}\nobjectClass: organizationalUnit\nou: par{}\n\n",
+            n + 1));
+    }
+    for dn in children.iter() {
+        ldif.push_str(&format!(
+            "dn: {dn}\nobjectClass: person\ncn: q\nsn: Parallel\n\n"));
+    }
+
+    let output = ldapmodify_ldif(
+        &ldif, &["--add", "--pipeline", "4", "--connections", "2"]);
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    assert!(output.status.success(), "parallel ldapmodify failed:\n{stderr}");
+
+    let search_output = ldapsearch("(sn=Parallel)");
+    for dn in children.iter() {
+        assert!(search_output.contains(dn.as_str()),
+                "{dn} should exist:\n{search_output}");
+    }
+
+    ldapdelete(&child_refs);
+    ldapdelete(&parents);
+}
+
+#[test]
+fn transactional_ldapmodify_applies_every_batch() {
+    let _lock = serial();
+    ensure_slapd();
+
+    let parent = "ou=txn,dc=example,dc=com";
+    let children: Vec<String> =
+        (1..=5).map(|i| format!("cn=t{i},{parent}")).collect();
+    let child_refs: Vec<&str> = children.iter().map(|s| s.as_str()).collect();
+    ldapdelete(&child_refs);
+    ldapdelete(&[parent]);
+
+    let mut ldif = format!(
+        "dn: {parent}\nobjectClass: organizationalUnit\nou: txn\n\n");
+    for dn in children.iter() {
+        ldif.push_str(&format!(
+            "dn: {dn}\nobjectClass: person\ncn: t\nsn: Transaction\n\n"));
+    }
+
+    // Six updates in batches of two.  Servers without RFC 5805 support
+    // get the same updates pipelined instead.
+    let output = ldapmodify_ldif(&ldif, &["--add", "--transaction", "2"]);
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    assert!(output.status.success(),
+            "transactional ldapmodify failed:\n{stderr}");
+
+    let search_output = ldapsearch("(sn=Transaction)");
+    for dn in children.iter() {
+        assert!(search_output.contains(dn.as_str()),
+                "{dn} should exist:\n{search_output}");
+    }
+
+    ldapdelete(&child_refs);
+    ldapdelete(&[parent]);
+}
+
+#[test]
+fn transaction_needs_noquestions() {
+    let _lock = serial();
+    ensure_slapd();
+
+    let parent = "ou=txnc,dc=example,dc=com";
+    let child = "cn=c1,ou=txnc,dc=example,dc=com";
+    ldapdelete(&[child]);
+    ldapdelete(&[parent]);
+    let ldif = format!(
+        "dn: {parent}\nobjectClass: organizationalUnit\nou: txnc\n\n\
+         dn: {child}\nobjectClass: person\ncn: c1\nsn: TxnContinue\n\n");
+    let output = ldapmodify_ldif(&ldif, &["--add"]);
+    assert!(output.status.success(), "setup failed:\n{}",
+            String::from_utf8_lossy(&output.stderr));
+
+    // An interactive -c commit retries the delete of the parent after
+    // that of its child, outside of any transaction.
+    let mut args: Vec<String> = bind_args();
+    args.extend(["-c", "--transaction", "2", "(|(ou=txnc)(sn=TxnContinue))"]
+                .iter().map(|s| s.to_string()));
+    let arg_refs: Vec<&str> = args.iter().map(|s| s.as_str()).collect();
+    let mut session = TestSession::spawn(&test_ldapvi_binary(), &arg_refs, &[])
+        .expect("failed to spawn test-ldapvi");
+    session.expect_edit(|path| {
+        fs::write(path, "").unwrap();
+    });
+    session.expect_choose();
+    session.respond('y');
+    let output = session.wait_exit(0);
+    assert!(output.stderr.contains("--transaction requires --noquestions"),
+            "stderr:\n{}", output.stderr);
+
+    let search_output = ldapsearch("(|(ou=txnc)(sn=TxnContinue))");
+    assert!(!search_output.contains("txnc"),
+            "both entries should be gone:\n{search_output}");
+}
+
+#[test]
+fn streaming_ldapmodify_from_pipe() {
+    let _lock = serial();
+    ensure_slapd();
+
+    let dns = ["cn=s1,dc=example,dc=com", "cn=s2,dc=example,dc=com"];
+    ldapdelete(&dns);
+
+    // Records arrive on a pipe, which ldapvi cannot seek; they are applied
+    // as they are read, the modify after the add it depends on.
+    let ldif = "version: 1\n\n\
+                dn: cn=s1,dc=example,dc=com\n\
+                objectClass: person\n\
+                cn: s1\n\
+                sn: Stream\n\n\
+                dn: cn=s2,dc=example,dc=com\n\
+                objectClass: person\n\
+                cn: s2\n\
+                sn: Stream\n\n\
+                dn: cn=s1,dc=example,dc=com\n\
+                changetype: modify\n\
+                replace: description\n\
+                description: streamed\n\
+                -\n";
+    let mut child = Command::new(ldapvi_binary())
+        .args([
+            "--ldapmodify", "--add",
+            "--tls", "never",
+            "--bind", "simple",
+            "-h", &ldap_url(),
+            "-D", "cn=admin,dc=example,dc=com",
+            "-w", "secret",
+        ])
+        .stdin(Stdio::piped())
+        .stdout(Stdio::piped())
+        .stderr(Stdio::piped())
+        .spawn()
+        .expect("ldapvi --ldapmodify failed to execute");
+    child.stdin.take().unwrap().write_all(ldif.as_bytes()).unwrap();
+    let output = child.wait_with_output().unwrap();
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    assert!(output.status.success(), "streaming ldapmodify failed:\n{stderr}");
+
+    let search_output = ldapsearch("(sn=Stream)");
+    for dn in dns.iter() {
+        assert!(search_output.contains(dn),
+                "{dn} should exist:\n{search_output}");
+    }
+    assert!(search_output.contains("description: streamed"),
+            "modify should have been applied:\n{search_output}");
+
+    ldapdelete(&dns);
+}
+
 // ── Regression: --sasl-secprops is actually applied ──────────
 
 #[test]
@@ -1014,3 +1337,340 @@ fn sasl_secprops_is_applied() {
         "error should mention LDAP_OPT_X_SASL_SECPROPS:\n{stderr}",
     );
 }
+
+// ── Regression: noninteractive runs skip terminal and history setup ──
+
+/// A one-entry `--out` with HOME at `home` and no terminal type, as run
+/// from cron.
+fn out_one_entry(home: &std::path::Path) -> Command {
+    let mut cmd = Command::new(ldapvi_binary());
+    cmd.args(["--out", "-s", "base"])
+        .args(bind_args())
+        .env("HOME", home)
+        .env_remove("TERM");
+    cmd
+}
+
+#[test]
+fn out_without_terminal_or_history() {
+    let _lock = serial();
+    ensure_slapd();
+
+    // Before, --out set up the terminal, which exits for an unknown
+    // TERM, and read and rewrote ~/.ldapvi_history.
+    let home = tempfile::tempdir().expect("failed to create temp dir");
+    let output = out_one_entry(home.path())
+        .output()
+        .expect("ldapvi failed to execute");
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    assert!(output.status.success(), "ldapvi --out failed:\n{stderr}");
+    let stdout = String::from_utf8_lossy(&output.stdout);
+    assert!(stdout.contains("dn: dc=example,dc=com"),
+            "expected the base entry:\n{stdout}");
+    assert!(!home.path().join(".ldapvi_history").exists(),
+            "--out should not write a history file");
+
+    // A --noquestions commit prints its summary on a terminal of
+    // unknown type, which used to make setupterm exit.
+    let input = home.path().join("change.ldif");
+    fs::write(&input,
+              "dn: cn=Test User,dc=example,dc=com\n\
+               changetype: modify\n\
+               replace: description\n\
+               description: noquestions-without-terminal\n\
+               -\n\n").unwrap();
+    let mut args: Vec<String> = vec!["--in".into(), "--noquestions".into()];
+    args.extend(bind_args());
+    args.push(input.to_str().unwrap().into());
+    let arg_refs: Vec<&str> = args.iter().map(|s| s.as_str()).collect();
+    let home_str = home.path().to_str().unwrap().to_string();
+    let session = TestSession::spawn(
+        &test_ldapvi_binary(), &arg_refs,
+        &[("TERM", "no-such-terminal"), ("HOME", &home_str)])
+        .expect("failed to spawn test-ldapvi");
+    let output = session.wait_exit(0);
+    assert!(output.stdout.contains("modify: 1"),
+            "expected the summary:\n{}", output.stdout);
+    assert!(!output.stdout.contains('\x1b'),
+            "--noquestions should not colour the summary:\n{}",
+            output.stdout);
+    assert!(ldapsearch_test_user().contains("noquestions-without-terminal"),
+            "the change should have been committed");
+}
+
+// ── Load benchmarks ──────────────────────────────────────────
+//
+// Not run by default.  Populate slapd with LDAPVI_BENCH_ENTRIES entries
+// (10000 unless set) and time the main code paths against them, or time
+// LDAPVI_BENCH_RUNS (200 unless set) short invocations:
+//
+//     cargo test --release -- --ignored --nocapture --test-threads 1 load_
+
+fn bench_entries() -> usize {
+    std::env::var("LDAPVI_BENCH_ENTRIES")
+        .ok()
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(10_000)
+}
+
+fn bench_runs() -> usize {
+    std::env::var("LDAPVI_BENCH_RUNS")
+        .ok()
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(200)
+}
+
+/// Wall time and peak RSS of one scenario.
+struct Measurement {
+    wall: std::time::Duration,
+    max_rss_kb: i64,
+}
+
+fn report(scenario: &str, entries: usize, m: &Measurement) {
+    let secs = m.wall.as_secs_f64();
+    println!(
+        "bench {scenario:<32} {entries:>8} entries {secs:>9.3} s \
+         {:>10.0} entries/s {:>8} KB peak RSS",
+        if secs > 0.0 { entries as f64 / secs } else { 0.0 },
+        m.max_rss_kb,
+    );
+}
+
+/// Run `cmd` to completion with stdout going to `stdout`.  Panics unless
+/// it exits 0; returns its measurement.
+fn run_measured(cmd: &mut Command, stdout: Stdio) -> Measurement {
+    let mut stderr = tempfile::tempfile().expect("failed to create temp file");
+    let start = std::time::Instant::now();
+    let child = cmd
+        .stdin(Stdio::null())
+        .stdout(stdout)
+        .stderr(stderr.try_clone().unwrap())
+        .spawn()
+        .expect("failed to execute ldapvi");
+    let (code, max_rss_kb) = test_driver::wait_rusage(child.id());
+    let wall = start.elapsed();
+    if code != 0 {
+        use std::io::{Read, Seek};
+        let mut text = String::new();
+        stderr.seek(std::io::SeekFrom::Start(0)).unwrap();
+        stderr.read_to_string(&mut text).unwrap();
+        panic!("ldapvi exited with {code}:\n{text}");
+    }
+    Measurement { wall, max_rss_kb }
+}
+
+/// Write an LDIF file creating ou=`ou` and `n` people below it.
+fn write_bench_ldif(path: &std::path::Path, ou: &str, n: usize) {
+    let mut f = std::io::BufWriter::new(fs::File::create(path).unwrap());
+    write!(f, "dn: ou={ou},dc=example,dc=com\n\
+               objectClass: organizationalUnit\n\
+               ou: {ou}\n\n").unwrap();
+    for i in 0..n {
+        write!(f, "dn: cn=bench{i},ou={ou},dc=example,dc=com\n\
+                   objectClass: inetOrgPerson\n\
+                   cn: bench{i}\n\
+                   sn: Bench\n\
+                   mail: bench{i}@example.com\n\
+                   description: d{i}\n\n").unwrap();
+    }
+    f.flush().unwrap();
+}
+
+fn bench_import(ou: &str, n: usize, extra: &[&str]) -> Measurement {
+    let tmpdir = tempfile::tempdir().expect("failed to create temp dir");
+    let input_path = tmpdir.path().join("input.ldif");
+    write_bench_ldif(&input_path, ou, n);
+    run_measured(
+        Command::new(ldapvi_binary())
+            .args(["--ldapmodify", "--add"])
+            .args(extra)
+            .args([
+                "--tls", "never",
+                "--bind", "simple",
+                "-h", &ldap_url(),
+                "-D", "cn=admin,dc=example,dc=com",
+                "-w", "secret",
+            ])
+            .arg(&input_path),
+        Stdio::null(),
+    )
+}
+
+static BENCH_INIT: Once = Once::new();
+
+/// Fill ou=bench once per run; the container starts out empty.
+fn ensure_bench_entries() {
+    BENCH_INIT.call_once(|| {
+        let n = bench_entries();
+        let m = bench_import("bench", n, &["--pipeline", "64"]);
+        report("--in --pipeline 64 (populate)", n, &m);
+    });
+}
+
+fn bench_args() -> Vec<String> {
+    let mut args = bind_args();
+    let base = args.iter().position(|a| a == "-b").unwrap() + 1;
+    args[base] = "ou=bench,dc=example,dc=com".into();
+    args
+}
+
+/// Export ou=bench in ldapvi syntax to `path`.
+fn bench_export(path: &std::path::Path, extra: &[&str]) -> Measurement {
+    run_measured(
+        Command::new(ldapvi_binary())
+            .args(["--out", "--ldapvi"])
+            .args(extra)
+            .args(bench_args())
+            .arg("(cn=bench*)"),
+        Stdio::from(fs::File::create(path).unwrap()),
+    )
+}
+
+/// Replace the description of every hundredth entry, returning the
+/// number of entries changed.
+fn edit_every_hundredth(text: &str) -> (String, usize) {
+    let mut out = String::with_capacity(text.len() + 1024);
+    let mut changed = 0;
+    for line in text.split_inclusive('\n') {
+        match line.strip_prefix("description: d")
+            .and_then(|rest| rest.trim_end().parse::<usize>().ok())
+        {
+            Some(i) if i % 100 == 0 => {
+                out.push_str(&format!("description: edited {i}\n"));
+                changed += 1;
+            }
+            _ => out.push_str(line),
+        }
+    }
+    (out, changed)
+}
+
+#[test]
+#[ignore]
+fn load_import() {
+    let _lock = serial();
+    ensure_slapd();
+
+    let n = bench_entries();
+    let m = bench_import("import", n, &[]);
+    report("--in", n, &m);
+}
+
+#[test]
+#[ignore]
+fn load_export() {
+    let _lock = serial();
+    ensure_slapd();
+    ensure_bench_entries();
+
+    let n = bench_entries();
+    let tmpdir = tempfile::tempdir().expect("failed to create temp dir");
+    let path = tmpdir.path().join("dump");
+    let m = bench_export(&path, &[]);
+    report("--out", n, &m);
+
+    let text = fs::read_to_string(&path).unwrap();
+    assert_eq!(text.matches("\ndescription: d").count(), n,
+               "every entry should have been exported");
+}
+
+#[test]
+#[ignore]
+fn load_diff() {
+    let _lock = serial();
+    ensure_slapd();
+    ensure_bench_entries();
+
+    let n = bench_entries();
+    let tmpdir = tempfile::tempdir().expect("failed to create temp dir");
+    let clean = tmpdir.path().join("clean");
+    let index = tmpdir.path().join("clean.idx");
+    let data = tmpdir.path().join("data");
+    bench_export(&clean, &["--index", index.to_str().unwrap()]);
+    let (edited, changed) = edit_every_hundredth(&fs::read_to_string(&clean).unwrap());
+    fs::write(&data, edited).unwrap();
+
+    let diff = |name: &str| {
+        let out = tmpdir.path().join(name);
+        let m = run_measured(
+            Command::new(ldapvi_binary()).arg("--diff").arg(&clean).arg(&data),
+            Stdio::from(fs::File::create(&out).unwrap()),
+        );
+        let ldif = fs::read_to_string(&out).unwrap();
+        assert_eq!(ldif.matches("changetype: modify").count(), changed,
+                   "--diff should report every edited entry:\n{ldif}");
+        m
+    };
+    // The index saves a pass over the clean file.
+    report("--diff (indexed)", n, &diff("diff-indexed"));
+    fs::remove_file(&index).unwrap();
+    report("--diff", n, &diff("diff"));
+}
+
+#[test]
+#[ignore]
+fn load_edit_commit() {
+    let _lock = serial();
+    ensure_slapd();
+    ensure_bench_entries();
+
+    let n = bench_entries();
+    let mut args = bench_args();
+    args.push("(cn=bench*)".into());
+    let arg_refs: Vec<&str> = args.iter().map(|s| s.as_str()).collect();
+
+    let start = std::time::Instant::now();
+    let mut session = TestSession::spawn(&test_ldapvi_binary(), &arg_refs, &[])
+        .expect("failed to spawn test-ldapvi");
+    let mut searched = start.elapsed();
+    let mut changed = 0;
+    session.expect_edit(|path| {
+        searched = start.elapsed();
+        let (edited, count) = edit_every_hundredth(&fs::read_to_string(path).unwrap());
+        fs::write(path, edited).unwrap();
+        changed = count;
+    });
+    let edited = std::time::Instant::now();
+    session.expect_choose();
+    let analyzed = edited.elapsed();
+    let chosen = std::time::Instant::now();
+    session.respond('y');
+    let output = session.wait_exit(0);
+    let committed = chosen.elapsed();
+    assert!(output.stdout.contains("Done."),
+            "expected 'Done.' in stdout:\n{}", output.stdout);
+
+    let phase = |wall| Measurement { wall, max_rss_kb: output.max_rss_kb };
+    report("edit: search", n, &phase(searched));
+    report("edit: analyze", n, &phase(analyzed));
+    report("edit: commit", changed, &phase(committed));
+    report("edit: total", n, &phase(searched + analyzed + committed));
+
+    let search_output = ldapsearch("(description=edited 0)");
+    assert!(search_output.contains("cn=bench0,"),
+            "the edit should have been committed:\n{search_output}");
+}
+
+#[test]
+#[ignore]
+fn load_startup() {
+    let _lock = serial();
+    ensure_slapd();
+
+    // Short scripted runs are dominated by startup and connection setup.
+    let runs = bench_runs();
+    let home = tempfile::tempdir().expect("failed to create temp dir");
+    let mut wall = std::time::Duration::ZERO;
+    let mut max_rss_kb = 0;
+    for _ in 0..runs {
+        let m = run_measured(&mut out_one_entry(home.path()), Stdio::null());
+        wall += m.wall;
+        max_rss_kb = max_rss_kb.max(m.max_rss_kb);
+    }
+    println!(
+        "bench {:<32} {runs:>8} runs    {:>9.3} ms/run {:>8} KB peak RSS",
+        "--out -s base (startup)",
+        wall.as_secs_f64() * 1e3 / runs.max(1) as f64,
+        max_rss_kb,
+    );
+}
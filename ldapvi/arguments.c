@@ -62,6 +62,9 @@ static void parse_configuration(char *, cmdline *, GPtrArray *);
 "  -b, --base DN          Search base.\n"				      \
 "  -s, --scope SCOPE      Search scope.  One of base|one|sub.\n"	      \
 "  -S, --sort KEYS        Sort control (critical).\n"			      \
+"      --page-size N      Fetch results in pages of N entries.\n"	      \
+"      --window N         Edit N sorted entries at a time (with -S).\n"	      \
+"      --render-threads N Format entries in N threads.\n"		      \
 "\n"									      \
 "Miscellaneous options:\n"						      \
 "      --add              (Only with --in, --ldapmodify:)\n"		      \
@@ -76,12 +79,20 @@ static void parse_configuration(char *, cmdline *, GPtrArray *);
 "      --encoding [ASCII|UTF-8|binary]\n"				      \
 "                         The encoding to allow.  Default is UTF-8.\n"	      \
 "  -H, --help             This help.\n"					      \
+"      --index FILE       (Only with --out --ldapvi:) Write an index\n"	      \
+"                         of the entries to FILE.  See --diff below.\n"	      \
 "      --ldap-conf        Always read libldap configuration.\n"		      \
 "  -m, --may              Show missing optional attributes as comments.\n"    \
 "  -M, --managedsait      manageDsaIT control (critical).\n"		      \
 "      --noquestions      Commit without asking for confirmation.\n"	      \
 "  -!, --noninteractive   Never ask any questions.\n"			      \
+"      --pipeline N       Keep up to N updates in flight.\n"		      \
+"                         (Only with -c or --noquestions.)\n"		      \
+"      --connections N    Distribute updates over N connections.\n"	      \
+"      --transaction N    Commit updates in transactions of N.\n"	      \
 "  -q, --quiet            Disable progress output.\n"			      \
+"      --stats            Print timing statistics when done.\n"		      \
+"      --stats-json       Same, as JSON.\n"				      \
 "  -R, --read DN          Same as -b DN -s base '(objectclass=*)' + *\n"      \
 "  -Z, --starttls         Require startTLS.\n"				      \
 "      --tls [never|allow|try|strict]  Level of TLS strictess.\n"	      \
@@ -110,6 +121,10 @@ static void parse_configuration(char *, cmdline *, GPtrArray *);
 "\n"									      \
 "A special (offline) option is --diff, which compares two files\n"	      \
 "and writes any changes to standard output in LDIF format.\n"		      \
+"If the first file has an index named FILE.idx, it is used instead of\n"      \
+"reading the file twice.\n"						      \
+"--diff-dumps compares two LDIF dumps that list their entries in any\n"       \
+"order, such as the output of slapcat on two servers.\n"		      \
 "\n"									      \
 "Report bugs to \"ldapvi@lists.askja.de\"."
 
@@ -119,7 +134,10 @@ enum ldapvi_option_numbers {
 	OPTION_NOQUESTIONS, OPTION_LDAPSEARCH, OPTION_LDAPMODIFY,
 	OPTION_LDAPDELETE, OPTION_LDAPMODDN, OPTION_LDAPMODRDN, OPTION_ADD,
 	OPTION_CONFIG, OPTION_READ, OPTION_LDAP_CONF, OPTION_BIND,
-	OPTION_BIND_DIALOG, OPTION_UNPAGED_HELP
+	OPTION_BIND_DIALOG, OPTION_UNPAGED_HELP, OPTION_PAGE_SIZE,
+	OPTION_PIPELINE, OPTION_CONNECTIONS, OPTION_RENDER_THREADS,
+	OPTION_INDEX, OPTION_TRANSACTION, OPTION_WINDOW, OPTION_STATS,
+	OPTION_STATS_JSON
 };
 
 static struct poptOption options[] = {
@@ -146,6 +164,15 @@ static struct poptOption options[] = {
 	{"encoding",	  0, POPT_ARG_STRING, 0, OPTION_ENCODING, 0, 0},
 	{"bind",	  0, POPT_ARG_STRING, 0, OPTION_BIND, 0, 0},
 	{"bind-dialog",	  0, POPT_ARG_STRING, 0, OPTION_BIND_DIALOG, 0, 0},
+	{"page-size",	  0, POPT_ARG_STRING, 0, OPTION_PAGE_SIZE, 0, 0},
+	{"window",	  0, POPT_ARG_STRING, 0, OPTION_WINDOW, 0, 0},
+	{"pipeline",	  0, POPT_ARG_STRING, 0, OPTION_PIPELINE, 0, 0},
+	{"connections",	  0, POPT_ARG_STRING, 0, OPTION_CONNECTIONS, 0, 0},
+	{"transaction",	  0, POPT_ARG_STRING, 0, OPTION_TRANSACTION, 0, 0},
+	{"render-threads",0, POPT_ARG_STRING, 0, OPTION_RENDER_THREADS, 0, 0},
+	{"index",	  0, POPT_ARG_STRING, 0, OPTION_INDEX, 0, 0},
+	{"stats",	  0, 0, 0, OPTION_STATS, 0, 0},
+	{"stats-json",	  0, 0, 0, OPTION_STATS_JSON, 0, 0},
 	{"continuous",	'c', 0, 0, 'c', 0, 0},
 	{"continue",	'c', 0, 0, 'c', 0, 0},
 	{"empty",	'A', 0, 0, 'A', 0, 0},
@@ -227,6 +254,14 @@ init_cmdline(cmdline *cmdline)
 	cmdline->schema_comments = 0;
 	cmdline->continuous = 0;
 	cmdline->profileonlyp = 0;
+	cmdline->page_size = 0;
+	cmdline->window = 0;
+	cmdline->pipeline = 0;
+	cmdline->connections = 1;
+	cmdline->transaction = 0;
+	cmdline->render_threads = 0;
+	cmdline->index_file = 0;
+	cmdline->stats = 0;
 
         cmdline->bind_options.authmethod = LDAP_AUTH_SIMPLE;
         cmdline->bind_options.dialog = BD_AUTO;
@@ -517,6 +552,84 @@ parse_argument(int c, char *arg, cmdline *result, GPtrArray *ctrls)
 	case OPTION_UNPAGED_HELP:
 		usage_pagerp = 0;
 		break;
+	case OPTION_PAGE_SIZE:
+		{
+			char *ptr;
+			result->page_size = strtol(arg, &ptr, 10);
+			if (!*arg || *ptr || result->page_size < 0) {
+				fprintf(stderr, "invalid page size: %s\n",
+					arg);
+				usage(2, 1);
+			}
+		}
+		break;
+	case OPTION_WINDOW:
+		{
+			char *ptr;
+			result->window = strtol(arg, &ptr, 10);
+			if (!*arg || *ptr || result->window < 1) {
+				fprintf(stderr, "invalid window size: %s\n",
+					arg);
+				usage(2, 1);
+			}
+		}
+		break;
+	case OPTION_PIPELINE:
+		{
+			char *ptr;
+			result->pipeline = strtol(arg, &ptr, 10);
+			if (!*arg || *ptr || result->pipeline < 0) {
+				fprintf(stderr, "invalid window size: %s\n",
+					arg);
+				usage(2, 1);
+			}
+		}
+		break;
+	case OPTION_CONNECTIONS:
+		{
+			char *ptr;
+			result->connections = strtol(arg, &ptr, 10);
+			if (!*arg || *ptr || result->connections < 1) {
+				fprintf(stderr,
+					"invalid number of connections: %s\n",
+					arg);
+				usage(2, 1);
+			}
+		}
+		break;
+	case OPTION_TRANSACTION:
+		{
+			char *ptr;
+			result->transaction = strtol(arg, &ptr, 10);
+			if (!*arg || *ptr || result->transaction < 1) {
+				fprintf(stderr,
+					"invalid transaction size: %s\n",
+					arg);
+				usage(2, 1);
+			}
+		}
+		break;
+	case OPTION_RENDER_THREADS:
+		{
+			char *ptr;
+			result->render_threads = strtol(arg, &ptr, 10);
+			if (!*arg || *ptr || result->render_threads < 0) {
+				fprintf(stderr,
+					"invalid number of threads: %s\n",
+					arg);
+				usage(2, 1);
+			}
+		}
+		break;
+	case OPTION_STATS:
+		result->stats = 1;
+		break;
+	case OPTION_STATS_JSON:
+		result->stats = 2;
+		break;
+	case OPTION_INDEX:
+		result->index_file = arg;
+		break;
 	case 'p':
 		parse_configuration(arg, result, ctrls);
 		break;
@@ -700,6 +813,17 @@ parse_arguments(int argc, const char **argv, cmdline *result, GPtrArray *ctrls)
 		exit(1);
 	}
 
+	/* only ldapvi syntax has keys for --diff to look up */
+	if (result->index_file && result->mode != ldapvi_mode_out) {
+		fputs("Warning: --index is only used with --out,"
+		      " ignoring it.\n",
+		      stderr);
+		result->index_file = 0;
+	} else if (result->index_file && !result->ldapvi) {
+		fputs("Error: --index requires --ldapvi.\n", stderr);
+		exit(1);
+	}
+
 	switch (result->mode) {
 	case ldapvi_mode_edit: /* fall through */
 	case ldapvi_mode_out:
@@ -52,136 +52,184 @@ static const char Base64[] =
 	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char Pad64 = '=';
 
-void
-print_base64(
-	unsigned char const *src,
-	size_t srclength,
-	FILE *s)
+/* Value of each byte as a base64 digit, or -1. */
+static const signed char Index64[256] = {
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	 -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	 -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/*
+ * Input bytes encoded per call of encode_groups() from print_base64.  The
+ * output, including a fold every 76 characters, fits into BASE64_BUFSIZE.
+ */
+#define BASE64_CHUNK 3072
+#define BASE64_BUFSIZE (BASE64_CHUNK / 3 * 4 + (BASE64_CHUNK / 57 + 1) * 2)
+
+/* Maximum output of encode_groups() and encode_tail() for n input bytes. */
+#define BASE64_ENCODED_MAX(n) (((n) + 2) / 3 * 4 + ((n) / 57 + 1) * 2)
+
+/*
+ * Encode the complete three-byte groups of SRC into DST, folding the
+ * output before every group that starts at column 76 or later.  COL is
+ * the column carried over from the previous call.  Returns the number of
+ * characters written; the last srclength % 3 bytes are left for
+ * encode_tail().
+ */
+static size_t
+encode_groups(
+	unsigned char const *src, size_t srclength, char *dst, int *col)
 {
-	unsigned char input[3];
-	unsigned char output[4];
-	size_t i;
-	int col = 0;
+	char *p = dst;
+	int c = *col;
 
 	while (2 < srclength) {
-		input[0] = *src++;
-		input[1] = *src++;
-		input[2] = *src++;
+		unsigned long v = ((unsigned long) src[0] << 16)
+			| ((unsigned long) src[1] << 8)
+			| src[2];
+		src += 3;
 		srclength -= 3;
 
-		output[0] = input[0] >> 2;
-		output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
-		output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
-		output[3] = input[2] & 0x3f;
-
-		if (col >= 76) {
-			fputs("\n ", s);
-			col = 0;
+		if (c >= 76) {
+			*p++ = '\n';
+			*p++ = ' ';
+			c = 0;
 		}
-		col += 4;
+		c += 4;
 
-		fputc(Base64[output[0]], s);
-		fputc(Base64[output[1]], s);
-		fputc(Base64[output[2]], s);
-		fputc(Base64[output[3]], s);
+		p[0] = Base64[v >> 18];
+		p[1] = Base64[(v >> 12) & 0x3f];
+		p[2] = Base64[(v >> 6) & 0x3f];
+		p[3] = Base64[v & 0x3f];
+		p += 4;
 	}
-    
-	/* Now we worry about padding. */
-	if (0 != srclength) {
-		/* Get what's left. */
-		input[0] = input[1] = input[2] = '\0';
-		for (i = 0; i < srclength; i++)
-			input[i] = *src++;
-	
-		output[0] = input[0] >> 2;
-		output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
-		output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
 
-		fputc(Base64[output[0]], s);
-		fputc(Base64[output[1]], s);
-		if (srclength == 1)
-			fputc(Pad64, s);
-		else
-			fputc(Base64[output[2]], s);
-		fputc(Pad64, s);
-	}
+	*col = c;
+	return p - dst;
 }
 
-/* Like b64_ntop above, but append to a GString. */
-void
-g_string_append_base64(
-	GString *string, unsigned char const *src, size_t srclength)
+/* Encode the final one or two bytes of input, if any, with padding. */
+static size_t
+encode_tail(unsigned char const *src, size_t srclength, char *dst)
 {
 	unsigned char input[3];
-	unsigned char output[4];
-	size_t i;
-	int col = 0;
 
-	while (2 < srclength) {
-		input[0] = *src++;
-		input[1] = *src++;
-		input[2] = *src++;
-		srclength -= 3;
+	if (srclength == 0)
+		return 0;
+	input[0] = src[0];
+	input[1] = srclength > 1 ? src[1] : '\0';
+	input[2] = '\0';
 
-		output[0] = input[0] >> 2;
-		output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
-		output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
-		output[3] = input[2] & 0x3f;
+	dst[0] = Base64[input[0] >> 2];
+	dst[1] = Base64[((input[0] & 0x03) << 4) + (input[1] >> 4)];
+	if (srclength == 1)
+		dst[2] = Pad64;
+	else
+		dst[2] = Base64[((input[1] & 0x0f) << 2) + (input[2] >> 6)];
+	dst[3] = Pad64;
+	return 4;
+}
 
-		if (col >= 76) {
-			g_string_append(string, "\n ");
-			col = 0;
-		}
-		col += 4;
+void
+print_base64(
+	unsigned char const *src,
+	size_t srclength,
+	FILE *s)
+{
+	char buf[BASE64_BUFSIZE];
+	int col = 0;
 
-		g_string_append_c(string, Base64[output[0]]);
-		g_string_append_c(string, Base64[output[1]]);
-		g_string_append_c(string, Base64[output[2]]);
-		g_string_append_c(string, Base64[output[3]]);
+	while (srclength > BASE64_CHUNK) {
+		fwrite(buf, 1, encode_groups(src, BASE64_CHUNK, buf, &col), s);
+		src += BASE64_CHUNK;
+		srclength -= BASE64_CHUNK;
 	}
-    
-	/* Now we worry about padding. */
-	if (0 != srclength) {
-		/* Get what's left. */
-		input[0] = input[1] = input[2] = '\0';
-		for (i = 0; i < srclength; i++)
-			input[i] = *src++;
-	
-		output[0] = input[0] >> 2;
-		output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
-		output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
-
-		g_string_append_c(string, Base64[output[0]]);
-		g_string_append_c(string, Base64[output[1]]);
-		if (srclength == 1)
-			g_string_append_c(string, Pad64);
-		else
-			g_string_append_c(string, Base64[output[2]]);
-		g_string_append_c(string, Pad64);
+	{
+		size_t n = encode_groups(src, srclength, buf, &col);
+		size_t rest = srclength % 3;
+		n += encode_tail(src + srclength - rest, rest, buf + n);
+		fwrite(buf, 1, n, s);
 	}
 }
 
+/* Like b64_ntop above, but append to a GString. */
+void
+g_string_append_base64(
+	GString *string, unsigned char const *src, size_t srclength)
+{
+	size_t len = string->len;
+	size_t rest = srclength % 3;
+	int col = 0;
+	char *p;
+
+	g_string_set_size(string, len + BASE64_ENCODED_MAX(srclength));
+	p = string->str + len;
+	p += encode_groups(src, srclength, p, &col);
+	p += encode_tail(src + srclength - rest, rest, p);
+	g_string_truncate(string, p - string->str);
+}
+
 int
 read_base64(
 	char const *src,
 	unsigned char *target, 
 	size_t targsize)
 {
-	int tarindex, state, ch;
-	char *pos;
+	int tarindex, state, ch, pos;
 
 	state = 0;
 	tarindex = 0;
 
-	while ((ch = *src++) != '\0') {
+	for (;;) {
+		/*
+		 * Decode runs of complete groups straight into the target;
+		 * everything else goes through the state machine.
+		 */
+		while (state == 0) {
+			unsigned char const *u = (unsigned char const *) src;
+			int a, b, c, d;
+
+			if ((a = Index64[u[0]]) < 0
+			    || (b = Index64[u[1]]) < 0
+			    || (c = Index64[u[2]]) < 0
+			    || (d = Index64[u[3]]) < 0)
+				break;
+			if (target) {
+				if ((size_t)tarindex + 2 >= targsize)
+					break;
+				target[tarindex]   = (a << 2) | (b >> 4);
+				target[tarindex+1] = ((b & 0x0f) << 4)
+							| (c >> 2);
+				target[tarindex+2] = ((c & 0x03) << 6) | d;
+			}
+			tarindex += 3;
+			src += 4;
+		}
+
+		if ((ch = *src++) == '\0')
+			break;
+
 		if (isascii(ch) && isspace(ch))	/* Skip whitespace anywhere. */
 			continue;
 
 		if (ch == Pad64)
 			break;
 
-		pos = strchr(Base64, ch);
-		if (pos == 0) 		/* A non-base64 character. */
+		pos = Index64[(unsigned char) ch];
+		if (pos < 0) 		/* A non-base64 character. */
 			return (-1);
 
 		switch (state) {
@@ -189,7 +237,7 @@ read_base64(
 			if (target) {
 				if ((size_t)tarindex >= targsize)
 					return (-1);
-				target[tarindex] = (pos - Base64) << 2;
+				target[tarindex] = pos << 2;
 			}
 			state = 1;
 			break;
@@ -197,8 +245,8 @@ read_base64(
 			if (target) {
 				if ((size_t)tarindex + 1 >= targsize)
 					return (-1);
-				target[tarindex]   |=  (pos - Base64) >> 4;
-				target[tarindex+1]  = ((pos - Base64) & 0x0f)
+				target[tarindex]   |=  pos >> 4;
+				target[tarindex+1]  = (pos & 0x0f)
 							<< 4 ;
 			}
 			tarindex++;
@@ -208,8 +256,8 @@ read_base64(
 			if (target) {
 				if ((size_t)tarindex + 1 >= targsize)
 					return (-1);
-				target[tarindex]   |=  (pos - Base64) >> 2;
-				target[tarindex+1]  = ((pos - Base64) & 0x03)
+				target[tarindex]   |=  pos >> 2;
+				target[tarindex+1]  = (pos & 0x03)
 							<< 6;
 			}
 			tarindex++;
@@ -219,7 +267,7 @@ read_base64(
 			if (target) {
 				if ((size_t)tarindex >= targsize)
 					return (-1);
-				target[tarindex] |= (pos - Base64);
+				target[tarindex] |= pos;
 			}
 			tarindex++;
 			state = 0;
@@ -0,0 +1,217 @@
+/* -*- show-trailing-whitespace: t; indent-tabs: t -*-
+ * Microbenchmark for base64.c.
+ *
+ * Compares print_base64, g_string_append_base64 and read_base64 against
+ * reference versions that work one character at a time, the way base64.c
+ * used to, and checks that both agree on the output.
+ *
+ * usage: bench_base64 [SIZE [ROUNDS]]
+ */
+#define _GNU_SOURCE
+#include <time.h>
+#include "common.h"
+
+static const char Ref64[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void
+ref_print_base64(unsigned char const *src, size_t n, FILE *s)
+{
+	int col = 0;
+
+	for (; n > 2; n -= 3, src += 3) {
+		if (col >= 76) {
+			fputs("\n ", s);
+			col = 0;
+		}
+		col += 4;
+		fputc(Ref64[src[0] >> 2], s);
+		fputc(Ref64[((src[0] & 0x03) << 4) + (src[1] >> 4)], s);
+		fputc(Ref64[((src[1] & 0x0f) << 2) + (src[2] >> 6)], s);
+		fputc(Ref64[src[2] & 0x3f], s);
+	}
+	if (n) {
+		unsigned char b = n > 1 ? src[1] : 0;
+		fputc(Ref64[src[0] >> 2], s);
+		fputc(Ref64[((src[0] & 0x03) << 4) + (b >> 4)], s);
+		fputc(n > 1 ? Ref64[(b & 0x0f) << 2] : '=', s);
+		fputc('=', s);
+	}
+}
+
+static void
+ref_append_base64(GString *string, unsigned char const *src, size_t n)
+{
+	int col = 0;
+
+	for (; n > 2; n -= 3, src += 3) {
+		if (col >= 76) {
+			g_string_append(string, "\n ");
+			col = 0;
+		}
+		col += 4;
+		g_string_append_c(string, Ref64[src[0] >> 2]);
+		g_string_append_c(
+			string, Ref64[((src[0] & 0x03) << 4) + (src[1] >> 4)]);
+		g_string_append_c(
+			string, Ref64[((src[1] & 0x0f) << 2) + (src[2] >> 6)]);
+		g_string_append_c(string, Ref64[src[2] & 0x3f]);
+	}
+	if (n) {
+		unsigned char b = n > 1 ? src[1] : 0;
+		g_string_append_c(string, Ref64[src[0] >> 2]);
+		g_string_append_c(
+			string, Ref64[((src[0] & 0x03) << 4) + (b >> 4)]);
+		g_string_append_c(
+			string, n > 1 ? Ref64[(b & 0x0f) << 2] : '=');
+		g_string_append_c(string, '=');
+	}
+}
+
+/* Decodes well-formed input only; returns the number of bytes. */
+static int
+ref_read_base64(char const *src, unsigned char *target)
+{
+	int tarindex = 0, state = 0, ch;
+	char *pos;
+
+	while ((ch = *src++) != '\0' && ch != '=') {
+		if (isascii(ch) && isspace(ch))
+			continue;
+		if ( !(pos = strchr(Ref64, ch)))
+			return -1;
+		switch (state) {
+		case 0:
+			target[tarindex] = (pos - Ref64) << 2;
+			break;
+		case 1:
+			target[tarindex++] |= (pos - Ref64) >> 4;
+			target[tarindex] = ((pos - Ref64) & 0x0f) << 4;
+			break;
+		case 2:
+			target[tarindex++] |= (pos - Ref64) >> 2;
+			target[tarindex] = ((pos - Ref64) & 0x03) << 6;
+			break;
+		case 3:
+			target[tarindex++] |= pos - Ref64;
+			break;
+		}
+		state = (state + 1) % 4;
+	}
+	return tarindex;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(char *what, double seconds, size_t bytes, int rounds)
+{
+	printf("%-32s %9.1f MB/s\n",
+	       what,
+	       seconds > 0 ? (double) bytes * rounds / seconds / 1e6 : 0.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t size = argc > 1 ? strtoul(argv[1], 0, 10) : 1 << 20;
+	int rounds = argc > 2 ? atoi(argv[2]) : 50;
+	unsigned char *data = malloc(size + 1);
+	unsigned char *decoded = malloc(size + 1);
+	unsigned int seed = 1;
+	GString *encoded = g_string_new("");
+	GString *check = g_string_new("");
+	char *ref;
+	size_t reflen;
+	FILE *null;
+	double start;
+	size_t i;
+	int r;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+	if (!data || !decoded) syserr();
+	if ( !(null = fopen("/dev/null", "w"))) syserr();
+
+	/* Both encoders and decoders must agree before timing anything. */
+	g_string_append_base64(encoded, data, size);
+	ref_append_base64(check, data, size);
+	if (strcmp(encoded->str, check->str)) {
+		fputs("g_string_append_base64 differs from reference\n",
+		      stderr);
+		return 1;
+	}
+	{
+		FILE *s = open_memstream(&ref, &reflen);
+		if (!s) syserr();
+		print_base64(data, size, s);
+		fclose(s);
+		if (reflen != encoded->len
+		    || memcmp(ref, encoded->str, reflen))
+		{
+			fputs("print_base64 differs from reference\n", stderr);
+			return 1;
+		}
+		free(ref);
+	}
+	if (read_base64(encoded->str, decoded, size + 1) != (int) size
+	    || memcmp(decoded, data, size)
+	    || ref_read_base64(encoded->str, decoded) != (int) size
+	    || memcmp(decoded, data, size))
+	{
+		fputs("read_base64 differs from reference\n", stderr);
+		return 1;
+	}
+
+	printf("%lu bytes, %d rounds\n", (unsigned long) size, rounds);
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		ref_print_base64(data, size, null);
+	report("print_base64 (reference)",
+	       now() - start, size, rounds);
+	start = now();
+	for (r = 0; r < rounds; r++)
+		print_base64(data, size, null);
+	report("print_base64", now() - start, size, rounds);
+
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		g_string_truncate(check, 0);
+		ref_append_base64(check, data, size);
+	}
+	report("g_string_append_base64 (ref.)",
+	       now() - start, size, rounds);
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		g_string_truncate(check, 0);
+		g_string_append_base64(check, data, size);
+	}
+	report("g_string_append_base64",
+	       now() - start, size, rounds);
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		ref_read_base64(encoded->str, decoded);
+	report("read_base64 (reference)",
+	       now() - start, size, rounds);
+	start = now();
+	for (r = 0; r < rounds; r++)
+		read_base64(encoded->str, decoded, size + 1);
+	report("read_base64", now() - start, size, rounds);
+
+	fclose(null);
+	g_string_free(encoded, 1);
+	g_string_free(check, 1);
+	free(data);
+	free(decoded);
+	return 0;
+}
@@ -0,0 +1,552 @@
+/* -*- show-trailing-whitespace: t; indent-tabs: t -*-
+ * Benchmarks for the hot paths of ldapvi that do not need a server.
+ *
+ * Generates synthetic corpora -- many small entries, wide groups,
+ * entries with large binary values and entries deep down a tree --
+ * and times printing them in both syntaxes, reading them back, running
+ * compare_streams over an unchanged and a partly changed copy, and
+ * computing entroids.  Links against the stubs in test_stubs.c.
+ *
+ * usage: bench_ldapvi [SCALE]
+ *
+ * SCALE multiplies the size of every corpus; at 10, the small corpus
+ * has a million entries.
+ */
+#define _GNU_SOURCE
+#include <time.h>
+#include "common.h"
+
+/* Not declared in common.h but has external linkage in parseldif.c */
+int ldif_read_entry(FILE *, long, char **, tentry **, long *);
+
+typedef struct corpus {
+	char *name;
+	int n;			/* entries */
+	void (*make)(tentry *, int);
+} corpus;
+
+typedef struct files {
+	FILE *ldapvi;		/* clean file, ldapvi syntax */
+	FILE *copy;		/* the same again */
+	FILE *changed;		/* ldapvi syntax, every tenth entry changed */
+	FILE *ldif;
+	GArray *offsets;	/* of entries in ldapvi */
+	double ldapvi_time;
+	double ldif_time;
+} files;
+
+static unsigned int seed = 1;
+
+static unsigned int
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Print throughput; BYTES is -1 when only entries count. */
+static void
+report(char *corpus, char *what, double seconds, long bytes, int n)
+{
+	printf("%-8s %-28s ", corpus, what);
+	if (bytes == -1)
+		printf("%14s", "");
+	else
+		printf("%9.1f MB/s",
+		       seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+	printf(" %11.0f entries/s\n", seconds > 0 ? n / seconds : 0.0);
+}
+
+static void
+add_value(tentry *entry, char *ad, char *value, int n)
+{
+	tattribute *a = entry_find_attribute(entry, ad, 1);
+	attribute_append_value(a, value, n == -1 ? strlen(value) : n);
+}
+
+static void
+add_person(tentry *entry, int i)
+{
+	char buf[64];
+
+	add_value(entry, "objectClass", "top", -1);
+	add_value(entry, "objectClass", "person", -1);
+	add_value(entry, "objectClass", "inetOrgPerson", -1);
+	snprintf(buf, sizeof(buf), "user%d", i);
+	add_value(entry, "uid", buf, -1);
+	snprintf(buf, sizeof(buf), "User %d", i);
+	add_value(entry, "cn", buf, -1);
+	snprintf(buf, sizeof(buf), "%d", i);
+	add_value(entry, "sn", buf, -1);
+	snprintf(buf, sizeof(buf), "user%d@example.com", i);
+	add_value(entry, "mail", buf, -1);
+	snprintf(buf, sizeof(buf), "+49 30 %07u", rnd() % 10000000);
+	add_value(entry, "telephoneNumber", buf, -1);
+}
+
+/* many small entries */
+static void
+make_small(tentry *entry, int i)
+{
+	add_person(entry, i);
+}
+
+/* groups with thousands of members */
+static void
+make_wide(tentry *entry, int i)
+{
+	char buf[64];
+	int j;
+
+	add_value(entry, "objectClass", "top", -1);
+	add_value(entry, "objectClass", "groupOfNames", -1);
+	snprintf(buf, sizeof(buf), "group%d", i);
+	add_value(entry, "cn", buf, -1);
+	for (j = 0; j < 10000; j++) {
+		snprintf(buf, sizeof(buf),
+			 "uid=user%d,ou=people,dc=example,dc=com", j);
+		add_value(entry, "member", buf, -1);
+	}
+}
+
+/* entries with a large binary value */
+static void
+make_binary(tentry *entry, int i)
+{
+	char photo[16384];
+	int j;
+
+	add_person(entry, i);
+	for (j = 0; j < sizeof(photo); j++)
+		photo[j] = rnd();
+	add_value(entry, "jpegPhoto", photo, sizeof(photo));
+}
+
+/* entries with long DNs; the depth is added by entry_dn_for */
+static void
+make_deep(tentry *entry, int i)
+{
+	add_value(entry, "objectClass", "top", -1);
+	add_value(entry, "objectClass", "organizationalUnit", -1);
+	add_value(entry, "ou", "level", -1);
+}
+
+static corpus corpora[] = {
+	{"small", 100000, make_small},
+	{"wide", 20, make_wide},
+	{"binary", 2000, make_binary},
+	{"deep", 20000, make_deep}
+};
+
+static char *
+entry_dn_for(corpus *c, int i)
+{
+	GString *dn = g_string_new("");
+	int depth;
+
+	if (c->make != make_deep) {
+		g_string_append_printf(
+			dn, "cn=%s%d,ou=%s,dc=example,dc=com",
+			c->name, i, c->name);
+		return g_string_free(dn, 0);
+	}
+	g_string_append_printf(dn, "ou=level%d", i);
+	for (depth = 1 + i % 32; depth > 0; depth--)
+		g_string_append_printf(dn, ",ou=level%d", depth);
+	g_string_append(dn, ",dc=example,dc=com");
+	return g_string_free(dn, 0);
+}
+
+static FILE *
+tmp(void)
+{
+	FILE *s = tmpfile();
+	if (!s) syserr();
+	return s;
+}
+
+/*
+ * Write corpus C in both syntaxes, timing only the printers.
+ */
+static void
+generate(corpus *c, files *out)
+{
+	int i;
+
+	out->ldapvi = tmp();
+	out->copy = tmp();
+	out->changed = tmp();
+	out->ldif = tmp();
+	out->offsets = g_array_new(0, 0, sizeof(long));
+	out->ldapvi_time = 0;
+	out->ldif_time = 0;
+
+	for (i = 0; i < c->n; i++) {
+		char *dn = entry_dn_for(c, i);
+		tentry *entry = entry_new(dn);
+		long pos = ftell(out->ldapvi);
+		char key[16];
+		double start;
+
+		c->make(entry, i);
+		snprintf(key, sizeof(key), "%d", i);
+		g_array_append_val(out->offsets, pos);
+
+		start = now();
+		print_ldapvi_entry(out->ldapvi, entry, key, 0);
+		out->ldapvi_time += now() - start;
+		start = now();
+		print_ldif_entry(out->ldif, entry, key, 0);
+		out->ldif_time += now() - start;
+
+		print_ldapvi_entry(out->copy, entry, key, 0);
+		if (i % 10 == 0)
+			add_value(entry, "description", "changed", -1);
+		print_ldapvi_entry(out->changed, entry, key, 0);
+		entry_free(entry);
+	}
+	if (fflush(out->ldapvi) || fflush(out->copy)
+	    || fflush(out->changed) || fflush(out->ldif))
+		syserr();
+}
+
+static void
+files_free(files *out)
+{
+	fclose(out->ldapvi);
+	fclose(out->copy);
+	fclose(out->changed);
+	fclose(out->ldif);
+	g_array_free(out->offsets, 1);
+}
+
+static int
+bench_read(char *name, parser_entry read, FILE *s, char *what, int n)
+{
+	char *key;
+	tentry *entry;
+	double start = now();
+	int count = 0;
+
+	rewind(s);
+	for (;;) {
+		key = 0;
+		entry = 0;
+		if (read(s, -1, &key, &entry, 0) == -1) {
+			fprintf(stderr, "%s: %s: parse error\n", name, what);
+			return -1;
+		}
+		if (!key)
+			break;
+		free(key);
+		entry_free(entry);
+		count++;
+	}
+	report(name, what, now() - start, ftell(s), count);
+	if (count != n) {
+		fprintf(stderr, "%s: %s: read %d of %d entries\n",
+			name, what, count, n);
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * Handlers for compare_streams: noop and statistics, as in ldapvi.c.
+ */
+struct statistics {
+	int nchange, nrename, nadd, ndelete;
+};
+
+static int
+noop_change(int key, char *labeldn, char *dn, LDAPMod **mods, void *userdata)
+{
+	return 0;
+}
+
+static int
+noop_rename(int key, char *olddn, tentry *modified, void *userdata)
+{
+	return 0;
+}
+
+static int
+noop_add(int key, char *dn, LDAPMod **mods, void *userdata)
+{
+	return 0;
+}
+
+static int
+noop_delete(int key, char *dn, void *userdata)
+{
+	return 0;
+}
+
+static int
+noop_rename0(int key, char *dn1, char *dn2, int deleteoldrdn, void *userdata)
+{
+	return 0;
+}
+
+static thandler noop_handler = {
+	noop_change,
+	noop_rename,
+	noop_add,
+	noop_delete,
+	noop_rename0
+};
+
+static int
+statistics_change(
+	int key, char *labeldn, char *dn, LDAPMod **mods, void *userdata)
+{
+	struct statistics *st = userdata;
+	st->nchange++;
+	return 0;
+}
+
+static int
+statistics_rename(int key, char *olddn, tentry *modified, void *userdata)
+{
+	struct statistics *st = userdata;
+	st->nrename++;
+	return 0;
+}
+
+static int
+statistics_add(int key, char *dn, LDAPMod **mods, void *userdata)
+{
+	struct statistics *st = userdata;
+	st->nadd++;
+	return 0;
+}
+
+static int
+statistics_delete(int key, char *dn, void *userdata)
+{
+	struct statistics *st = userdata;
+	st->ndelete++;
+	return 0;
+}
+
+static int
+statistics_rename0(
+	int key, char *dn1, char *dn2, int deleteoldrdn, void *userdata)
+{
+	struct statistics *st = userdata;
+	st->nrename++;
+	return 0;
+}
+
+static thandler statistics_handler = {
+	statistics_change,
+	statistics_rename,
+	statistics_add,
+	statistics_delete,
+	statistics_rename0
+};
+
+static int
+bench_compare(char *name, char *what, files *out, FILE *data,
+	      thandler *handler, void *userdata, int n)
+{
+	long pos;
+	long size;
+	double start;
+	int rc;
+
+	rewind(out->ldapvi);
+	rewind(data);
+	start = now();
+	rc = compare_streams(&ldapvi_parser, handler, userdata, out->offsets,
+			     out->ldapvi, data, &pos, 0);
+	size = ftell(data);
+	report(name, what, now() - start, size, n);
+	if (rc) {
+		fprintf(stderr, "%s: %s: compare_streams failed at %ld\n",
+			name, what, pos);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+run_corpus(corpus *c, int scale)
+{
+	struct statistics st;
+	corpus scaled = *c;
+	files out;
+	long size;
+	int rc = 0;
+
+	scaled.n *= scale;
+	generate(&scaled, &out);
+
+	if (fseek(out.ldapvi, 0, SEEK_END) == -1) syserr();
+	size = ftell(out.ldapvi);
+	report(c->name, "print_ldapvi_entry", out.ldapvi_time, size,
+	       scaled.n);
+	if (fseek(out.ldif, 0, SEEK_END) == -1) syserr();
+	size = ftell(out.ldif);
+	report(c->name, "print_ldif_entry", out.ldif_time, size, scaled.n);
+
+	rc |= bench_read(c->name, read_entry, out.ldapvi, "read_entry",
+			 scaled.n);
+	rc |= bench_read(c->name, ldif_read_entry, out.ldif,
+			 "ldif_read_entry", scaled.n);
+
+	rc |= bench_compare(c->name, "compare_streams (unchanged)",
+			    &out, out.copy, &noop_handler, 0, scaled.n);
+	rc |= bench_compare(c->name, "compare_streams (noop)",
+			    &out, out.changed, &noop_handler, 0, scaled.n);
+	memset(&st, 0, sizeof(st));
+	rc |= bench_compare(c->name, "compare_streams (statistics)",
+			    &out, out.changed, &statistics_handler, &st,
+			    scaled.n);
+	if (st.nchange != (scaled.n + 9) / 10
+	    || st.nrename || st.nadd || st.ndelete)
+	{
+		fprintf(stderr, "%s: unexpected changes: %d %d %d %d\n",
+			c->name, st.nchange, st.nrename, st.nadd, st.ndelete);
+		rc = -1;
+	}
+
+	files_free(&out);
+	return rc;
+}
+
+
+/*
+ * compute_entroid, against a schema built in memory as in test_schema.c.
+ */
+static gboolean
+bench_strcaseequal(gconstpointer v, gconstpointer w)
+{
+	return strcasecmp((char *) v, (char *) w) == 0;
+}
+
+static guint
+bench_strcasehash(gconstpointer v)
+{
+	const signed char *p = v;
+	guint32 h = tolower(*p);
+	if (h)
+		for (p += 1; *p != '\0'; p++)
+			h = (h << 5) - h + tolower(*p);
+	return h;
+}
+
+static void
+add_objectclass(tschema *s, const char *def)
+{
+	int code, i;
+	const char *errp;
+	LDAPObjectClass *cls = ldap_str2objectclass(def, &code, &errp, 0);
+	if (!cls) abort();
+	g_hash_table_insert(s->classes, cls->oc_oid, cls);
+	if (cls->oc_names)
+		for (i = 0; cls->oc_names[i]; i++)
+			g_hash_table_insert(s->classes, cls->oc_names[i], cls);
+}
+
+static void
+add_attributetype(tschema *s, const char *def)
+{
+	int code, i;
+	const char *errp;
+	LDAPAttributeType *at = ldap_str2attributetype(def, &code, &errp, 0);
+	if (!at) abort();
+	g_hash_table_insert(s->types, at->at_oid, at);
+	if (at->at_names)
+		for (i = 0; at->at_names[i]; i++)
+			g_hash_table_insert(s->types, at->at_names[i], at);
+}
+
+static tschema *
+make_schema(void)
+{
+	tschema *s = xalloc(sizeof(tschema));
+	s->classes = g_hash_table_new(bench_strcasehash, bench_strcaseequal);
+	s->types = g_hash_table_new(bench_strcasehash, bench_strcaseequal);
+	s->entroids = g_hash_table_new(carray_hash, carray_equal);
+	g_mutex_init(&s->lock);
+
+	add_attributetype(s, "( 2.5.4.0 NAME 'objectClass' )");
+	add_attributetype(s, "( 2.5.4.3 NAME ( 'cn' 'commonName' ) )");
+	add_attributetype(s, "( 2.5.4.4 NAME ( 'sn' 'surname' ) )");
+	add_attributetype(s, "( 2.5.4.35 NAME 'userPassword' )");
+	add_attributetype(s, "( 2.5.4.20 NAME 'telephoneNumber' )");
+	add_attributetype(s, "( 2.5.4.34 NAME 'seeAlso' )");
+	add_attributetype(s, "( 2.5.4.13 NAME 'description' )");
+	add_attributetype(s, "( 0.9.2342.19200300.100.1.1 NAME 'uid' )");
+	add_attributetype(s, "( 0.9.2342.19200300.100.1.3 NAME 'mail' )");
+	add_attributetype(s, "( 0.9.2342.19200300.100.1.60"
+			  " NAME 'jpegPhoto' )");
+	add_attributetype(s, "( 2.16.840.1.113730.3.1.241"
+			  " NAME 'displayName' )");
+
+	add_objectclass(s, "( 2.5.6.0 NAME 'top' ABSTRACT MUST objectClass )");
+	add_objectclass(s, "( 2.5.6.6 NAME 'person' SUP top STRUCTURAL"
+			" MUST ( sn $ cn )"
+			" MAY ( userPassword $ telephoneNumber"
+			" $ seeAlso $ description ) )");
+	add_objectclass(s, "( 2.5.6.7 NAME 'organizationalPerson'"
+			" SUP person STRUCTURAL"
+			" MAY ( telephoneNumber $ seeAlso $ description ) )");
+	add_objectclass(s, "( 2.16.840.1.113730.3.2.2 NAME 'inetOrgPerson'"
+			" SUP organizationalPerson STRUCTURAL"
+			" MAY ( uid $ mail $ jpegPhoto $ displayName ) )");
+	return s;
+}
+
+static void
+bench_entroid(int scale)
+{
+	tschema *schema = make_schema();
+	tentroid *entroid = entroid_new(schema);
+	int n = 100000 * scale;
+	double start = now();
+	int i;
+
+	for (i = 0; i < n; i++) {
+		entroid_reset(entroid);
+		entroid_request_class(entroid, "top");
+		entroid_request_class(entroid, "inetOrgPerson");
+		if (compute_entroid(entroid) == -1) {
+			fputs(entroid->error->str, stderr);
+			exit(1);
+		}
+	}
+	report("schema", "compute_entroid", now() - start, -1, n);
+	entroid_free(entroid);
+	schema_free(schema);
+}
+
+int
+main(int argc, char **argv)
+{
+	int scale = argc > 1 ? atoi(argv[1]) : 1;
+	int rc = 0;
+	int i;
+
+	if (scale < 1) {
+		fputs("usage: bench_ldapvi [SCALE]\n", stderr);
+		return 1;
+	}
+	for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+		corpus *c = &corpora[i];
+		printf("%s: %d entries\n", c->name, c->n * scale);
+		rc |= run_corpus(c, scale);
+	}
+	bench_entroid(scale);
+	return rc ? 1 : 0;
+}
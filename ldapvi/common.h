@@ -25,11 +25,14 @@
 #define LDAP_DEPRECATED 1
 #include <ldap.h>
 #include <ldap_schema.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/termios.h>
 #include <sys/time.h>
@@ -46,6 +49,8 @@
 typedef struct tschema {
 	GHashTable *classes;
 	GHashTable *types;
+	GHashTable *entroids;	/* computed entroids by class list */
+	GMutex lock;		/* protects entroids */
 } tschema;
 
 typedef struct tentroid {
@@ -130,6 +135,14 @@ typedef struct cmdline {
 	int schema_comments;
 	int continuous;
 	int profileonlyp;
+	int page_size;
+	int window;
+	int pipeline;
+	int connections;
+	int transaction;
+	int render_threads;
+	char *index_file;
+	int stats;
 } cmdline;
 
 void init_cmdline(cmdline *cmdline);
@@ -143,6 +156,9 @@ void usage(int fd, int rc);
 typedef struct named_array {
 	char *name;
 	GPtrArray *array;
+	GHashTable *index;	/* built lazily for large arrays, see data.c */
+	int nindexed;		/* array->len when index was last updated */
+	int id;			/* attributes only: ad_intern(name) */
 } named_array;
 
 typedef struct tentry {
@@ -166,19 +182,34 @@ void attribute_free(tattribute *a);
 int attribute_cmp(tattribute *a, tattribute *b);
 
 int named_array_ptr_cmp(const void *aa, const void *bb);
+int attribute_ptr_cmp(const void *aa, const void *bb);
 
+int ad_intern(char *ad);
+int attribute_matchable(tattribute *attribute);
+
+LDAPMod *values2mod(int op, char *ad, GPtrArray *values);
 LDAPMod *attribute2mods(tattribute *attribute);
 LDAPMod **entry2mods(tentry *entry);
+LDAPMod **copy_mods(LDAPMod **mods);
+void mods_free(LDAPMod **mods);
 tattribute *entry_find_attribute(tentry *entry, char *ad, int createp);
 void attribute_append_value(tattribute *attribute, char *data, int n);
 int attribute_find_value(tattribute *attribute, char *data, int n);
 int attribute_remove_value(tattribute *a, char *data, int n);
+guint carray_hash(gconstpointer p);
+gboolean carray_equal(gconstpointer p, gconstpointer q);
 
 struct berval *string2berval(GArray *s);
 struct berval *gstring2berval(GString *s);
 char *array2string(GArray *av);
 void xfree_berval(struct berval *bv);
 
+/*
+ * lex.c
+ */
+int lex_line(FILE *s, char **line);
+int lex_folded(FILE *s);
+
 /*
  * parse.c
  */
@@ -246,6 +277,16 @@ enum frob_rdn_mode {
 };
 int frob_rdn(tentry *entry, char *dn, int mode);
 int process_immediate(tparser *, thandler *, void *, FILE *, long, char *);
+int compare_dumps(tparser *p, thandler *handler, void *userdata,
+		  FILE *clean, FILE *data, long limit);
+#define DUMP_SORT_LIMIT (64 * 1024 * 1024)
+
+typedef struct mapping {
+	char *base;
+	long size;
+} tmapping;
+void map_stream(FILE *f, tmapping *m);
+void unmap_stream(tmapping *m);
 
 
 /*
@@ -272,6 +313,7 @@ void view(char *pathname);
 int pipeview(int *fd);
 void pipeview_wait(int pid);
 char *home_filename(char *name);
+char *terminal_string(char *capname);
 void read_ldapvi_history(void);
 void write_ldapvi_history(void);
 char *ldapvi_getline(char *prompt, char *value);
@@ -318,6 +360,10 @@ void print_ldapvi_rename(FILE *s, char *olddn, char *newdn, int deleteoldrdn);
 void print_ldapvi_add(FILE *s, char *dn, LDAPMod **mods);
 void print_ldapvi_delete(FILE *s, char *dn);
 void print_ldapvi_modrdn(FILE *s, char *olddn, char *newrdn, int deleteoldrdn);
+typedef struct decoded_message tmessage;
+tmessage *message_decode(LDAP *, LDAPMessage *);
+void message_free(tmessage *);
+void print_ldapvi_decoded(FILE *, tmessage *, int key, tentroid *);
 void print_ldapvi_message(FILE *, LDAP *, LDAPMessage *, int key, tentroid *);
 void print_ldif_entry(FILE *s, tentry *entry, char *key, tentroid *);
 void print_ldif_modify(FILE *s, char *dn, LDAPMod **mods);
@@ -325,15 +371,70 @@ void print_ldif_rename(FILE *s, char *olddn, char *newdn, int deleteoldrdn);
 void print_ldif_add(FILE *s, char *dn, LDAPMod **mods);
 void print_ldif_delete(FILE *s, char *dn);
 void print_ldif_modrdn(FILE *s, char *olddn, char *newrdn, int deleteoldrdn);
+void print_ldif_decoded(FILE *, tmessage *, int key, tentroid *);
 void print_ldif_message(FILE *, LDAP *, LDAPMessage *, int key, tentroid *);
 
+/*
+ * stats.c
+ */
+enum stat_timer {
+	STAT_SEARCH, STAT_LDAP_RESULT, STAT_RENDER, STAT_PARSE, STAT_COMPARE,
+	STAT_ADD, STAT_MODIFY, STAT_DELETE, STAT_RENAME,
+	STAT_NTIMERS
+};
+enum stat_counter {
+	STAT_ENTRIES, STAT_BYTES, STAT_FASTCMP_HITS, STAT_FASTCMP_MISSES,
+	STAT_NCOUNTERS
+};
+extern int stats_enabled;
+void stats_enable(int json);
+guint64 stats_now(void);
+void stats_record(enum stat_timer t, guint64 ns);
+void stats_time(enum stat_timer t, guint64 start);
+void stats_add(enum stat_counter c, guint64 n);
+guint64 stats_percentile(enum stat_timer t, double q);
+void stats_print(FILE *s);
+void stats_report(void);
+
+/*
+ * output.c
+ */
+typedef struct output {
+	FILE *s;		/* print into this */
+	FILE *target;
+	int fd;			/* of target, or -1 to write to it directly */
+	long offset;		/* bytes written so far, or -1 if unknown */
+} toutput;
+toutput *output_open(FILE *target);
+long output_tell(toutput *o);
+void output_close(toutput *o);
+
+/*
+ * index.c
+ */
+int index_write(char *file, FILE *s, GArray *offsets);
+GArray *index_read(char *file, FILE *s);
+
 /*
  * search.c
  */
+typedef struct window {
+	int target;		/* position of the first entry, from 1 */
+	int size;		/* entries per window */
+	int count;		/* entries in the list, or 0 if unknown */
+	struct berval *context;	/* from the server, or 0 */
+} twindow;
+
 void discover_naming_contexts(LDAP *ld, GPtrArray *basedns);
 GArray *search(
 	FILE *s, LDAP *ld, cmdline *cmdline, LDAPControl **ctrls, int notty,
-	int ldif);
+	int ldif, GPtrArray *stamps);
+GArray *search_window(
+	FILE *s, LDAP *ld, cmdline *cmdline, LDAPControl **ctrls,
+	twindow *w, GPtrArray *stamps);
+char *entry_stamp(LDAP *ld, LDAPMessage *entry);
+GHashTable *search_changes(
+	LDAP *ld, cmdline *cmdline, LDAPControl **ctrls, GPtrArray *stamps);
 LDAPMessage *get_entry(LDAP *ld, char *dn, LDAPMessage **result);
 
 /*
@@ -17,19 +17,71 @@
  */
 #include "common.h"
 
+/*
+ * Entries are parsed and freed again for every entry compared, so we keep
+ * free lists of recently freed named arrays and values instead of going
+ * through malloc each time.  Arrays that have grown large are not kept.
+ */
+#define POOL_SIZE 4096
+#define POOL_MAX_LEN 1024
+
+static GPtrArray *named_array_pool = 0;
+static GPtrArray *value_pool = 0;
+
+static void *
+pool_get(GPtrArray *pool)
+{
+	if (!pool || !pool->len)
+		return 0;
+	return g_ptr_array_remove_index_fast(pool, pool->len - 1);
+}
+
+static int
+pool_put(GPtrArray **pool, void *x)
+{
+	if (!*pool)
+		*pool = g_ptr_array_new();
+	if ((*pool)->len >= POOL_SIZE)
+		return -1;
+	g_ptr_array_add(*pool, x);
+	return 0;
+}
+
 static named_array *
 named_array_new(char *name)
 {
-	named_array *result = xalloc(sizeof(named_array));
+	named_array *result = pool_get(named_array_pool);
+	if (!result) {
+		result = xalloc(sizeof(named_array));
+		result->array = g_ptr_array_new();
+	}
 	result->name = name;
-	result->array = g_ptr_array_new();
+	result->index = 0;
+	result->nindexed = 0;
+	result->id = 0;
 	return result;
 }
 
+static void
+named_array_drop_index(named_array *na)
+{
+	if (na->index) {
+		g_hash_table_destroy(na->index);
+		na->index = 0;
+	}
+	na->nindexed = 0;
+}
+
 static void
 named_array_free(named_array *na)
 {
 	free(na->name);
+	named_array_drop_index(na);
+	if (na->array->len <= POOL_MAX_LEN) {
+		g_ptr_array_set_size(na->array, 0);
+		if (!pool_put(&named_array_pool, na))
+			return;
+	}
 	g_ptr_array_free(na->array, 1);
 	free(na);
 }
@@ -48,6 +100,93 @@ named_array_ptr_cmp(const void *aa, const void *bb)
 	return named_array_cmp(a, b);
 }
 
+/*
+ * Attribute descriptions are case-insensitive.  ad_intern maps every
+ * description to a small integer, equal for all spellings that differ
+ * only in case, so that attributes can be compared without looking at
+ * their names again.
+ *
+ * Other names of an attribute type from the schema are not merged: the
+ * schema is loaded only in some modes, and the same edit must result in
+ * the same changes either way.
+ *
+ * ad_keys maps descriptions, hashed and compared ignoring case, to IDs;
+ * ad_names holds the first spelling seen per ID, and ad_types the ID of
+ * the description without its options.
+ */
+static GHashTable *ad_keys = 0;
+static GPtrArray *ad_names = 0;
+static GArray *ad_types = 0;
+static GHashTable *ad_unmatchable = 0; /* type IDs */
+
+/*
+ * Types that the standard schemas give no EQUALITY rule, so that their
+ * values cannot be deleted one by one.  Like attribute names, this must
+ * not depend on whether the server schema has been loaded.
+ */
+static char *unmatchable_types[] = {
+	"audio", "0.9.2342.19200300.100.1.55",
+	"photo", "0.9.2342.19200300.100.1.7",
+	"jpegPhoto", "0.9.2342.19200300.100.1.60",
+	"personalSignature", "0.9.2342.19200300.100.1.53",
+	"userPKCS12", "2.16.840.1.113730.3.1.216",
+	0
+};
+
+static guint
+ad_hash(gconstpointer v)
+{
+	const unsigned char *p = v;
+	guint32 h = 0;
+
+	for (; *p; p++)
+		h = (h << 5) - h + g_ascii_tolower(*p);
+	return h;
+}
+
+static gboolean
+ad_equal(gconstpointer v, gconstpointer w)
+{
+	return g_ascii_strcasecmp(v, w) == 0;
+}
+
+int
+ad_intern(char *ad)
+{
+	gpointer found;
+	char *options;
+	char *key;
+	int id;
+	int type;
+
+	if (!ad_keys) {
+		ad_keys = g_hash_table_new(ad_hash, ad_equal);
+		ad_names = g_ptr_array_new();
+		g_ptr_array_add(ad_names, 0);	/* 0 is not a valid ID */
+		ad_types = g_array_new(0, 1, sizeof(int));
+	}
+	if (g_hash_table_lookup_extended(ad_keys, ad, 0, &found))
+		return GPOINTER_TO_INT(found);
+	key = xdup(ad);
+	id = ad_names->len;
+	g_hash_table_insert(ad_keys, key, GINT_TO_POINTER(id));
+	g_ptr_array_add(ad_names, key);
+
+	type = id;
+	if ( (options = strchr(ad, ';'))) {
+		int n = options - ad;
+		char *name = xalloc(n + 1);
+		memcpy(name, ad, n);
+		name[n] = 0;
+		type = ad_intern(name);
+		free(name);
+	}
+	if (ad_types->len < ad_names->len)
+		g_array_set_size(ad_types, ad_names->len);
+	g_array_index(ad_types, int, id) = type;
+	return id;
+}
+
 /*
  * entry
  */
@@ -78,14 +217,38 @@ entry_cmp(tentry *e, tentry *f)
 
 /*
  * value
+ *
+ * Values are kept NUL-terminated, so that a recycled value never shows
+ * the tail of its previous contents to code treating it as a string.
  */
+static GArray *
+value_new(char *data, int n)
+{
+	GArray *value = pool_get(value_pool);
+	if (value)
+		g_array_set_size(value, 0);
+	else
+		value = g_array_sized_new(1, 0, 1, n);
+	g_array_append_vals(value, data, n);
+	return value;
+}
+
+static void
+value_free(GArray *value)
+{
+	if (value->len > POOL_MAX_LEN || pool_put(&value_pool, value))
+		g_array_free(value, 1);
+}
+
 /*
  * attribute
  */
 tattribute *
 attribute_new(char *ad)
 {
-	return (tattribute *) named_array_new(ad);
+	named_array *na = named_array_new(ad);
+	na->id = ad_intern(ad);
+	return (tattribute *) na;
 }
 
 void
@@ -96,34 +259,147 @@ attribute_free(tattribute *attribute)
 	int i;
 
 	for (i = 0; i < n; i++)
-		g_array_free(g_ptr_array_index(values, i), 1);
+		value_free(g_ptr_array_index(values, i));
 	named_array_free((named_array *) attribute);
 }
 
+/*
+ * Attributes are equal if their descriptions are, and otherwise ordered
+ * by name, ignoring case.
+ */
 int
 attribute_cmp(tattribute *a, tattribute *b)
 {
-	return named_array_cmp((named_array *) a, (named_array *) b);
+	if (a->a.id == b->a.id)
+		return 0;
+	return g_ascii_strcasecmp(g_ptr_array_index(ad_names, a->a.id),
+				  g_ptr_array_index(ad_names, b->a.id));
+}
+
+/* Can the server compare values of ATTRIBUTE, as far as we know? */
+int
+attribute_matchable(tattribute *attribute)
+{
+	int type = g_array_index(ad_types, int, attribute->a.id);
+
+	if (!ad_unmatchable) {
+		char **ptr;
+
+		ad_unmatchable = g_hash_table_new(g_direct_hash, g_direct_equal);
+		for (ptr = unmatchable_types; *ptr; ptr++)
+			g_hash_table_insert(ad_unmatchable,
+					    GINT_TO_POINTER(ad_intern(*ptr)),
+					    (void *) 1);
+	}
+	return !g_hash_table_lookup(ad_unmatchable, GINT_TO_POINTER(type));
+}
+
+int
+attribute_ptr_cmp(const void *aa, const void *bb)
+{
+	tattribute *a = *((tattribute **) aa);
+	tattribute *b = *((tattribute **) bb);
+	return attribute_cmp(a, b);
 }
 
 
 /*
  * misc
  */
+
+/*
+ * Entries and attributes with many elements get a hash index, so that
+ * looking up attributes and values (once per line while parsing) does not
+ * make parsing quadratic.  The index is built on first use, kept up to
+ * date by the functions below, and rebuilt if the array has been changed
+ * behind our back.  Attributes are indexed by ID, values by their
+ * contents (mapping to their position).
+ */
+#define INDEX_THRESHOLD 16
+
+guint
+carray_hash(gconstpointer p)
+{
+	const GArray *a = p;
+	guint h = 5381;
+	int i;
+
+	for (i = 0; i < a->len; i++)
+		h = h * 33 + (unsigned char) a->data[i];
+	return h;
+}
+
+gboolean
+carray_equal(gconstpointer p, gconstpointer q)
+{
+	const GArray *a = p;
+	const GArray *b = q;
+	return a->len == b->len && !memcmp(a->data, b->data, a->len);
+}
+
+static void
+entry_update_index(tentry *entry)
+{
+	named_array *na = (named_array *) entry;
+	int i;
+
+	if (na->index && na->nindexed > na->array->len)
+		named_array_drop_index(na);
+	if (!na->index)
+		na->index = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (i = na->nindexed; i < na->array->len; i++) {
+		tattribute *a = g_ptr_array_index(na->array, i);
+		gpointer id = GINT_TO_POINTER(a->a.id);
+		if (!g_hash_table_lookup(na->index, id))
+			g_hash_table_insert(na->index, id, a);
+	}
+	na->nindexed = na->array->len;
+}
+
+static void
+attribute_update_index(tattribute *attribute)
+{
+	named_array *na = (named_array *) attribute;
+	int i;
+
+	if (na->index && na->nindexed > na->array->len)
+		named_array_drop_index(na);
+	if (!na->index)
+		na->index = g_hash_table_new(carray_hash, carray_equal);
+	for (i = na->nindexed; i < na->array->len; i++) {
+		GArray *value = g_ptr_array_index(na->array, i);
+		if (!g_hash_table_lookup_extended(na->index, value, 0, 0))
+			g_hash_table_insert(
+				na->index, value, GINT_TO_POINTER(i));
+	}
+	na->nindexed = na->array->len;
+}
+
 tattribute *
 entry_find_attribute(tentry *entry, char *ad, int createp)
 {
 	GPtrArray *attributes = entry_attributes(entry);
 	tattribute *attribute = 0;
+	int id = ad_intern(ad);
 	int i;
 
-	for (i = 0; i < attributes->len; i++) {
-		tattribute *a = g_ptr_array_index(attributes, i);
-		if (!strcmp(attribute_ad(a), ad)) {
-			attribute = a;
-			break;
+	if (attributes->len >= INDEX_THRESHOLD) {
+		entry_update_index(entry);
+		attribute = g_hash_table_lookup(
+			entry->e.index, GINT_TO_POINTER(id));
+		if (attribute && attribute->a.id != id) {
+			/* stale */
+			named_array_drop_index(&entry->e);
+			return entry_find_attribute(entry, ad, createp);
+		}
+	} else
+		for (i = 0; i < attributes->len; i++) {
+			tattribute *a = g_ptr_array_index(attributes, i);
+			if (a->a.id == id) {
+				attribute = a;
+				break;
+			}
 		}
-	}
 	if (!attribute && createp) {
 		attribute = attribute_new(xdup(ad));
 		g_ptr_array_add(attributes, attribute);
@@ -135,9 +411,7 @@ entry_find_attribute(tentry *entry, char *ad, int createp)
 void
 attribute_append_value(tattribute *attribute, char *data, int n)
 {
-	GArray *value = g_array_sized_new(0, 0, 1, n);
-	g_array_append_vals(value, data, n);
-	g_ptr_array_add(attribute_values(attribute), value);
+	g_ptr_array_add(attribute_values(attribute), value_new(data, n));
 }
 
 int
@@ -145,6 +419,27 @@ attribute_find_value(tattribute *attribute, char *data, int n)
 {
 	int i;
 	GPtrArray *values = attribute_values(attribute);
+
+	if (values->len >= INDEX_THRESHOLD) {
+		GArray probe;
+		gpointer pos;
+		GArray *value;
+
+		attribute_update_index(attribute);
+		probe.data = data;
+		probe.len = n;
+		if (!g_hash_table_lookup_extended(
+			    attribute->a.index, &probe, 0, &pos))
+			return -1;
+		i = GPOINTER_TO_INT(pos);
+		if (i < values->len) {
+			value = values->pdata[i];
+			if (value->len == n && !memcmp(value->data, data, n))
+				return i;
+		}
+		/* stale */
+		named_array_drop_index(&attribute->a);
+	}
 	for (i = 0; i < values->len; i++) {
 		GArray *value = values->pdata[i];
 		if (value->len == n && !memcmp(value->data, data, n))
@@ -158,7 +453,9 @@ attribute_remove_value(tattribute *a, char *data, int n)
 {
 	int i = attribute_find_value(a, data, n);
 	if (i == -1) return i;
-	g_array_free(g_ptr_array_remove_index_fast(attribute_values(a), i), 1);
+	value_free(g_ptr_array_remove_index_fast(attribute_values(a), i));
+	/* positions have changed */
+	named_array_drop_index(&a->a);
 	return 0;
 }
 
@@ -207,25 +504,81 @@ gstring2berval(GString *s)
 	return dup2berval(s->str, s->len);
 }
 
+/*
+ * Each LDAPMod made here lives in a single block: the LDAPMod itself, the
+ * null-terminated berval pointers, the bervals, the attribute description
+ * and the values, which share one buffer.  Building a modification hence
+ * takes one allocation instead of two per value plus three.  Free such
+ * modifications with mods_free, not ldap_mods_free.
+ *
+ * Allocate the block for N values of SIZE bytes in all (not counting the
+ * terminating NULs) and set *DATA to the place for the values.
+ */
+static LDAPMod *
+mod_alloc(int op, char *ad, int n, long size, char **data)
+{
+	long adlen = strlen(ad) + 1;
+	LDAPMod *m = xalloc(sizeof(LDAPMod)
+			    + (n + 1) * sizeof(struct berval *)
+			    + n * sizeof(struct berval)
+			    + adlen + size + n);
+	struct berval **bvs = (struct berval **) (m + 1);
+	struct berval *bv = (struct berval *) (bvs + n + 1);
+	char *ptr = (char *) (bv + n);
+	int i;
+
+	m->mod_op = op | LDAP_MOD_BVALUES;
+	m->mod_type = memcpy(ptr, ad, adlen);
+	m->mod_bvalues = bvs;
+	for (i = 0; i < n; i++)
+		bvs[i] = &bv[i];
+	bvs[n] = 0;
+	*data = ptr + adlen;
+	return m;
+}
+
+/* Append value I of M, returning the place for the next one. */
+static char *
+mod_set_value(LDAPMod *m, int i, char *data, char *value, int len)
+{
+	struct berval *bv = m->mod_bvalues[i];
+
+	bv->bv_val = data;
+	bv->bv_len = len;
+	memcpy(data, value, len);
+	data[len] = 0;
+	return data + len + 1;
+}
+
+/*
+ * Return a modification of type OP for attribute description AD with
+ * VALUES, an array of GArrays.
+ */
 LDAPMod *
-attribute2mods(tattribute *attribute)
+values2mod(int op, char *ad, GPtrArray *values)
 {
-	GPtrArray *values = attribute_values(attribute);
-	LDAPMod *m = xalloc(sizeof(LDAPMod));
-	int j;
-
-	m->mod_op = LDAP_MOD_BVALUES;
-	m->mod_type = xdup(attribute_ad(attribute));
-	m->mod_bvalues = xalloc(
-		(1 + values->len) * sizeof(struct berval *));
-
-	for (j = 0; j < values->len; j++)
-		m->mod_bvalues[j]
-			= string2berval(g_ptr_array_index(values, j));
-	m->mod_bvalues[j] = 0;
+	long size = 0;
+	char *data;
+	LDAPMod *m;
+	int i;
+
+	for (i = 0; i < values->len; i++)
+		size += ((GArray *) values->pdata[i])->len;
+	m = mod_alloc(op, ad, values->len, size, &data);
+	for (i = 0; i < values->len; i++) {
+		GArray *value = values->pdata[i];
+		data = mod_set_value(m, i, data, value->data, value->len);
+	}
 	return m;
 }
 
+LDAPMod *
+attribute2mods(tattribute *attribute)
+{
+	return values2mod(0, attribute_ad(attribute),
+			  attribute_values(attribute));
+}
+
 LDAPMod **
 entry2mods(tentry *entry)
 {
@@ -238,3 +591,50 @@ entry2mods(tentry *entry)
 	result[i] = 0;
 	return result;
 }
+
+/*
+ * Copy a null-terminated LDAPMod array with berval values into
+ * modifications as made by values2mod.
+ */
+LDAPMod **
+copy_mods(LDAPMod **mods)
+{
+	LDAPMod **result;
+	int i, j, n;
+
+	for (n = 0; mods[n]; n++)
+		;
+	result = xalloc((n + 1) * sizeof(LDAPMod *));
+	for (i = 0; i < n; i++) {
+		struct berval **values = mods[i]->mod_bvalues;
+		long size = 0;
+		char *data;
+		LDAPMod *m;
+
+		for (j = 0; values && values[j]; j++)
+			size += values[j]->bv_len;
+		m = mod_alloc(0, mods[i]->mod_type, j, size, &data);
+		m->mod_op = mods[i]->mod_op;
+		if (values)
+			for (j = 0; values[j]; j++)
+				data = mod_set_value(m, j, data,
+						     values[j]->bv_val,
+						     values[j]->bv_len);
+		else
+			m->mod_bvalues = 0;
+		result[i] = m;
+	}
+	result[n] = 0;
+	return result;
+}
+
+/* Free an array of modifications made by values2mod. */
+void
+mods_free(LDAPMod **mods)
+{
+	int i;
+
+	for (i = 0; mods[i]; i++)
+		free(mods[i]);
+	free(mods);
+}
@@ -20,6 +20,17 @@
 
 typedef void (*note_function)(void *, void *, void *);
 
+/* p->entry, timed for --stats */
+static int
+parse_entry(tparser *p, FILE *s, long offset, char **key, tentry **entry,
+	    long *pos)
+{
+	guint64 start = stats_now();
+	int rc = p->entry(s, offset, key, entry, pos);
+	stats_time(STAT_PARSE, start);
+	return rc;
+}
+
 static void
 compare_ptr_arrays(GPtrArray *a, GPtrArray *b,
 		   int (*cmp)(const void *, const void *),
@@ -65,49 +76,151 @@ ordered_array_equal(GPtrArray *a, GPtrArray *b,
 	return 1;
 }
 
+/*
+ * Put each value of VALUES into a new hash set.  Return null if there are
+ * duplicate values.
+ */
+static GHashTable *
+value_set(GPtrArray *values)
+{
+	GHashTable *set = g_hash_table_new(carray_hash, carray_equal);
+	int i;
+
+	for (i = 0; i < values->len; i++) {
+		GArray *value = g_ptr_array_index(values, i);
+		if (g_hash_table_lookup(set, value)) {
+			g_hash_table_destroy(set);
+			return 0;
+		}
+		g_hash_table_insert(set, value, value);
+	}
+	return set;
+}
+
+/*
+ * Try to express the change from OLD to NEW as the deletion of some values
+ * followed by the addition of others.  Since we preserve the order of
+ * values, this is possible only if NEW consists of the remaining values of
+ * OLD in their original order, followed by the added ones.  Return 0 and
+ * fill DELETED and ADDED if so, else return -1.
+ */
+static int
+diff_values(GPtrArray *old, GPtrArray *new,
+	    GPtrArray *deleted, GPtrArray *added)
+{
+	GHashTable *oldset = value_set(old);
+	GHashTable *newset = value_set(new);
+	int i;
+	int j = 0;
+	int rc = -1;
+
+	if (!oldset || !newset)
+		goto cleanup;
+	for (i = 0; i < old->len; i++) {
+		GArray *value = g_ptr_array_index(old, i);
+		if (!g_hash_table_lookup(newset, value))
+			g_ptr_array_add(deleted, value);
+		else if (j < new->len
+			 && carray_equal(value, g_ptr_array_index(new, j)))
+			j++;
+		else
+			goto cleanup;
+	}
+	for (; j < new->len; j++) {
+		GArray *value = g_ptr_array_index(new, j);
+		if (g_hash_table_lookup(oldset, value))
+			goto cleanup;
+		g_ptr_array_add(added, value);
+	}
+	rc = 0;
+
+cleanup:
+	if (oldset) g_hash_table_destroy(oldset);
+	if (newset) g_hash_table_destroy(newset);
+	return rc;
+}
+
+/*
+ * Can the server be asked to delete VALUES one by one?  Not for types
+ * known to have no equality rule, and not for values that are clearly
+ * binary, like photos and certificates, which usually have none either.
+ * This does not consult the server schema, which is loaded only in some
+ * modes, so that the same edit always results in the same changes.
+ */
+static int
+values_matchable(tattribute *attribute, GPtrArray *values)
+{
+	int i;
+
+	if (!attribute_matchable(attribute))
+		return 0;
+	for (i = 0; i < values->len; i++) {
+		GArray *value = g_ptr_array_index(values, i);
+		if (!g_utf8_validate(value->data, value->len, 0))
+			return 0;
+	}
+	return 1;
+}
+
 static void
 compare_attributes(tattribute *clean, tattribute *new, GPtrArray *mods)
 {
-	if (!ordered_array_equal(attribute_values(clean),
-				 attribute_values(new),
-				 carray_ptr_cmp))
+	GPtrArray *deleted;
+	GPtrArray *added;
+	int n = attribute_values(new)->len;
+
+	if (ordered_array_equal(attribute_values(clean),
+				attribute_values(new),
+				carray_ptr_cmp))
+		return;
+
+	/* send only the values that have changed, unless that would
+	 * not be shorter than replacing the attribute */
+	deleted = g_ptr_array_new();
+	added = g_ptr_array_new();
+	if (!diff_values(attribute_values(clean), attribute_values(new),
+			 deleted, added)
+	    && deleted->len + added->len < n
+	    && values_matchable(new, deleted)
+	    && values_matchable(new, added))
 	{
+		if (deleted->len)
+			g_ptr_array_add(
+				mods,
+				values2mod(LDAP_MOD_DELETE,
+					   attribute_ad(new),
+					   deleted));
+		if (added->len)
+			g_ptr_array_add(
+				mods,
+				values2mod(LDAP_MOD_ADD,
+					   attribute_ad(new),
+					   added));
+	} else {
 		LDAPMod *m = attribute2mods(new);
 		m->mod_op |= LDAP_MOD_REPLACE;
 		g_ptr_array_add(mods, m);
 	}
+	g_ptr_array_free(deleted, 1);
+	g_ptr_array_free(added, 1);
 }
 
 static void
 note_attributes(tattribute *a1, tattribute *a2, GPtrArray *mods)
 {
-	tattribute *a;
-	GPtrArray *values;
 	LDAPMod *m;
-	int i;
 
 	if (a1 && a2) {
 		compare_attributes(a1, a2, mods);
 		return;
 	}
 
-	m = xalloc(sizeof(LDAPMod));
-	if (a1) {
-		a = a1;
-		m->mod_op = LDAP_MOD_DELETE;
-	} else {
-		a = a2;
-		m->mod_op = LDAP_MOD_ADD;
-	}
-
-	values = attribute_values(a);
-	m->mod_op |= LDAP_MOD_BVALUES;
-	m->mod_type = xdup(attribute_ad(a));
-	m->mod_bvalues = xalloc((1 + values->len) * sizeof(struct berval *));
-	for (i = 0; i < values->len; i++)
-		m->mod_bvalues[i]
-			= string2berval(g_ptr_array_index(values, i));
-	m->mod_bvalues[values->len] = 0;
+	if (a1)
+		m = values2mod(LDAP_MOD_DELETE, attribute_ad(a1),
+			       attribute_values(a1));
+	else
+		m = values2mod(LDAP_MOD_ADD, attribute_ad(a2),
+			       attribute_values(a2));
 	g_ptr_array_add(mods, m);
 }
 
@@ -115,11 +228,14 @@ static LDAPMod **
 compare_entries(tentry *eclean, tentry *enew)
 {
 	GPtrArray *mods = g_ptr_array_new();
+	guint64 start = stats_now();
+
 	compare_ptr_arrays(entry_attributes(eclean),
 			   entry_attributes(enew),
-			   named_array_ptr_cmp,
+			   attribute_ptr_cmp,
 			   (note_function) note_attributes,
 			   mods);
+	stats_time(STAT_COMPARE, start);
 	if (!mods->len) {
 		g_ptr_array_free(mods, 1);
 		return 0;
@@ -170,6 +286,51 @@ cleanup:
 	return rc;
 }
 
+/*
+ * Map the complete file underlying stream F into memory, read-only.  If
+ * that is not possible (e.g. for an empty file or a pipe), leave the
+ * mapping empty, and mapcmp will fall back to fastcmp.
+ */
+void
+map_stream(FILE *f, tmapping *m)
+{
+	struct stat st;
+	void *base;
+
+	m->base = 0;
+	m->size = 0;
+	if (fstat(fileno(f), &st) == -1 || !S_ISREG(st.st_mode))
+		return;
+	if (st.st_size == 0)
+		return;
+	base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fileno(f), 0);
+	if (base == MAP_FAILED)
+		return;
+	m->base = base;
+	m->size = st.st_size;
+}
+
+void
+unmap_stream(tmapping *m)
+{
+	if (m->base && munmap(m->base, m->size) == -1) syserr();
+	m->base = 0;
+	m->size = 0;
+}
+
+/*
+ * Like fastcmp, but compare directly in the mappings MS and MT of streams
+ * S and T when both segments are mapped.  Data appended to a file after
+ * it has been mapped is read through the stream instead.
+ */
+int
+mapcmp(tmapping *ms, tmapping *mt, FILE *s, FILE *t, long p, long q, long n)
+{
+	if (ms->base && p + n <= ms->size && mt->base && q + n <= mt->size)
+		return memcmp(ms->base + p, mt->base + q, n) != 0;
+	return fastcmp(s, t, p, q, n);
+}
+
 /*
  * Do something with ENTRY and attribute AD, value DATA.
  *
@@ -321,22 +482,22 @@ process_immediate(tparser *p, thandler *handler, void *userdata, FILE *data,
 	if (!strcmp(key, "add")) {
 		tentry *entry;
 		LDAPMod **mods;
-		if (p->entry(data, datapos, 0, &entry, 0) == -1)
+		if (parse_entry(p, data, datapos, 0, &entry, 0) == -1)
 			return -1;
 		mods = entry2mods(entry);
 		if (handler->add(-1, entry_dn(entry), mods, userdata) == -1) {
-			ldap_mods_free(mods, 1);
+			mods_free(mods);
 			entry_free(entry);
 			return -2;
 		}
-		ldap_mods_free(mods, 1);
+		mods_free(mods);
 		entry_free(entry);
 		entry = 0;
 	} else if (!strcmp(key, "replace")) {
 		tentry *entry;
 		LDAPMod **mods;
 		int i;
-		if (p->entry(data, datapos, 0, &entry, 0) == -1)
+		if (parse_entry(p, data, datapos, 0, &entry, 0) == -1)
 			return -1;
 		mods = entry2mods(entry);
 		for (i = 0; mods[i]; i++) {
@@ -349,11 +510,11 @@ process_immediate(tparser *p, thandler *handler, void *userdata, FILE *data,
 				    entry_dn(entry),
 				    mods,
 				    userdata) == -1) {
-			ldap_mods_free(mods, 1);
+			mods_free(mods);
 			entry_free(entry);
 			return -2;
 		}
-		ldap_mods_free(mods, 1);
+		mods_free(mods);
 		entry_free(entry);
 		entry = 0;
 	} else if (!strcmp(key, "rename")) {
@@ -380,13 +541,14 @@ process_immediate(tparser *p, thandler *handler, void *userdata, FILE *data,
 	} else if (!strcmp(key, "modify")) {
 		char *dn;
 		LDAPMod **mods;
+		int rc;
 		if (p->modify(data, datapos, &dn, &mods) ==-1)
 			return -1;
-		if (handler->change(-1, dn, dn, mods, userdata) == -1) {
-			free(dn);
-			ldap_mods_free(mods, 1);
+		rc = handler->change(-1, dn, dn, mods, userdata);
+		free(dn);
+		ldap_mods_free(mods, 1);
+		if (rc == -1)
 			return -2;
-		}
 	} else {
 		fprintf(stderr, "Error: Invalid key: `%s'.\n", key);
 		return -1;
@@ -394,6 +556,130 @@ process_immediate(tparser *p, thandler *handler, void *userdata, FILE *data,
 	return 0;
 }
 
+/*
+ * Cache of modified entries, so that the comparison does not have to be
+ * repeated each time the data file is analyzed, viewed or committed.
+ *
+ * For each key, remember the bytes of the clean and the data entry as
+ * last parsed, plus the resulting modifications.  The bytes are compared
+ * against the mapped files including one character of lookahead (or the
+ * end of the file), so that a hit guarantees that the parser would have
+ * read exactly the same entries again.  Entries that were not mapped,
+ * renames and entries with errors are never cached.
+ */
+struct cached_change {
+	tparser *parser;
+	char *clean;
+	long cleanlen;
+	int cleaneof;
+	char *data;
+	long datalen;
+	int dataeof;
+	char *olddn;
+	char *newdn;
+	LDAPMod **mods;		/* null if the entries are equivalent */
+};
+
+static GHashTable *change_cache = 0;
+
+static void
+cached_change_free(struct cached_change *c)
+{
+	free(c->clean);
+	free(c->data);
+	free(c->olddn);
+	free(c->newdn);
+	if (c->mods) mods_free(c->mods);
+	free(c);
+}
+
+/*
+ * Return the number of bytes to remember for the segment of length LEN at
+ * START in mapping M, or -1 if the segment cannot be cached.
+ */
+static long
+cacheable_segment(tmapping *m, long start, long len, int *eof)
+{
+	if (!m->base || start < 0 || len <= 0)
+		return -1;
+	if (start + len == m->size) {
+		*eof = 1;
+		return len;
+	}
+	*eof = 0;
+	if (start + len + 1 > m->size)
+		return -1;
+	return len + 1;
+}
+
+static int
+segment_unchanged(tmapping *m, long start, char *bytes, long len, int eof)
+{
+	if (!m->base)
+		return 0;
+	if (eof ? start + len != m->size : start + len > m->size)
+		return 0;
+	return !memcmp(m->base + start, bytes, len);
+}
+
+static struct cached_change *
+find_cached_change(tparser *p, int n, tmapping *cleanmap, long pos,
+		   tmapping *datamap, long datapos)
+{
+	struct cached_change *c;
+
+	if (!change_cache)
+		return 0;
+	c = g_hash_table_lookup(change_cache, GINT_TO_POINTER(n));
+	if (!c || c->parser != p)
+		return 0;
+	if (!segment_unchanged(cleanmap, pos, c->clean, c->cleanlen,
+			       c->cleaneof))
+		return 0;
+	if (!segment_unchanged(datamap, datapos, c->data, c->datalen,
+			       c->dataeof))
+		return 0;
+	return c;
+}
+
+static void
+remember_change(tparser *p, int n,
+		tmapping *cleanmap, long pos, long cleanend,
+		tmapping *datamap, long datapos, long dataend,
+		char *olddn, char *newdn, LDAPMod **mods)
+{
+	struct cached_change *c;
+	int cleaneof, dataeof;
+	long cleanlen = cacheable_segment(cleanmap, pos, cleanend - pos,
+					  &cleaneof);
+	long datalen = cacheable_segment(datamap, datapos, dataend - datapos,
+					 &dataeof);
+
+	if (cleanlen == -1 || datalen == -1) {
+		if (mods) mods_free(mods);
+		return;
+	}
+	if (!change_cache)
+		change_cache = g_hash_table_new_full(
+			g_direct_hash, g_direct_equal,
+			0, (GDestroyNotify) cached_change_free);
+
+	c = xalloc(sizeof(struct cached_change));
+	c->parser = p;
+	c->clean = xalloc(cleanlen);
+	memcpy(c->clean, cleanmap->base + pos, cleanlen);
+	c->cleanlen = cleanlen;
+	c->cleaneof = cleaneof;
+	c->data = xalloc(datalen);
+	memcpy(c->data, datamap->base + datapos, datalen);
+	c->datalen = datalen;
+	c->dataeof = dataeof;
+	c->olddn = xdup(olddn);
+	c->newdn = xdup(newdn);
+	c->mods = mods;
+	g_hash_table_replace(change_cache, GINT_TO_POINTER(n), c);
+}
+
 /*
  * read the next entry from `data', its clean copy from `clean', process
  * them as described for compare_streams, and return
@@ -404,13 +690,16 @@ process_immediate(tparser *p, thandler *handler, void *userdata, FILE *data,
 static int
 process_next_entry(
 	tparser *p, thandler *handler, void *userdata, GArray *offsets,
-	FILE *clean, FILE *data, char *key, long datapos)
+	FILE *clean, FILE *data, tmapping *cleanmap, tmapping *datamap,
+	char *key, long datapos)
 {
 	tentry *entry = 0;
 	tentry *cleanentry = 0;
+	struct cached_change *cached;
 	int rc = -1;
 	LDAPMod **mods;
 	long pos;
+	long cleanend, dataend;
 	char *ptr;
 	int n;
 	int rename, deleteoldrdn;
@@ -431,13 +720,15 @@ process_next_entry(
 	}
 
 	/* find precise position */
-	if (p->entry(clean, pos, 0, 0, &pos) == -1) abort();
+	if (parse_entry(p, clean, pos, 0, 0, &pos) == -1) abort();
 	/* fast comparison */
 	if (n + 1 < offsets->len) {
 		long next = g_array_index(offsets, long, n + 1);
 		if (next >= 0
-		    && !fastcmp(clean, data, pos, datapos, next-pos+1))
+		    && !mapcmp(cleanmap, datamap, clean, data,
+			       pos, datapos, next-pos+1))
 		{
+			stats_add(STAT_FASTCMP_HITS, 1);
 			datapos += next - pos;
 			long_array_invert(offsets, n);
 			if (fseek(data, datapos, SEEK_SET) == -1)
@@ -446,11 +737,30 @@ process_next_entry(
 		}
 	}
 
+	stats_add(STAT_FASTCMP_MISSES, 1);
+
 	/* if we get here, a quick scan found a difference in the
-	 * files, so we need to read the entries and compare them */
-	if (p->entry(data, datapos, 0, &entry, 0) == -1)
+	 * files.  If we have compared the same two entries before, replay
+	 * the result.  Otherwise read the entries and compare them. */
+	if ( (cached = find_cached_change(
+		      p, n, cleanmap, pos, datamap, datapos)))
+	{
+		long end = datapos + cached->datalen - !cached->dataeof;
+		if (fseek(data, end, SEEK_SET) == -1)
+			syserr();
+		if (cached->mods
+		    && handler->change(n, cached->olddn, cached->newdn,
+				       cached->mods, userdata)
+		       == -1)
+			return -2;
+		long_array_invert(offsets, n);
+		return 0;
+	}
+	if (parse_entry(p, data, datapos, 0, &entry, 0) == -1)
 		goto cleanup;
-	if (p->entry(clean, pos, 0, &cleanentry, 0) == -1) abort();
+	if ( (dataend = ftell(data)) == -1) syserr();
+	if (parse_entry(p, clean, pos, 0, &cleanentry, 0) == -1) abort();
+	if ( (cleanend = ftell(clean)) == -1) syserr();
 
 	/* compare and update */
 	if ( (rename = strcmp(entry_dn(cleanentry), entry_dn(entry)))){
@@ -474,15 +784,20 @@ process_next_entry(
 				    userdata)
 		    == -1)
 		{
-			if (mods) ldap_mods_free(mods, 1);
+			if (mods) mods_free(mods);
 			if (rename)
 				update_clean_copy(
 					offsets, key, clean, cleanentry, p);
 			rc = -2;
 			goto cleanup;
 		}
-		ldap_mods_free(mods, 1);
 	}
+	if (rename) {
+		if (mods) mods_free(mods);
+	} else
+		remember_change(p, n, cleanmap, pos, cleanend,
+				datamap, datapos, dataend,
+				entry_dn(cleanentry), entry_dn(entry), mods);
 
 	/* mark as seen */
 	long_array_invert(offsets, n);
@@ -504,18 +819,13 @@ cleanup:
 }
 
 static int
-nonleaf_action(tentry *entry, GArray *offsets, int n)
+nonleaf_action(char *dn, int more)
 {
-	int i;
-
-	printf("Error: Cannot delete non-leaf entry: %s\n", entry_dn(entry));
+	printf("Error: Cannot delete non-leaf entry: %s\n", dn);
 
-	for (i = n + 1; i < offsets->len; i++) {
-		if (g_array_index(offsets, long, n) >= 0)
-			goto more_deletions;
-	}
 	/* no more deletions anyway, so no need to ignore this one */
-	return 0;
+	if (!more)
+		return 0;
 
 more_deletions:
 	switch (choose("Continue?", "yn!Q?", "(Type '?' for help.)")) {
@@ -541,9 +851,44 @@ more_deletions:
 	return 0;
 }
 
+struct deletion {
+	int n;			/* key */
+	int depth;		/* number of RDNs */
+	char *dn;
+};
+
+static int
+cmp_deletions(const void *a, const void *b)
+{
+	struct deletion *x = *((struct deletion **) a);
+	struct deletion *y = *((struct deletion **) b);
+
+	if (x->depth != y->depth)
+		return y->depth - x->depth;
+	return x->n - y->n;
+}
+
+static int
+dn_depth(char *dn)
+{
+	char **rdns = ldap_explode_dn(dn, 0);
+	int depth = 0;
+
+	if (!rdns)
+		return 0;
+	while (rdns[depth])
+		depth++;
+	ldap_value_free(rdns);
+	return depth;
+}
+
 /*
  * process deletions as described for compare_streams.
  * return 0 on success, -2 else.
+ *
+ * Entries are deleted deepest first, so that children are always gone
+ * by the time their parent is deleted.  A non-leaf error therefore means
+ * that the entry has children which are not being deleted.
  */
 static int
 process_deletions(tparser *p,
@@ -552,58 +897,73 @@ process_deletions(tparser *p,
 		  GArray *offsets,
 		  FILE *clean)
 {
+	GPtrArray *deletions = g_ptr_array_new();
 	tentry *cleanentry = 0;
 	long pos;
+	int i;
 	int n;
 	int ignore_nonleaf = 0;
-	int n_leaf;
-	int n_nonleaf;
-
-	do {
-		if (ignore_nonleaf)
-			printf("Retrying %d failed deletion%s...\n",
-			       n_nonleaf,
-			       n_nonleaf == 1 ? "" : "s");
-		n_leaf = 0;
-		n_nonleaf = 0;
-		for (n = 0; n < offsets->len; n++) {
-			if ( (pos = g_array_index(offsets, long, n)) < 0)
-				continue;
-			if (p->entry(clean, pos, 0, &cleanentry, 0) == -1)
-				abort();
-			switch (handler->delete(
-					n, entry_dn(cleanentry), userdata))
-			{
-			case -1:
-				entry_free(cleanentry);
-				return -2;
-			case -2:
-				if (ignore_nonleaf) {
-					printf("Skipping non-leaf entry: %s\n",
-					       entry_dn(cleanentry));
-					n_nonleaf++;
-					break;
-				}
-				switch (nonleaf_action(cleanentry,offsets,n)) {
-				case 0:
-					entry_free(cleanentry);
-					return -2;
-				case 2:
-					ignore_nonleaf = 1;
-					/* fall through */
-				case 1:
-					n_nonleaf++;
-				}
+	int n_nonleaf = 0;
+	int more;
+	int rc = 0;
+
+	for (n = 0; n < offsets->len; n++) {
+		struct deletion *d;
+
+		if ( (pos = g_array_index(offsets, long, n)) < 0)
+			continue;
+		if (parse_entry(p, clean, pos, 0, &cleanentry, 0) == -1)
+			abort();
+		d = xalloc(sizeof(struct deletion));
+		d->n = n;
+		d->dn = xdup(entry_dn(cleanentry));
+		d->depth = dn_depth(d->dn);
+		g_ptr_array_add(deletions, d);
+		entry_free(cleanentry);
+	}
+	qsort(deletions->pdata, deletions->len, sizeof(void *),
+	      cmp_deletions);
+
+	for (i = 0; i < deletions->len; i++) {
+		struct deletion *d = g_ptr_array_index(deletions, i);
+
+		switch (handler->delete(d->n, d->dn, userdata)) {
+		case -1:
+			rc = -2;
+			goto cleanup;
+		case -2:
+			if (ignore_nonleaf) {
+				printf("Skipping non-leaf entry: %s\n", d->dn);
+				n_nonleaf++;
 				break;
-			default:
-				n_leaf++;
-				long_array_invert(offsets, n);
 			}
-			entry_free(cleanentry);
+			more = i + 1 < deletions->len;
+			switch (nonleaf_action(d->dn, more)) {
+			case 0:
+				rc = -2;
+				goto cleanup;
+			case 2:
+				ignore_nonleaf = 1;
+				/* fall through */
+			case 1:
+				n_nonleaf++;
+			}
+			break;
+		default:
+			long_array_invert(offsets, d->n);
 		}
-	} while (ignore_nonleaf && n_nonleaf > 0 && n_leaf > 0);
+	}
+	if (n_nonleaf)
+		rc = -2;
 
-	return n_nonleaf ? -2 : 0;
+cleanup:
+	for (i = 0; i < deletions->len; i++) {
+		struct deletion *d = g_ptr_array_index(deletions, i);
+		free(d->dn);
+		free(d);
+	}
+	g_ptr_array_free(deletions, 1);
+	return rc;
 }
 
 /*
@@ -669,7 +1029,11 @@ compare_streams(tparser *p,
 	char *key = 0;
 	int n;
 	int rc;
+	tmapping cleanmap;
+	tmapping datamap;
 
+	map_stream(clean, &cleanmap);
+	map_stream(data, &datamap);
 	for (;;) {
 		long datapos;
 
@@ -682,7 +1046,7 @@ compare_streams(tparser *p,
 		/* and do something with it */
 		if ( (rc = process_next_entry(
 			      p, handler, userdata, offsets, clean, data,
-			      key, datapos)))
+			      &cleanmap, &datamap, key, datapos)))
 			goto cleanup;
 	}
 	if ( (*error_position = ftell(data)) == -1) syserr();
@@ -691,6 +1055,8 @@ compare_streams(tparser *p,
 
 cleanup:
 	if (key) free(key);
+	unmap_stream(&cleanmap);
+	unmap_stream(&datamap);
 
 	if (syntax_error_position)
 		if ( (*syntax_error_position = ftell(data)) == -1) syserr();
@@ -704,3 +1070,585 @@ cleanup:
 			long_array_invert(offsets, n);
 	return rc;
 }
+
+/*
+ * Comparison of two LDIF dumps.
+ *
+ * compare_streams needs a clean file of numbered entries, which it reads
+ * in random order.  Dumps taken independently from two servers have
+ * neither property, so compare_dumps sorts both files by DN instead,
+ * writing sorted runs of at most LIMIT bytes of entries to temporary
+ * files, and merges the two sorted streams.  All I/O is sequential.
+ *
+ * To bound the number of open files, no more than DUMP_MERGE_FANIN runs
+ * are kept per dump.  Whenever another run would exceed that, the
+ * smallest runs are merged into one first.
+ *
+ * The sort key of an entry is its DN in LDAPv3 syntax, lower-cased,
+ * with the RDNs in reverse order and separated by \001.  Every entry
+ * hence sorts right after its superior and before the next sibling of
+ * its superior, so that the entries of a subtree are contiguous.
+ */
+typedef struct dump_item {
+	char *key;
+	tentry *entry;
+} dump_item;
+
+typedef struct dump_run {
+	FILE *s;		/* sorted entries, or 0 ... */
+	GPtrArray *items;	/* ... if they still are in memory */
+	int next;		/* index into items */
+	int level;		/* number of merges that went into the run */
+	dump_item head;		/* head.key is 0 when done */
+} dump_run;
+
+typedef struct dump {
+	tparser *p;
+	GPtrArray *heap;	/* of dump_run, ordered by head.key */
+	dump_item current;
+} tdump;
+
+#define DUMP_SEPARATOR '\001'
+#define DUMP_MERGE_FANIN 16
+
+char *
+dump_key(char *dn)
+{
+	GString *key = g_string_new("");
+	LDAPDN ldn;
+	char *ptr;
+	int i;
+
+	if (ldap_str2dn(dn, &ldn, LDAP_DN_FORMAT_LDAP) != LDAP_SUCCESS) {
+		g_string_free(key, 1);
+		return 0;
+	}
+	for (i = 0; ldn && ldn[i]; i++)
+		;
+	while (i-- > 0) {
+		char *str;
+		if (ldap_rdn2str(ldn[i], &str, LDAP_DN_FORMAT_LDAPV3)
+		    != LDAP_SUCCESS)
+		{
+			ldap_dnfree(ldn);
+			g_string_free(key, 1);
+			return 0;
+		}
+		if (key->len)
+			g_string_append_c(key, DUMP_SEPARATOR);
+		g_string_append(key, str);
+		ldap_memfree(str);
+	}
+	if (ldn) ldap_dnfree(ldn);
+	for (ptr = key->str; *ptr; ptr++)
+		*ptr = tolower((unsigned char) *ptr);
+	return g_string_free(key, 0);
+}
+
+static int
+dump_key_below(char *key, char *superior)
+{
+	int n = strlen(superior);
+	if (!n)
+		return *key != 0;
+	return !strncmp(key, superior, n) && key[n] == DUMP_SEPARATOR;
+}
+
+static long
+dump_entry_size(tentry *entry)
+{
+	GPtrArray *attributes = entry_attributes(entry);
+	long size = sizeof(tentry) + strlen(entry_dn(entry));
+	int i, j;
+
+	for (i = 0; i < attributes->len; i++) {
+		tattribute *a = g_ptr_array_index(attributes, i);
+		GPtrArray *values = attribute_values(a);
+		size += sizeof(tattribute) + strlen(attribute_ad(a));
+		for (j = 0; j < values->len; j++) {
+			GArray *av = g_ptr_array_index(values, j);
+			size += sizeof(GArray) + av->len;
+		}
+	}
+	return size;
+}
+
+/*
+ * Read the next entry from S into ITEM.  At EOF, set item->key to 0.
+ * Return 0 on success, -1 on error.
+ */
+static int
+dump_read(tparser *p, FILE *s, dump_item *item)
+{
+	char *key = 0;
+	char *ptr;
+
+	item->key = 0;
+	item->entry = 0;
+	if (parse_entry(p, s, -1, &key, &item->entry, 0) == -1)
+		return -1;
+	if (!key)
+		return 0;
+	if (strcmp(key, "add")) {
+		strtol(key, &ptr, 10);
+		if (!*key || *ptr) {
+			fprintf(stderr,
+				"Error: Not an attrval record: `%s'.\n",
+				key);
+			free(key);
+			entry_free(item->entry);
+			item->entry = 0;
+			return -1;
+		}
+	}
+	free(key);
+	if ( !(item->key = dump_key(entry_dn(item->entry)))) {
+		fprintf(stderr,
+			"Error: Invalid distinguished name: `%s'.\n",
+			entry_dn(item->entry));
+		entry_free(item->entry);
+		item->entry = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+dump_item_free(dump_item *item)
+{
+	if (item->key) free(item->key);
+	if (item->entry) entry_free(item->entry);
+	item->key = 0;
+	item->entry = 0;
+}
+
+static int
+dump_item_cmp(const void *a, const void *b)
+{
+	dump_item *x = *((dump_item **) a);
+	dump_item *y = *((dump_item **) b);
+	return strcmp(x->key, y->key);
+}
+
+static int
+run_advance(dump_run *run)
+{
+	if (run->s)
+		return dump_read(&ldif_parser, run->s, &run->head);
+	if (run->next < run->items->len) {
+		dump_item *item = g_ptr_array_index(run->items, run->next++);
+		run->head = *item;
+		free(item);
+	} else {
+		run->head.key = 0;
+		run->head.entry = 0;
+	}
+	return 0;
+}
+
+static void
+run_free(dump_run *run)
+{
+	int i;
+
+	dump_item_free(&run->head);
+	if (run->s && fclose(run->s) == EOF) syserr();
+	if (run->items) {
+		for (i = run->next; i < run->items->len; i++) {
+			dump_item *item = g_ptr_array_index(run->items, i);
+			dump_item_free(item);
+			free(item);
+		}
+		g_ptr_array_free(run->items, 1);
+	}
+	free(run);
+}
+
+#define HEAD(heap, i) \
+	(((dump_run *) g_ptr_array_index((heap), (i)))->head.key)
+
+static void
+heap_swap(GPtrArray *heap, int i, int j)
+{
+	void *tmp = heap->pdata[i];
+	heap->pdata[i] = heap->pdata[j];
+	heap->pdata[j] = tmp;
+}
+
+static void
+heap_up(GPtrArray *heap, int i)
+{
+	while (i > 0 && strcmp(HEAD(heap, i), HEAD(heap, (i - 1) / 2)) < 0) {
+		heap_swap(heap, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void
+heap_down(GPtrArray *heap, int i)
+{
+	for (;;) {
+		int min = i;
+		int l = 2 * i + 1;
+		int r = l + 1;
+		if (l < heap->len && strcmp(HEAD(heap, l), HEAD(heap, min)) < 0)
+			min = l;
+		if (r < heap->len && strcmp(HEAD(heap, r), HEAD(heap, min)) < 0)
+			min = r;
+		if (min == i)
+			break;
+		heap_swap(heap, i, min);
+		i = min;
+	}
+}
+
+/*
+ * Finish writing the temporary file of RUN and read its first entry.
+ */
+static int
+run_rewind(dump_run *run)
+{
+	fputc('\n', run->s);
+	if (fflush(run->s) == EOF) syserr();
+	rewind(run->s);
+	return run_advance(run);
+}
+
+static void
+dump_close(tdump *d)
+{
+	int i;
+
+	for (i = 0; i < d->heap->len; i++)
+		run_free(g_ptr_array_index(d->heap, i));
+	g_ptr_array_free(d->heap, 1);
+	dump_item_free(&d->current);
+}
+
+/*
+ * Make the next entry of D, in order, the current one, freeing the
+ * previous one.  At the end, d->current.key is 0.
+ */
+static int
+dump_next(tdump *d)
+{
+	dump_run *run;
+
+	if (!d->heap->len) {
+		dump_item_free(&d->current);
+		return 0;
+	}
+	run = g_ptr_array_index(d->heap, 0);
+	if (d->current.key && !strcmp(d->current.key, run->head.key)) {
+		fprintf(stderr,
+			"Error: Duplicate entry: `%s'.\n",
+			entry_dn(run->head.entry));
+		return -1;
+	}
+	dump_item_free(&d->current);
+	d->current = run->head;
+	if (run_advance(run) == -1) {
+		run->head.key = 0;
+		run->head.entry = 0;
+		return -1;
+	}
+	if (!run->head.key) {
+		heap_swap(d->heap, 0, d->heap->len - 1);
+		run_free(g_ptr_array_remove_index(d->heap, d->heap->len - 1));
+	}
+	if (d->heap->len)
+		heap_down(d->heap, 0);
+	return 0;
+}
+
+/*
+ * Replace the runs of D from index FROM on by a single run in a temporary
+ * file, merging their entries.
+ */
+static int
+dump_merge_runs(tdump *d, int from)
+{
+	dump_run *run = xalloc(sizeof(dump_run));
+	tdump m;
+	int i;
+
+	m.p = d->p;
+	m.heap = g_ptr_array_new();
+	m.current.key = 0;
+	m.current.entry = 0;
+	/* runs are in order of decreasing level, see dump_add_run */
+	run->level = ((dump_run *) g_ptr_array_index(d->heap, from))->level;
+	for (i = from; i < d->heap->len; i++) {
+		dump_run *r = g_ptr_array_index(d->heap, i);
+		if (i == d->heap->len - 1 && r->level == run->level)
+			run->level++;
+		g_ptr_array_add(m.heap, r);
+		heap_up(m.heap, m.heap->len - 1);
+	}
+	g_ptr_array_set_size(d->heap, from);
+
+	if ( !(run->s = tmpfile())) syserr();
+	run->items = 0;
+	run->next = 0;
+	run->head.key = 0;
+	run->head.entry = 0;
+	for (;;) {
+		if (dump_next(&m) == -1) {
+			dump_close(&m);
+			run_free(run);
+			return -1;
+		}
+		if (!m.current.key)
+			break;
+		print_ldif_entry(run->s, m.current.entry, 0, 0);
+	}
+	dump_close(&m);
+	if (run_rewind(run) == -1) {
+		run_free(run);
+		return -1;
+	}
+	g_ptr_array_add(d->heap, run);
+	return 0;
+}
+
+/*
+ * Sort ITEMS and add them to the runs of D.  Unless INMEMORY is set,
+ * write the run to a temporary file first.
+ *
+ * The runs are kept in order of decreasing level until dump_open is
+ * done, so that merging the runs at the end that share the lowest level
+ * combines runs of similar size.
+ */
+static int
+dump_add_run(tdump *d, GPtrArray *items, int inmemory)
+{
+	dump_run *run = xalloc(sizeof(dump_run));
+	int i;
+
+	g_ptr_array_sort(items, dump_item_cmp);
+	run->next = 0;
+	run->level = 0;
+	run->head.key = 0;
+	run->head.entry = 0;
+	if (inmemory) {
+		run->s = 0;
+		run->items = items;
+		if (run_advance(run) == -1) {
+			run_free(run);
+			return -1;
+		}
+	} else {
+		if (d->heap->len == DUMP_MERGE_FANIN - 1) {
+			int from = d->heap->len - 1;
+			int level = ((dump_run *) g_ptr_array_index(
+					     d->heap, from))->level;
+			while (from > 0
+			       && ((dump_run *) g_ptr_array_index(
+					   d->heap, from - 1))->level == level)
+				from--;
+			if (from == d->heap->len - 1)
+				from--;
+			if (dump_merge_runs(d, from) == -1) {
+				for (i = 0; i < items->len; i++) {
+					dump_item_free(
+						g_ptr_array_index(items, i));
+					free(g_ptr_array_index(items, i));
+				}
+				g_ptr_array_free(items, 1);
+				free(run);
+				return -1;
+			}
+		}
+		if ( !(run->s = tmpfile())) syserr();
+		run->items = 0;
+		for (i = 0; i < items->len; i++) {
+			dump_item *item = g_ptr_array_index(items, i);
+			print_ldif_entry(run->s, item->entry, 0, 0);
+			dump_item_free(item);
+			free(item);
+		}
+		g_ptr_array_free(items, 1);
+		if (run_rewind(run) == -1) {
+			run_free(run);
+			return -1;
+		}
+	}
+	g_ptr_array_add(d->heap, run);
+	return 0;
+}
+
+/*
+ * Read all entries from stream S using parser P and split them into
+ * sorted runs.  If everything fits into LIMIT bytes, keep the only run
+ * in memory.
+ */
+static int
+dump_open(tdump *d, tparser *p, FILE *s, long limit)
+{
+	GPtrArray *items = g_ptr_array_new();
+	long size = 0;
+	int i;
+
+	d->p = p;
+	d->heap = g_ptr_array_new();
+	d->current.key = 0;
+	d->current.entry = 0;
+	for (;;) {
+		dump_item item;
+
+		if (dump_read(p, s, &item) == -1)
+			goto error;
+		if (item.key) {
+			dump_item *copy = xalloc(sizeof(dump_item));
+			*copy = item;
+			g_ptr_array_add(items, copy);
+			size += dump_entry_size(item.entry);
+		}
+		if (items->len && (!item.key || size >= limit)) {
+			int inmemory = !item.key && !d->heap->len;
+			if (dump_add_run(d, items, inmemory) == -1) {
+				items = 0;
+				goto error;
+			}
+			items = g_ptr_array_new();
+			size = 0;
+		}
+		if (!item.key)
+			break;
+	}
+	g_ptr_array_free(items, 1);
+	for (i = 1; i < d->heap->len; i++)
+		heap_up(d->heap, i);
+	return 0;
+
+error:
+	if (items) {
+		for (i = 0; i < items->len; i++) {
+			dump_item_free(g_ptr_array_index(items, i));
+			free(g_ptr_array_index(items, i));
+		}
+		g_ptr_array_free(items, 1);
+	}
+	dump_close(d);
+	d->heap = 0;
+	return -1;
+}
+
+/*
+ * Delete the entries on stack DELETIONS that are not superiors of KEY
+ * (all of them if KEY is 0), subordinates first.
+ */
+static int
+flush_deletions(thandler *handler, void *userdata, GPtrArray *deletions,
+		char *key)
+{
+	while (deletions->len) {
+		dump_item *top = g_ptr_array_index(
+			deletions, deletions->len - 1);
+		int rc;
+
+		if (key && dump_key_below(key, top->key))
+			break;
+		rc = handler->delete(-1, entry_dn(top->entry), userdata);
+		g_ptr_array_remove_index(deletions, deletions->len - 1);
+		dump_item_free(top);
+		free(top);
+		if (rc)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Compare the LDIF dumps CLEAN and DATA, which can list their entries
+ * in any order, and call HANDLER for the differences as described for
+ * compare_streams.  Both files are sorted in runs of at most LIMIT bytes.
+ *
+ * Entries are matched by DN, ignoring case.  Entries only present in
+ * CLEAN are deleted (subordinates first), those only present in DATA
+ * are added (superiors first).  No renames are reported.
+ *
+ * Return 0 on success, -1 on parse error, -2 on handler failure.
+ */
+int
+compare_dumps(tparser *p, thandler *handler, void *userdata,
+	      FILE *clean, FILE *data, long limit)
+{
+	GPtrArray *deletions = g_ptr_array_new();
+	tdump a, b;
+	int rc = -1;
+
+	if (dump_open(&a, p, clean, limit) == -1) {
+		g_ptr_array_free(deletions, 1);
+		return -1;
+	}
+	if (dump_open(&b, p, data, limit) == -1) {
+		dump_close(&a);
+		g_ptr_array_free(deletions, 1);
+		return -1;
+	}
+	if (dump_next(&a) == -1 || dump_next(&b) == -1)
+		goto cleanup;
+
+	while (a.current.key || b.current.key) {
+		dump_item *x = &a.current;
+		dump_item *y = &b.current;
+		int c = !x->key ? 1 : !y->key ? -1 : strcmp(x->key, y->key);
+		LDAPMod **mods;
+
+		if (flush_deletions(handler, userdata, deletions,
+				    c <= 0 ? x->key : y->key)
+		    == -1)
+		{
+			rc = -2;
+			goto cleanup;
+		}
+		if (c < 0) {
+			dump_item *item = xalloc(sizeof(dump_item));
+			item->key = xdup(x->key);
+			item->entry = x->entry;
+			x->entry = 0;
+			g_ptr_array_add(deletions, item);
+		} else if (c > 0) {
+			mods = entry2mods(y->entry);
+			if (handler->add(-1, entry_dn(y->entry), mods, userdata)
+			    == -1)
+			{
+				mods_free(mods);
+				rc = -2;
+				goto cleanup;
+			}
+			mods_free(mods);
+		} else if ( (mods = compare_entries(x->entry, y->entry))) {
+			if (handler->change(-1,
+					    entry_dn(x->entry),
+					    entry_dn(x->entry),
+					    mods,
+					    userdata)
+			    == -1)
+			{
+				mods_free(mods);
+				rc = -2;
+				goto cleanup;
+			}
+			mods_free(mods);
+		}
+		if (c <= 0 && dump_next(&a) == -1)
+			goto cleanup;
+		if (c >= 0 && dump_next(&b) == -1)
+			goto cleanup;
+	}
+	rc = flush_deletions(handler, userdata, deletions, 0) ? -2 : 0;
+
+cleanup:
+	while (deletions->len) {
+		dump_item *item = g_ptr_array_remove_index(
+			deletions, deletions->len - 1);
+		dump_item_free(item);
+		free(item);
+	}
+	g_ptr_array_free(deletions, 1);
+	dump_close(&a);
+	dump_close(&b);
+	return rc;
+}
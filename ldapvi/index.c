@@ -0,0 +1,148 @@
+/* -*- show-trailing-whitespace: t; indent-tabs: t -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "common.h"
+
+/*
+ * Index files.
+ *
+ * An index describes a file of numbered entries as written by search():
+ * a header identifying the file by inode, size and modification time,
+ * followed by one record per entry, in key order.  Each record holds the
+ * offset and length of the entry.  Unchanged entries are recognized by
+ * comparing their bytes (see mapcmp), so no digests are kept.
+ *
+ * Indexes are written in the byte order of the host.  They are only a
+ * shortcut for reading the file itself, so a missing, foreign or stale
+ * index is simply ignored.
+ */
+#define INDEX_MAGIC "ldapvi\0\2"
+
+struct index_header {
+	char magic[8];
+	guint64 ino;
+	guint64 size;
+	guint64 mtime;
+	guint64 count;
+};
+
+struct index_record {
+	gint64 offset;
+	gint64 length;
+};
+
+static void
+index_identify(struct index_header *h, struct stat *st)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, INDEX_MAGIC, sizeof(h->magic));
+	h->ino = st->st_ino;
+	h->size = st->st_size;
+	h->mtime = (guint64) st->st_mtim.tv_sec * 1000000000
+		+ st->st_mtim.tv_nsec;
+}
+
+/*
+ * Write an index of the entries at OFFSETS in the file underlying stream
+ * S, which must have been flushed, to FILE.
+ *
+ * Return 0 on success, or -1 if S is not a regular file.
+ */
+int
+index_write(char *file, FILE *s, GArray *offsets)
+{
+	struct index_header h;
+	struct stat st;
+	FILE *out;
+	int i;
+
+	if (fstat(fileno(s), &st) == -1) syserr();
+	if (!S_ISREG(st.st_mode))
+		return -1;
+
+	if ( !(out = fopen(file, "w"))) syserr();
+	index_identify(&h, &st);
+	h.count = offsets->len;
+	if (fwrite(&h, sizeof(h), 1, out) != 1) syserr();
+	for (i = 0; i < offsets->len; i++) {
+		struct index_record r;
+		long next = i + 1 < offsets->len
+			? g_array_index(offsets, long, i + 1)
+			: st.st_size;
+		r.offset = g_array_index(offsets, long, i);
+		r.length = next - r.offset;
+		if (fwrite(&r, sizeof(r), 1, out) != 1) syserr();
+	}
+	if (fclose(out) == EOF) syserr();
+	return 0;
+}
+
+/*
+ * Read the index FILE of the file underlying stream S.
+ *
+ * Return the table of offsets, or NULL if there is no index for the
+ * current contents of S.
+ */
+GArray *
+index_read(char *file, FILE *s)
+{
+	struct index_header want;
+	struct index_header *h;
+	struct index_record *r;
+	struct stat st;
+	tmapping m;
+	GArray *offsets = 0;
+	FILE *in;
+	gint64 last = 0;
+	guint64 i;
+
+	if (fstat(fileno(s), &st) == -1) syserr();
+	if ( !(in = fopen(file, "r"))) {
+		if (errno == ENOENT) return 0;
+		syserr();
+	}
+	map_stream(in, &m);
+	if (fclose(in) == EOF) syserr();
+	if (m.size < sizeof(*h))
+		goto cleanup;
+
+	h = (struct index_header *) m.base;
+	r = (struct index_record *) (m.base + sizeof(*h));
+	index_identify(&want, &st);
+	if (memcmp(h->magic, want.magic, sizeof(h->magic))
+	    || h->ino != want.ino
+	    || h->size != want.size
+	    || h->mtime != want.mtime
+	    || h->count > (m.size - sizeof(*h)) / sizeof(*r)
+	    || m.size != sizeof(*h) + h->count * sizeof(*r))
+		goto cleanup;
+
+	offsets = g_array_sized_new(0, 0, sizeof(long), h->count);
+	for (i = 0; i < h->count; i++, r++) {
+		long offset = r->offset;
+		if (r->offset < last || r->offset + r->length > h->size) {
+			g_array_free(offsets, 1);
+			offsets = 0;
+			break;
+		}
+		last = r->offset + r->length;
+		g_array_append_val(offsets, offset);
+	}
+
+cleanup:
+	unmap_stream(&m);
+	return offsets;
+}
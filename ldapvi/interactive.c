@@ -125,7 +125,7 @@ view(char *pathname)
 	int childpid;
 	int status;
 	char *pg;
-	char *clear = tigetstr("clear");
+	char *clear = terminal_string("clear");
 
 	pg = getenv("PAGER");
 	if (!pg) pg = "less";
@@ -23,7 +23,7 @@
 #include "common.h"
 
 typedef void (*handler_entry)(char *, tentry *, void *);
-static void parse_file(
+static int parse_file(
 	FILE *, tparser *, thandler *, void *, handler_entry, void *, int);
 static void cut_datafile(char *, long, cmdline *);
 static int write_file_header(FILE *, cmdline *);
@@ -117,6 +117,7 @@ moddn(LDAP *ld, char *old, char *new, int dor, LDAPControl **ctrls)
 	char **ptr = newrdns;
 	char *newrdn = *ptr++;
 	GString *newsup = g_string_sized_new(strlen(new));
+	guint64 start = stats_now();
 
 	if (newrdn) {
 		if (*ptr) g_string_append(newsup, *ptr++);
@@ -127,6 +128,7 @@ moddn(LDAP *ld, char *old, char *new, int dor, LDAPControl **ctrls)
 	} else
 		newrdn = "";
 	rc = ldap_rename_s(ld, old, newrdn, newsup->str, dor, ctrls, 0);
+	stats_time(STAT_RENAME, start);
 	g_string_free(newsup, 1);
 	ldap_value_free(newrdns);
 	return rc;
@@ -135,13 +137,67 @@ moddn(LDAP *ld, char *old, char *new, int dor, LDAPControl **ctrls)
 
 /*****************************************
  * ldapmodify_handler
+ *
+ * With --pipeline or --connections, updates are not sent one at a time.
+ * Instead, the handler functions queue them, and the queue is worked off
+ * asynchronously over one or more connections, each of which keeps up
+ * to --pipeline operations in flight.  An update is sent only once no
+ * earlier update of the same entry, one of its ancestors, or one of its
+ * descendants is still queued or outstanding.  This keeps adds top-down
+ * and deletes bottom-up while letting independent subtrees proceed in
+ * parallel.  Renames (and deletes that might need to be retried) are
+ * barriers that wait for the whole queue.
+ *
+ * Since errors are noticed only after later updates may have been sent
+ * already, this mode is used only when errors either do not stop
+ * processing (--continue) or end the program anyway (--noquestions).
+ * Interactive commits without -c are always done one entry at a time.
+ *
+ * With --transaction N, the queue is worked off over the main connection
+ * only, and every N updates are grouped into an RFC 5805 transaction,
+ * which the server applies at once when it is committed.  That needs
+ * --noquestions, since every update then goes through the queue.
  */
+struct ldapmodify_conn {
+	LDAP *ld;
+	int npending;		/* operations in flight */
+};
+
+struct ldapmodify_op {
+	char *what;		/* "ldap_add", "ldap_modify", "ldap_delete" */
+	char *dn;
+	char **rdns;		/* exploded DN, for ordering constraints */
+	int nrdns;
+	LDAPMod **mods;
+	struct ldapmodify_conn *conn; /* null while still queued */
+	int msgid;
+	guint64 sent;		/* for --stats */
+};
+
 struct ldapmodify_context {
 	LDAP *ld;
 	LDAPControl **controls;
 	int verbose;
 	int noquestions;
 	int continuous;
+	int async;		/* queue updates instead of sending them */
+	int window;		/* operations in flight per connection */
+	struct ldapmodify_conn *conns;
+	int nconns;
+	GPtrArray *ops;		/* queued and in flight, in arrival order */
+	int failed;		/* an asynchronous operation has failed */
+	int batch;		/* updates per transaction, or 0 */
+	struct berval *txn;	/* identifier of the open transaction */
+	LDAPControl txn_control;
+	LDAPControl **txn_controls; /* controls plus txn_control */
+	GPtrArray *txn_updates;	/* sent in the open transaction */
+	int nupdates;		/* updates in the open transaction */
+	int ntxns;		/* transactions started so far */
+};
+
+struct txn_update {
+	int msgid;
+	char *dn;
 };
 
 static int
@@ -154,6 +210,512 @@ ldapmodify_error(struct ldapmodify_context *ctx, char *error)
 	return 0;
 }
 
+/*
+ * Two DNs are related if one of them is equal to or an ancestor of the
+ * other.  Operations on related DNs must not overtake each other.
+ */
+static int
+related_dns(struct ldapmodify_op *a, struct ldapmodify_op *b)
+{
+	int i = a->nrdns;
+	int j = b->nrdns;
+
+	while (i > 0 && j > 0)
+		if (strcasecmp(a->rdns[--i], b->rdns[--j]))
+			return 0;
+	return 1;
+}
+
+static struct ldapmodify_op *
+ldapmodify_op_new(char *what, char *dn, LDAPMod **mods)
+{
+	struct ldapmodify_op *op = xalloc(sizeof(struct ldapmodify_op));
+
+	op->what = what;
+	op->dn = xdup(dn);
+	/* freed with ldap_value_free, so allocate it with liblber */
+	if ( !(op->rdns = ldap_explode_dn(dn, 0))) {
+		op->rdns = ber_memcalloc(1, sizeof(char *));
+		if (!op->rdns) syserr();
+	}
+	op->nrdns = 0;
+	while (op->rdns[op->nrdns])
+		op->nrdns++;
+	op->mods = mods ? copy_mods(mods) : 0;
+	op->conn = 0;
+	return op;
+}
+
+static void
+ldapmodify_op_free(struct ldapmodify_op *op)
+{
+	free(op->dn);
+	ldap_value_free(op->rdns);
+	if (op->mods) mods_free(op->mods);
+	free(op);
+}
+
+static void
+ldapmodify_report(struct ldapmodify_context *ctx, struct ldapmodify_op *op,
+		  int err, char *matcheddn, char *text)
+{
+	fprintf(stderr, "%s: %s (%d)\n", op->what, ldap_err2string(err), err);
+	if (matcheddn && *matcheddn)
+		fprintf(stderr, "\tmatched DN: %s\n", matcheddn);
+	if (text && *text)
+		fprintf(stderr, "\tadditional info: %s\n", text);
+	fprintf(stderr, "\tentry: %s\n", op->dn);
+	if (ctx->continuous)
+		fputs("(error ignored)\n", stderr);
+	else
+		ctx->failed = 1;
+}
+
+static void
+ldapmodify_send(struct ldapmodify_context *ctx, struct ldapmodify_op *op,
+		struct ldapmodify_conn *conn)
+{
+	LDAP *ld = conn->ld;
+	LDAPControl **ctrls = ctx->txn ? ctx->txn_controls : ctx->controls;
+	int rc;
+
+	if (!strcmp(op->what, "ldap_add"))
+		rc = ldap_add_ext(ld, op->dn, op->mods, ctrls, 0, &op->msgid);
+	else if (!strcmp(op->what, "ldap_modify"))
+		rc = ldap_modify_ext(
+			ld, op->dn, op->mods, ctrls, 0, &op->msgid);
+	else
+		rc = ldap_delete_ext(ld, op->dn, ctrls, 0, &op->msgid);
+	if (rc) {
+		ldapmodify_report(ctx, op, rc, 0, 0);
+		g_ptr_array_remove(ctx->ops, op);
+		ldapmodify_op_free(op);
+		return;
+	}
+	op->conn = conn;
+	op->sent = stats_now();
+	conn->npending++;
+	if (ctx->txn) {
+		struct txn_update *u = xalloc(sizeof(struct txn_update));
+		u->msgid = op->msgid;
+		u->dn = xdup(op->dn);
+		g_ptr_array_add(ctx->txn_updates, u);
+	}
+}
+
+/*
+ * Send every queued operation that does not depend on an earlier one,
+ * as long as there is a connection with room for it.
+ */
+static void
+ldapmodify_dispatch(struct ldapmodify_context *ctx)
+{
+	int i, j;
+
+	if (ctx->failed)
+		return;
+	for (i = 0; i < ctx->ops->len; i++) {
+		struct ldapmodify_op *op = g_ptr_array_index(ctx->ops, i);
+		struct ldapmodify_conn *conn = 0;
+
+		if (op->conn)
+			continue;
+		for (j = 0; j < ctx->nconns; j++)
+			if (ctx->conns[j].npending < ctx->window
+			    && (!conn || ctx->conns[j].npending < conn->npending))
+				conn = &ctx->conns[j];
+		if (!conn)
+			break;
+		for (j = 0; j < i; j++)
+			if (related_dns(g_ptr_array_index(ctx->ops, j), op))
+				break;
+		if (j < i)
+			continue;
+		ldapmodify_send(ctx, op, conn);
+		if (ctx->failed)
+			return;
+		if (i < ctx->ops->len && g_ptr_array_index(ctx->ops, i) != op)
+			i--;		/* removed after an error */
+	}
+}
+
+/*
+ * Read the next available result from any connection.
+ */
+static LDAPMessage *
+ldapmodify_next_result(struct ldapmodify_context *ctx,
+		       struct ldapmodify_conn **connp)
+{
+	struct timeval zero = {0, 0};
+	struct pollfd *fds;
+	LDAPMessage *result;
+	int nbusy = 0;
+	int i;
+
+	for (i = 0; i < ctx->nconns; i++)
+		if (ctx->conns[i].npending) {
+			*connp = &ctx->conns[i];
+			nbusy++;
+		}
+	if (nbusy == 1) {
+		LDAP *ld = (*connp)->ld;
+		switch (ldap_result(ld, LDAP_RES_ANY, LDAP_MSG_ONE, 0, &result))
+		{
+		case -1:
+		case 0:
+			ldaperr(ld, "ldap_result");
+		}
+		return result;
+	}
+
+	fds = xalloc(ctx->nconns * sizeof(struct pollfd));
+	for (;;) {
+		int nfds = 0;
+
+		for (i = 0; i < ctx->nconns; i++) {
+			struct ldapmodify_conn *conn = &ctx->conns[i];
+			if (!conn->npending)
+				continue;
+			switch (ldap_result(conn->ld, LDAP_RES_ANY,
+					    LDAP_MSG_ONE, &zero, &result))
+			{
+			case -1:
+				ldaperr(conn->ld, "ldap_result");
+			case 0:
+				break;
+			default:
+				*connp = conn;
+				free(fds);
+				return result;
+			}
+			if (ldap_get_option(conn->ld, LDAP_OPT_DESC,
+					    &fds[nfds].fd))
+				ldaperr(conn->ld, "ldap_get_option");
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+		if (poll(fds, nfds, -1) == -1 && errno != EINTR)
+			syserr();
+	}
+}
+
+/*
+ * Wait for one operation in flight to complete and report its result.
+ */
+static void
+ldapmodify_collect(struct ldapmodify_context *ctx)
+{
+	struct ldapmodify_conn *conn;
+	struct ldapmodify_op *op = 0;
+	LDAPMessage *result;
+	int err;
+	char *matcheddn = 0;
+	char *text = 0;
+	int i;
+
+	do {
+		result = ldapmodify_next_result(ctx, &conn);
+		for (i = 0; i < ctx->ops->len; i++) {
+			op = g_ptr_array_index(ctx->ops, i);
+			if (op->conn == conn && op->msgid == ldap_msgid(result))
+				break;
+		}
+		if (i == ctx->ops->len) {
+			ldap_msgfree(result);
+			op = 0;
+		}
+	} while (!op);
+	g_ptr_array_remove_index(ctx->ops, i);
+	conn->npending--;
+
+	if (ldap_parse_result(conn->ld, result, &err, &matcheddn, &text,
+			      0, 0, 1))
+		ldaperr(conn->ld, "ldap_parse_result");
+	if (err)
+		ldapmodify_report(ctx, op, err, matcheddn, text);
+	if (matcheddn) ldap_memfree(matcheddn);
+	if (text) ldap_memfree(text);
+	if (!strcmp(op->what, "ldap_add"))
+		stats_time(STAT_ADD, op->sent);
+	else if (!strcmp(op->what, "ldap_modify"))
+		stats_time(STAT_MODIFY, op->sent);
+	else
+		stats_time(STAT_DELETE, op->sent);
+	ldapmodify_op_free(op);
+}
+
+/*
+ * Work off the whole queue.  Returns -1 if an operation has failed (and
+ * errors are not being ignored), else 0.
+ */
+static int
+ldapmodify_flush(struct ldapmodify_context *ctx)
+{
+	int i;
+
+	while (ctx->ops->len) {
+		ldapmodify_dispatch(ctx);
+		if (ctx->failed) {
+			/* stop here, but wait for what has been sent already */
+			int n = 0;
+			for (i = ctx->ops->len - 1; i >= 0; i--) {
+				struct ldapmodify_op *op
+					= g_ptr_array_index(ctx->ops, i);
+				if (op->conn)
+					continue;
+				g_ptr_array_remove_index(ctx->ops, i);
+				ldapmodify_op_free(op);
+				n++;
+			}
+			if (n)
+				fprintf(stderr,
+					"%d queued update%s not sent.\n",
+					n, n == 1 ? "" : "s");
+			if (!ctx->ops->len)
+				break;
+		}
+		ldapmodify_collect(ctx);
+	}
+	return ctx->failed ? -1 : 0;
+}
+
+#define TXN_START_OID "1.3.6.1.1.21.1"
+#define TXN_SPEC_OID "1.3.6.1.1.21.2"
+#define TXN_END_OID "1.3.6.1.1.21.3"
+
+static int
+has_value(LDAP *ld, LDAPMessage *entry, char *ad, char *value)
+{
+	char **values = ldap_get_values(ld, entry, ad);
+	char **ptr;
+	int found = 0;
+
+	if (!values)
+		return 0;
+	for (ptr = values; *ptr && !found; ptr++)
+		found = !strcmp(*ptr, value);
+	ldap_value_free(values);
+	return found;
+}
+
+/*
+ * Does the root DSE advertise RFC 5805 transactions?  A root DSE we
+ * cannot read counts as "no", since we can still pipeline.
+ */
+static int
+txn_supported(LDAP *ld)
+{
+	char *attrs[3] = {"supportedExtension", "supportedControl", 0};
+	LDAPMessage *result = 0;
+	LDAPMessage *entry;
+	int rc = 0;
+
+	if (ldap_search_s(ld, "", LDAP_SCOPE_BASE, 0, attrs, 0, &result)
+	    == LDAP_SUCCESS
+	    && (entry = ldap_first_entry(ld, result)))
+		rc = has_value(ld, entry, "supportedExtension", TXN_START_OID)
+			&& has_value(ld, entry, "supportedExtension",
+				     TXN_END_OID)
+			&& has_value(ld, entry, "supportedControl",
+				     TXN_SPEC_OID);
+	if (result)
+		ldap_msgfree(result);
+	return rc;
+}
+
+/*
+ * Open a transaction unless one is open already.
+ *
+ * If the very first transaction cannot be started, pipeline all updates
+ * instead, so that none of them is sent within a transaction.  Once
+ * transactions have been used, failing to start one is fatal, even with
+ * --continue: updates must not go out in and outside of transactions.
+ */
+static int
+txn_start(struct ldapmodify_context *ctx)
+{
+	char *oid = 0;
+
+	if (ctx->txn)
+		return 0;
+	if (ldap_extended_operation_s(ctx->ld, TXN_START_OID, 0,
+				      ctx->controls, 0, &oid, &ctx->txn))
+	{
+		ldap_perror(ctx->ld, "ldap_txn_start");
+		if (ctx->txn) ber_bvfree(ctx->txn);
+		ctx->txn = 0;
+	} else if (!ctx->txn)
+		fputs("Error: Server did not identify the transaction.\n",
+		      stderr);
+	if (oid) ldap_memfree(oid);
+	if (!ctx->txn) {
+		if (ctx->ntxns) {
+			ctx->failed = 1;
+			return -1;
+		}
+		fputs("Warning: Cannot start a transaction,"
+		      " pipelining updates instead.\n",
+		      stderr);
+		if (ctx->window <= 1)
+			ctx->window = ctx->batch;
+		ctx->batch = 0;
+		return 0;
+	}
+	ctx->txn_control.ldctl_value = *ctx->txn;
+	ctx->nupdates = 0;
+	ctx->ntxns++;
+	return 0;
+}
+
+/* the update that made the transaction fail, according to the server */
+static char *
+txn_failed_dn(struct ldapmodify_context *ctx, struct berval *data)
+{
+	BerElement *ber;
+	ber_len_t len;
+	ber_int_t msgid = -1;
+	int i;
+
+	if (!data || !(ber = ber_init(data)))
+		return 0;
+	if (ber_scanf(ber, "{") != LBER_ERROR
+	    && ber_peek_tag(ber, &len) == LBER_INTEGER)
+		ber_scanf(ber, "i", &msgid);
+	ber_free(ber, 1);
+	for (i = 0; i < ctx->txn_updates->len; i++) {
+		struct txn_update *u = g_ptr_array_index(ctx->txn_updates, i);
+		if (u->msgid == msgid)
+			return u->dn;
+	}
+	return 0;
+}
+
+/*
+ * Commit (or, if COMMIT is false, abort) the open transaction, after
+ * all of its updates have been sent.  Return -1 if that fails and errors
+ * are not being ignored, else 0.
+ */
+static int
+txn_end(struct ldapmodify_context *ctx, int commit)
+{
+	BerElement *ber;
+	struct berval *value;
+	struct berval *data = 0;
+	char *oid = 0;
+	int n = ctx->nupdates;
+	int rc;
+	int i;
+
+	if (!ctx->txn)
+		return 0;
+	if ( !(ber = ber_alloc_t(LBER_USE_DER))) syserr();
+	if (commit)
+		rc = ber_printf(ber, "{O}", ctx->txn);
+	else
+		rc = ber_printf(ber, "{bO}", (ber_int_t) 0, ctx->txn);
+	if (rc == -1 || ber_flatten(ber, &value) == -1)
+		yourfault("ber_printf");
+	ber_free(ber, 1);
+
+	rc = ldap_extended_operation_s(
+		ctx->ld, TXN_END_OID, value, 0, 0, &oid, &data);
+	if (commit && rc == LDAP_SUCCESS) {
+		if (ctx->verbose)
+			printf("(commit) %d update%s\n", n, n == 1 ? "" : "s");
+	} else if (commit) {
+		char *dn = txn_failed_dn(ctx, data);
+		char *text = 0;
+
+		fprintf(stderr, "ldap_txn_end: %s (%d)\n",
+			ldap_err2string(rc), rc);
+		ldap_get_option(ctx->ld, LDAP_OPT_DIAGNOSTIC_MESSAGE, &text);
+		if (text && *text)
+			fprintf(stderr, "\tadditional info: %s\n", text);
+		if (text) ldap_memfree(text);
+		if (dn)
+			fprintf(stderr, "\tentry: %s\n", dn);
+		fprintf(stderr, "\t%d update%s not applied.\n",
+			n, n == 1 ? "" : "s");
+		if (ctx->continuous)
+			fputs("(error ignored)\n", stderr);
+		else
+			ctx->failed = 1;
+	} else
+		fprintf(stderr, "Transaction of %d update%s aborted.\n",
+			n, n == 1 ? "" : "s");
+
+	if (oid) ldap_memfree(oid);
+	if (data) ber_bvfree(data);
+	ber_bvfree(value);
+	ber_bvfree(ctx->txn);
+	ctx->txn = 0;
+	for (i = 0; i < ctx->txn_updates->len; i++) {
+		struct txn_update *u = g_ptr_array_index(ctx->txn_updates, i);
+		free(u->dn);
+		free(u);
+	}
+	g_ptr_array_set_size(ctx->txn_updates, 0);
+	return ctx->failed ? -1 : 0;
+}
+
+/*
+ * Count an update sent in the open transaction, and commit it once it
+ * is full.
+ */
+static int
+txn_count(struct ldapmodify_context *ctx)
+{
+	if (++ctx->nupdates < ctx->batch)
+		return 0;
+	if (ldapmodify_flush(ctx) == -1) {
+		txn_end(ctx, 0);
+		return -1;
+	}
+	return txn_end(ctx, 1);
+}
+
+static int
+ldapmodify_enqueue(struct ldapmodify_context *ctx, char *what, char *dn,
+		   LDAPMod **mods)
+{
+	int limit = 2 * ctx->window * ctx->nconns;
+
+	if (ctx->failed)
+		return -1;
+	if (ctx->batch && txn_start(ctx) == -1)
+		return -1;
+	g_ptr_array_add(ctx->ops, ldapmodify_op_new(what, dn, mods));
+	ldapmodify_dispatch(ctx);
+	while (ctx->ops->len > limit && !ctx->failed) {
+		ldapmodify_collect(ctx);
+		ldapmodify_dispatch(ctx);
+	}
+	if (ctx->failed) {
+		ldapmodify_flush(ctx);
+		txn_end(ctx, 0);
+		return -1;
+	}
+	return ctx->batch ? txn_count(ctx) : 0;
+}
+
+/*
+ * Rename synchronously, as a barrier, but within the open transaction.
+ */
+static int
+ldapmodify_moddn(struct ldapmodify_context *ctx, char *dn1, char *dn2,
+		 int deleteoldrdn)
+{
+	if (ldapmodify_flush(ctx) == -1)
+		return -1;
+	if (ctx->verbose) printf("(rename) %s to %s\n", dn1, dn2);
+	if (ctx->batch && txn_start(ctx) == -1)
+		return -1;
+	if (moddn(ctx->ld, dn1, dn2, deleteoldrdn,
+		  ctx->txn ? ctx->txn_controls : ctx->controls))
+		return ldapmodify_error(ctx, "ldap_rename");
+	return ctx->batch ? txn_count(ctx) : 0;
+}
+
 static int
 ldapmodify_change(
 	int key, char *labeldn, char *dn, LDAPMod **mods, void *userdata)
@@ -162,9 +724,16 @@ ldapmodify_change(
 	LDAP *ld = ctx->ld;
 	LDAPControl **ctrls = ctx->controls;
 	int verbose = ctx->verbose;
+	guint64 start;
+	int rc;
 
 	if (verbose) printf("(modify) %s\n", labeldn);
-	if (ldap_modify_ext_s(ld, dn, mods, ctrls, 0))
+	if (ctx->async)
+		return ldapmodify_enqueue(ctx, "ldap_modify", dn, mods);
+	start = stats_now();
+	rc = ldap_modify_ext_s(ld, dn, mods, ctrls, 0);
+	stats_time(STAT_MODIFY, start);
+	if (rc)
 		return ldapmodify_error(ctx, "ldap_modify");
 	return 0;
 }
@@ -173,16 +742,11 @@ static int
 ldapmodify_rename(int key, char *dn1, tentry *modified, void *userdata)
 {
 	struct ldapmodify_context *ctx = userdata;
-	LDAP *ld = ctx->ld;
-	LDAPControl **ctrls = ctx->controls;
-	int verbose = ctx->verbose;
-
 	char *dn2 = entry_dn(modified);
 	int deleteoldrdn = frob_rdn(modified, dn1, FROB_RDN_CHECK) == -1;
-	if (verbose) printf("(rename) %s to %s\n", dn1, dn2);
-	if (moddn(ld, dn1, dn2, deleteoldrdn, ctrls))
-		return ldapmodify_error(ctx, "ldap_rename");
-	return 0;
+
+	/* renames move whole subtrees, so they are barriers */
+	return ldapmodify_moddn(ctx, dn1, dn2, deleteoldrdn);
 }
 
 static int
@@ -192,9 +756,16 @@ ldapmodify_add(int key, char *dn, LDAPMod **mods, void *userdata)
 	LDAP *ld = ctx->ld;
 	LDAPControl **ctrls = ctx->controls;
 	int verbose = ctx->verbose;
+	guint64 start;
+	int rc;
 
 	if (verbose) printf("(add) %s\n", dn);
-	if (ldap_add_ext_s(ld, dn, mods, ctrls, 0))
+	if (ctx->async)
+		return ldapmodify_enqueue(ctx, "ldap_add", dn, mods);
+	start = stats_now();
+	rc = ldap_add_ext_s(ld, dn, mods, ctrls, 0);
+	stats_time(STAT_ADD, start);
+	if (rc)
 		return ldapmodify_error(ctx, "ldap_add");
 	return 0;
 }
@@ -206,9 +777,22 @@ ldapmodify_delete(int key, char *dn, void *userdata)
 	LDAP *ld = ctx->ld;
 	LDAPControl **ctrls = ctx->controls;
 	int verbose = ctx->verbose;
+	guint64 start;
+	int rc;
 
+	/* without --noquestions, deletions of non-leaf entries are
+	 * retried later, so we need to know the result right away */
+	if (ctx->async && ctx->noquestions) {
+		if (verbose) printf("(delete) %s\n", dn);
+		return ldapmodify_enqueue(ctx, "ldap_delete", dn, 0);
+	}
+	if (ldapmodify_flush(ctx) == -1)
+		return -1;
 	if (verbose) printf("(delete) %s\n", dn);
-	switch (ldap_delete_ext_s(ld, dn, ctrls, 0)) {
+	start = stats_now();
+	rc = ldap_delete_ext_s(ld, dn, ctrls, 0);
+	stats_time(STAT_DELETE, start);
+	switch (rc) {
 	case 0:
 		break;
 	case LDAP_NOT_ALLOWED_ON_NONLEAF:
@@ -225,15 +809,7 @@ static int
 ldapmodify_rename0(
 	int key, char *dn1, char *dn2, int deleteoldrdn, void *userdata)
 {
-	struct ldapmodify_context *ctx = userdata;
-	LDAP *ld = ctx->ld;
-	LDAPControl **ctrls = ctx->controls;
-	int verbose = ctx->verbose;
-
-	if (verbose) printf("(rename) %s to %s\n", dn1, dn2);
-	if (moddn(ld, dn1, dn2, deleteoldrdn, ctrls))
-		return ldapmodify_error(ctx, "ldap_rename");
-	return 0;
+	return ldapmodify_moddn(userdata, dn1, dn2, deleteoldrdn);
 }
 
 
@@ -837,17 +1413,23 @@ view_vdif(tparser *parser, char *dir, GArray *offsets, char *clean, char *data)
 static void
 setcolor(int fg)
 {
-	char *bold = tigetstr("bold");
-	char *setaf = tigetstr("setaf");
+	char *bold = terminal_string("bold");
+	char *setaf = terminal_string("setaf");
 	if (setaf) putp(tparm(setaf, fg));
 	if (bold) putp(bold);
 }
 
+/* COLOR is -1 for plain output, as when stdout is not a terminal */
 static void
 print_counter(int color, char *label, int value)
 {
-	char *sgr0 = tigetstr("sgr0");
+	char *sgr0;
 
+	if (color == -1) {
+		printf("%s: %d", label, value);
+		return;
+	}
+	sgr0 = terminal_string("sgr0");
 	if (value) setcolor(color);
 	printf("%s: %d", label, value);
 	if (sgr0) putp(sgr0);
@@ -861,6 +1443,7 @@ analyze_changes(tparser *p, GArray *offsets, char *clean, char *data,
 		cmdline *cmdline)
 {
 	struct statistics st;
+	int color = !cmdline->noquestions && isatty(1);
 	static thandler statistics_handler = {
 		statistics_change,
 		statistics_rename,
@@ -885,13 +1468,14 @@ retry:
 		}
 		if (cmdline->quiet)
 			return 1;
-		print_counter(COLOR_GREEN, "add", st.nadd);
+		print_counter(color ? COLOR_GREEN : -1, "add", st.nadd);
 		fputs(", ", stdout);
-		print_counter(COLOR_BLUE, "rename", st.nrename);
+		print_counter(color ? COLOR_BLUE : -1, "rename", st.nrename);
 		fputs(", ", stdout);
-		print_counter(COLOR_YELLOW, "modify", st.nmodify);
+		print_counter(color ? COLOR_YELLOW : -1, "modify",
+			      st.nmodify);
 		fputs(", ", stdout);
-		print_counter(COLOR_RED, "delete", st.ndelete);
+		print_counter(color ? COLOR_RED : -1, "delete", st.ndelete);
 		putchar('\n');
 		return 1;
 	}
@@ -920,38 +1504,140 @@ retry:
 	}
 }
 
+static thandler ldapmodify_handler = {
+	ldapmodify_change,
+	ldapmodify_rename,
+	ldapmodify_add,
+	ldapmodify_delete,
+	ldapmodify_rename0
+};
+
 static void
+ldapmodify_open(struct ldapmodify_context *ctx, LDAP *ld,
+		LDAPControl **ctrls, int verbose, int noquestions,
+		int continuous, cmdline *cmdline)
+{
+	int i;
+
+	ctx->ld = ld;
+	ctx->controls = ctrls;
+	ctx->verbose = verbose;
+	ctx->noquestions = noquestions;
+	ctx->continuous = continuous;
+	ctx->async = (continuous || noquestions)
+		&& (cmdline->pipeline > 1 || cmdline->connections > 1);
+	ctx->window = cmdline->pipeline > 1 ? cmdline->pipeline : 1;
+	ctx->nconns = ctx->async ? cmdline->connections : 1;
+	if (ctx->nconns < 1)
+		ctx->nconns = 1;
+	ctx->batch = 0;
+	ctx->txn = 0;
+	ctx->ntxns = 0;
+	/* interactive commits need the result of each deletion right
+	 * away, see ldapmodify_delete, which a transaction cannot give */
+	if (!noquestions && cmdline->transaction > 0)
+		fputs("Warning: --transaction requires --noquestions,"
+		      " committing without transactions.\n",
+		      stderr);
+	else if (noquestions && cmdline->transaction > 0) {
+		ctx->async = 1;
+		if (txn_supported(ld)) {
+			/* transactions are bound to one connection */
+			ctx->batch = cmdline->transaction;
+			ctx->nconns = 1;
+		} else {
+			fputs("Warning: Server does not support transactions,"
+			      " pipelining updates instead.\n",
+			      stderr);
+			if (cmdline->pipeline <= 1)
+				ctx->window = cmdline->transaction;
+		}
+	}
+	ctx->conns = xalloc(ctx->nconns * sizeof(struct ldapmodify_conn));
+	ctx->conns[0].ld = ld;
+	ctx->conns[0].npending = 0;
+	for (i = 1; i < ctx->nconns; i++) {
+		/* reuse the credentials of the main connection */
+		bind_options bo = cmdline->bind_options;
+		LDAP *ld2;
+
+		bo.dialog = BD_NEVER;
+		ld2 = do_connect(cmdline->server, &bo, cmdline->referrals,
+				 cmdline->starttls, cmdline->tls,
+				 cmdline->deref, 1, 0);
+		if (!ld2) {
+			fprintf(stderr, "Warning: Only %d connection%s.\n",
+				i, i == 1 ? "" : "s");
+			break;
+		}
+		ctx->conns[i].ld = ld2;
+		ctx->conns[i].npending = 0;
+	}
+	ctx->nconns = i;
+	ctx->ops = g_ptr_array_new();
+	ctx->failed = 0;
+
+	for (i = 0; ctrls[i]; i++)
+		;
+	ctx->txn_controls = xalloc((i + 2) * sizeof(LDAPControl *));
+	memcpy(ctx->txn_controls, ctrls, i * sizeof(LDAPControl *));
+	ctx->txn_controls[i] = &ctx->txn_control;
+	ctx->txn_controls[i + 1] = 0;
+	ctx->txn_control.ldctl_oid = TXN_SPEC_OID;
+	ctx->txn_control.ldctl_iscritical = 1;
+	ctx->txn_updates = g_ptr_array_new();
+	ctx->nupdates = 0;
+}
+
+/*
+ * Wait for all outstanding updates and release CTX.
+ * Return 0 on success, -1 if an update has failed.
+ */
+static int
+ldapmodify_close(struct ldapmodify_context *ctx)
+{
+	int rc = ldapmodify_flush(ctx);
+	int i;
+
+	if (ctx->txn && txn_end(ctx, rc == 0) == -1)
+		rc = -1;
+	g_ptr_array_free(ctx->txn_updates, 1);
+	free(ctx->txn_controls);
+	g_ptr_array_free(ctx->ops, 1);
+	for (i = 1; i < ctx->nconns; i++)
+		ldap_unbind_s(ctx->conns[i].ld);
+	free(ctx->conns);
+	return rc;
+}
+
+/*
+ * Apply the changes.  Return 0 on success, or -1 if an update has failed.
+ */
+static int
 commit(tparser *p, LDAP *ld, GArray *offsets, char *clean, char *data,
        LDAPControl **ctrls, int verbose, int noquestions, int continuous,
        cmdline *cmdline)
 {
 	struct ldapmodify_context ctx;
-	static thandler ldapmodify_handler = {
-		ldapmodify_change,
-		ldapmodify_rename,
-		ldapmodify_add,
-		ldapmodify_delete,
-		ldapmodify_rename0
-	};
-	ctx.ld = ld;
-	ctx.controls = ctrls;
-	ctx.verbose = verbose;
-	ctx.noquestions = noquestions;
-	ctx.continuous = continuous;
+	int rc;
 
-	switch (compare(p, &ldapmodify_handler, &ctx, offsets, clean, data, 0,
-			cmdline))
-	{
+	ldapmodify_open(&ctx, ld, ctrls, verbose, noquestions, continuous,
+			cmdline);
+	rc = compare(p, &ldapmodify_handler, &ctx, offsets, clean, data, 0,
+		     cmdline);
+	if (ldapmodify_close(&ctx) == -1 && rc == 0)
+		rc = -2;
+
+	switch (rc) {
 	case 0:
 		if (!cmdline->quiet)
 			puts("Done.");
-		write_ldapvi_history();
-		exit(0);
+		return 0;
 	case -1:
 		yourfault("unexpected syntax error!");
 	case -2:
 		/* user error */
-		break;
+		return -1;
 	default:
 		abort();
 	}
@@ -1115,7 +1801,7 @@ rewrite_comments(LDAP *ld, char *dataname, cmdline *cmdline)
 	ctx.out = out;
 	ctx.entroid = entroid_new(schema);
 	ctx.parser = p;
-	parse_file(in, p, h, out, annotate_entry, &ctx, addp);
+	if (parse_file(in, p, h, out, annotate_entry, &ctx, addp)) exit(1);
 
 	if (fclose(in) == EOF) syserr();
 	if (fclose(out) == EOF) syserr();
@@ -1191,11 +1877,35 @@ read_offsets(tparser *p, char *file)
 static void
 offline_diff(tparser *p, char *a, char *b)
 {
-	GArray *offsets = read_offsets(p, a);
+	char *index = append(a, ".idx");
+	GArray *offsets;
+	FILE *s;
+
+	/* use the index written by --out --index, if it is up to date */
+	if ( !(s = fopen(a, "r"))) syserr();
+	offsets = index_read(index, s);
+	if (fclose(s) == EOF) syserr();
+	free(index);
+	if (!offsets)
+		offsets = read_offsets(p, a);
 	compare(p, &ldif_handler, stdout, offsets, a, b, 0, 0);
 	g_array_free(offsets, 1);
 }
 
+static int
+offline_diff_dumps(tparser *p, char *a, char *b)
+{
+	FILE *s, *t;
+	int rc;
+
+	if ( !(s = fopen(a, "r"))) syserr();
+	if ( !(t = fopen(b, "r"))) syserr();
+	rc = compare_dumps(p, &ldif_handler, stdout, s, t, DUMP_SORT_LIMIT);
+	if (fclose(s) == EOF) syserr();
+	if (fclose(t) == EOF) syserr();
+	return rc;
+}
+
 void
 write_config(LDAP *ld, FILE *f, cmdline *cmdline)
 {
@@ -1378,7 +2088,10 @@ add_template(LDAP *ld, FILE *s, GPtrArray *wanted, char *base)
 	schema_free(schema);
 }
 
-static void
+/*
+ * Return 0 on success, -1 on syntax error, -2 on handler failure.
+ */
+static int
 parse_file(FILE *in,
 	   tparser *p, thandler *h, void *userdata,
 	   handler_entry hentry, void *entrydata,
@@ -1388,14 +2101,17 @@ parse_file(FILE *in,
 
 	for (;;) {
 		long pos;
+		int rc;
 
-		if (p->peek(in, -1, &key, &pos) == -1) exit(1);
+		if (p->peek(in, -1, &key, &pos) == -1) return -1;
 		if (!key) break;
 
 		if (ndecimalp(key)) {
 			tentry *entry;
-			if (p->entry(in, pos, 0, &entry, 0) == -1)
-				exit(1);
+			if (p->entry(in, pos, 0, &entry, 0) == -1) {
+				free(key);
+				return -1;
+			}
 			if (hentry)
 				hentry(key, entry, entrydata);
 			entry_free(entry);
@@ -1403,11 +2119,16 @@ parse_file(FILE *in,
 			char *k = key;
 			if (!strcmp(key, "add") && !addp)
 				k = "replace";
-			if (process_immediate(p, h, userdata, in, pos, k) < 0)
-				exit(1);
+			if ( (rc = process_immediate(
+				      p, h, userdata, in, pos, k)) < 0)
+			{
+				free(key);
+				return rc;
+			}
 		}
 		free(key);
 	}
+	return 0;
 }
 
 static int
@@ -1513,6 +2234,7 @@ main_write_files(
 	char *clean, char *data, char *sasl,
 	GPtrArray *ctrls,
 	FILE *source,
+	GPtrArray *stamps,
 	int *nlines)
 {
 	FILE *s;
@@ -1546,7 +2268,8 @@ main_write_files(
 
 		if (cmdline->ldif) h = &ldif_handler;
 		if (cmdline->ldapvi) p = &ldapvi_parser;
-		parse_file(source, p, h, s, 0, 0, cmdline->ldapmodify_add);
+		if (parse_file(source, p, h, s, 0, 0, cmdline->ldapmodify_add))
+			exit(1);
 
 		if (cmdline->in_file)
 			if (fclose(source) == EOF) syserr();
@@ -1570,7 +2293,7 @@ main_write_files(
 		offsets = g_array_new(0, 0, sizeof(long));
 	} else {
 		offsets = search(s, ld, cmdline, (void *) ctrls->pdata, 0,
-				 cmdline->ldif);
+				 cmdline->ldif, stamps);
 		if (fclose(s) == EOF) syserr();
 		cp(data, clean, 0, 0);
 	}
@@ -1579,11 +2302,201 @@ main_write_files(
 	return offsets;
 }
 
+/*
+ * Read up to about STREAM_CHUNK bytes of complete LDIF records from IN
+ * into CHUNK.  Return 0 at EOF.
+ */
+#define STREAM_CHUNK (1024 * 1024)
+
+static int
+read_chunk(FILE *in, GString *chunk)
+{
+	static char *line = 0;
+	static size_t n = 0;
+	ssize_t len;
+
+	g_string_truncate(chunk, 0);
+	while ( (len = getline(&line, &n, in)) != -1) {
+		g_string_append_len(chunk, line, len);
+		if (chunk->len >= STREAM_CHUNK
+		    && (!strcmp(line, "\n") || !strcmp(line, "\r\n")))
+			break;
+	}
+	if (ferror(in)) syserr();
+	return chunk->len > 0;
+}
+
+/*
+ * Noninteractive --in: apply the change records in SOURCE as they are
+ * read, instead of writing them into the data file and comparing that
+ * against an empty clean file first.
+ *
+ * The parsers need to seek, so records are read in chunks of complete
+ * records, each of which is parsed from memory.  Restricted to LDIF,
+ * where records are separated by empty lines.  Unlike the two-pass path,
+ * records before a syntax error have been applied when it is found.
+ */
+static int
+stream_changes(LDAP *ld, cmdline *cmdline, GPtrArray *ctrls, FILE *source)
+{
+	struct ldapmodify_context ctx;
+	GString *chunk = g_string_sized_new(STREAM_CHUNK);
+	int rc = 0;
+
+	if (cmdline->in_file) {
+		if ( !(source = fopen(cmdline->in_file, "r"))) syserr();
+	} else if (!source)
+		source = stdin;
+
+	ldapmodify_open(&ctx, ld, (void *) ctrls->pdata, cmdline->verbose,
+			1, cmdline->continuous, cmdline);
+	while (!rc && read_chunk(source, chunk)) {
+		FILE *s = fmemopen(chunk->str, chunk->len, "r");
+		if (!s) syserr();
+		rc = parse_file(s, &ldif_parser, &ldapmodify_handler, &ctx,
+				0, 0, cmdline->ldapmodify_add);
+		if (fclose(s) == EOF) syserr();
+	}
+	if (ldapmodify_close(&ctx) == -1 && rc == 0)
+		rc = -2;
+
+	if (cmdline->in_file)
+		if (fclose(source) == EOF) syserr();
+	g_string_free(chunk, 1);
+
+	if (rc == -1)
+		fputs("Syntax error in noninteractive mode, giving up.\n",
+		      stderr);
+	else if (rc)
+		fputs("Error in noninteractive mode, giving up.\n", stderr);
+	return rc ? 1 : 0;
+}
+
+static void
+free_stamps(GPtrArray *stamps, int all)
+{
+	int i;
+
+	for (i = 0; i < stamps->len; i++)
+		free(g_ptr_array_index(stamps, i));
+	if (all)
+		g_ptr_array_free(stamps, 1);
+	else
+		g_ptr_array_set_size(stamps, 0);
+}
+
+struct conflicts {
+	GPtrArray *stamps;
+	GHashTable *changed;	/* from search_changes */
+	int n;
+};
+
+/*
+ * The user has changed the entry with key KEY and original DN DN.  Is
+ * its stamp on the server different from the one we have read?
+ */
+static int
+note_conflict(struct conflicts *c, int key, char *dn)
+{
+	char *ndn;
+	char *stamp;
+	char *current;
+
+	if (key < 0 || key >= c->stamps->len)
+		return 0;
+	stamp = g_ptr_array_index(c->stamps, key);
+	ndn = g_ascii_strdown(dn, -1);
+	current = g_hash_table_lookup(c->changed, ndn);
+	g_free(ndn);
+	if (!current || (stamp && !strcmp(stamp, current)))
+		return 0;
+	if (!c->n++)
+		puts("Conflicts (changed on the server since they were read):");
+	printf("  %s\n", dn);
+	return 0;
+}
+
+static int
+conflicts_change(
+	int key, char *labeldn, char *dn, LDAPMod **mods, void *userdata)
+{
+	return note_conflict(userdata, key, labeldn);
+}
+
+static int
+conflicts_rename(int key, char *olddn, tentry *modified, void *userdata)
+{
+	return note_conflict(userdata, key, olddn);
+}
+
+static int
+conflicts_add(int key, char *dn, LDAPMod **mods, void *userdata)
+{
+	return 0;
+}
+
+static int
+conflicts_delete(int key, char *dn, void *userdata)
+{
+	return note_conflict(userdata, key, dn);
+}
+
 static int
-main_loop(LDAP *ld, cmdline *cmdline,
-	  tparser *parser, GArray *offsets, char *clean, char *data,
-	  GPtrArray *ctrls, char *dir)
+conflicts_rename0(
+	int key, char *dn1, char *dn2, int deleteoldrdn, void *userdata)
 {
+	return note_conflict(userdata, key, dn1);
+}
+
+/*
+ * Look for entries that the user has changed and that have also been
+ * changed on the server since search() has read them, printing their
+ * DNs.  Only entries changed on the server are fetched again, see
+ * search_changes().
+ *
+ * Return the number of conflicts, or -1 if they cannot be checked for.
+ */
+static int
+check_conflicts(LDAP *ld, cmdline *cmdline, tparser *p, GArray *offsets,
+		GPtrArray *stamps, char *clean, char *data, GPtrArray *ctrls)
+{
+	static thandler conflicts_handler = {
+		conflicts_change,
+		conflicts_rename,
+		conflicts_add,
+		conflicts_delete,
+		conflicts_rename0
+	};
+	struct conflicts c;
+
+	if (!stamps->len)
+		return -1;
+	c.changed = search_changes(ld, cmdline, (void *) ctrls->pdata,
+				   stamps);
+	if (!c.changed)
+		return -1;
+	c.stamps = stamps;
+	c.n = 0;
+	if (compare(p, &conflicts_handler, &c, offsets, clean, data, 0, 0))
+		yourfault("unexpected syntax error!");
+	g_hash_table_destroy(c.changed);
+	return c.n;
+}
+
+/*
+ * Return 0 when done.  With WINDOWED, return NEXT_WINDOW instead if the
+ * user wants to go on with the next window of entries.  *LDP is updated
+ * when the user reconnects.
+ */
+#define NEXT_WINDOW 1
+
+static int
+main_loop(LDAP **ldp, cmdline *cmdline,
+	  tparser *parser, GArray *offsets, GPtrArray *stamps,
+	  char *clean, char *data,
+	  GPtrArray *ctrls, char *dir, int windowed)
+{
+	LDAP *ld = *ldp;
 	int changed = 1;
 	int continuous = cmdline->continuous;
 
@@ -1592,22 +2505,52 @@ main_loop(LDAP *ld, cmdline *cmdline,
 			if (!analyze_changes(
 				    parser, offsets, clean, data, cmdline))
 			{
+				if (windowed
+				    && choose("Continue with the next window?",
+					      "yn", 0) == 'y')
+					return NEXT_WINDOW;
 				write_ldapvi_history();
 				return 0;
 			}
 		changed = 0;
 		switch (choose("Action?",
-			       "yYqQvVebB*rsf+?",
+			       windowed ? "yYqQvVebB*rsf+cn?"
+			       : "yYqQvVebB*rsf+c?",
 			       "(Type '?' for help.)")) {
 		case 'Y':
 			continuous = 1;
 			/* fall through */
 		case 'y':
-			commit(parser, ld, offsets, clean, data,
-			       (void *) ctrls->pdata, cmdline->verbose, 0,
-			       continuous, cmdline);
+			if (check_conflicts(ld, cmdline, parser, offsets,
+					    stamps, clean, data, ctrls) > 0
+			    && choose("Commit anyway?", "yn", 0) != 'y')
+				break;
+			if (commit(parser, ld, offsets, clean, data,
+				   (void *) ctrls->pdata, cmdline->verbose, 0,
+				   continuous, cmdline)
+			    == 0)
+			{
+				if (windowed)
+					return NEXT_WINDOW;
+				write_ldapvi_history();
+				return 0;
+			}
 			changed = 1;
-			break; /* reached only on user error */
+			break;
+		case 'c':
+			switch (check_conflicts(ld, cmdline, parser, offsets,
+						stamps, clean, data, ctrls)) {
+			case -1:
+				puts("Cannot check for conflicts: No entryCSN"
+				     " or modifyTimestamp values.");
+				break;
+			case 0:
+				puts("No conflicts.");
+				break;
+			}
+			break;
+		case 'n':
+			return NEXT_WINDOW;
 		case 'q':
 			if (save_ldif(parser,
 				      offsets, clean, data,
@@ -1654,6 +2597,7 @@ main_loop(LDAP *ld, cmdline *cmdline,
 				1,
 				0);
 			printf("Connected to %s.\n", cmdline->server);
+			*ldp = ld;
 			changed = 1; /* print stats again */
 			break;
 		case 's':
@@ -1671,7 +2615,7 @@ main_loop(LDAP *ld, cmdline *cmdline,
 			break;
 		case 'L' - '@':
 			{
-				char *clear = tigetstr("clear");
+				char *clear = terminal_string("clear");
 				if (clear && clear != (char *) -1)
 					putp(clear);
 			}
@@ -1692,10 +2636,113 @@ main_loop(LDAP *ld, cmdline *cmdline,
 			     "  s -- skip one entry\n"
 			     "  f -- forget deletions\n"
 			     "  + -- rewrite file to include schema comments\n"
-			     "  ? -- this help");
+			     "  c -- check for conflicting changes on the server");
+			if (windowed)
+				puts("  n -- discard changes, edit next window");
+			puts("  ? -- this help");
+			break;
+		}
+	}
+}
+
+/*
+ * Write the window of entries W into DATA and CLEAN.
+ *
+ * Positions in the sorted list are not stable across commits: entries
+ * deleted in the previous window move everything after them forward.
+ * When the list has shrunk since the last window, go back by the same
+ * number of entries, so that no entry is skipped.  (Entries may be shown
+ * twice instead, if others were added at the same time.)
+ */
+static GArray *
+window_write_files(
+	LDAP *ld, cmdline *cmdline,
+	char *clean, char *data, char *sasl,
+	GPtrArray *ctrls,
+	twindow *w,
+	GPtrArray *stamps,
+	int *nlines)
+{
+	GArray *offsets;
+	FILE *s;
+
+	for (;;) {
+		int count = w->count;
+		int line;
+
+		if ( !(s = fopen(data, "w"))) syserr();
+		line = write_file_header(s, cmdline);
+		if (w->target == 1)
+			line += copy_sasl_output(s, sasl);
+		free_stamps(stamps, 0);
+		offsets = search_window(
+			s, ld, cmdline, (void *) ctrls->pdata, w, stamps);
+		if (fclose(s) == EOF) syserr();
+		*nlines = line;
+		if (!count || w->count >= count || w->target == 1)
+			break;
+		w->target -= count - w->count;
+		if (w->target < 1)
+			w->target = 1;
+		g_array_free(offsets, 1);
+	}
+	cp(data, clean, 0, 0);
+	return offsets;
+}
+
+/*
+ * With --window, edit the search results a window at a time, using the
+ * virtual list view control to fetch each window only when the previous
+ * one is done.
+ */
+static int
+edit_windows(LDAP *ld, cmdline *cmdline, tparser *parser,
+	     char *clean, char *data, char *sasl, GPtrArray *ctrls, char *dir)
+{
+	GPtrArray *stamps = g_ptr_array_new();
+	twindow w;
+	int rc = NEXT_WINDOW;
+
+	w.target = 1;
+	w.size = cmdline->window;
+	w.count = 0;
+	w.context = 0;
+
+	while (rc == NEXT_WINDOW) {
+		int nlines;
+		int n;
+		GArray *offsets = window_write_files(
+			ld, cmdline, clean, data, sasl, ctrls, &w, stamps,
+			&nlines);
+
+		n = offsets->len;
+		if (!n) {
+			g_array_free(offsets, 1);
+			if (w.target == 1 && !cmdline->quiet)
+				fputs("No search results.\n", stderr);
+			write_ldapvi_history();
+			rc = 0;
 			break;
 		}
+		if (!cmdline->quiet)
+			printf("Entries %d-%d of %d.\n",
+			       w.target, w.target + n - 1, w.count);
+		edit(data, nlines + 1);
+		rc = main_loop(&ld, cmdline, parser, offsets, stamps,
+			       clean, data, ctrls, dir, 1);
+		g_array_free(offsets, 1);
+		w.target += n;
+		if (rc == NEXT_WINDOW && w.count && w.target > w.count) {
+			if (!cmdline->quiet)
+				puts("No more entries.");
+			write_ldapvi_history();
+			rc = 0;
+		}
 	}
+	if (w.context)
+		ber_bvfree(w.context);
+	free_stamps(stamps, 1);
+	return rc;
 }
 
 int
@@ -1709,6 +2756,7 @@ main(int argc, const char **argv)
 	char *data;
 	char *sasl;
 	GArray *offsets;
+	GPtrArray *stamps;
 	FILE *source_stream = 0;
 	FILE *target_stream = 0;
 	tparser *parser;
@@ -1726,8 +2774,23 @@ main(int argc, const char **argv)
 			     (char *) argv[3]);
 		exit(0);
 	}
+	if (argc >= 2 && !strcmp(argv[1], "--diff-dumps")) {
+		if (argc != 4) {
+			fputs("wrong number of arguments to --diff-dumps\n",
+			      stderr);
+			usage(2, 1);
+		}
+		exit(offline_diff_dumps(&ldif_parser,
+					(char *) argv[2],
+					(char *) argv[3])
+		     ? 1 : 0);
+	}
 
 	parse_arguments(argc, argv, &cmdline, ctrls);
+	if (cmdline.stats) {
+		stats_enable(cmdline.stats == 2);
+		atexit(stats_report);
+	}
 	if (fixup_streams(&source_stream, &target_stream) == -1)
 		cmdline.noninteractive = 1;
 	if (cmdline.noninteractive) {
@@ -1739,9 +2802,6 @@ main(int argc, const char **argv)
 		parser = &ldif_parser;
 	else
 		parser = &ldapvi_parser;
-	read_ldapvi_history();
-
-	setupterm(0, 1, 0);
 	ld = do_connect(cmdline.server,
 			&cmdline.bind_options,
 			cmdline.referrals,
@@ -1759,6 +2819,17 @@ main(int argc, const char **argv)
 		append_sort_control(ld, ctrls, cmdline.sortkeys);
 	g_ptr_array_add(ctrls, 0);
 
+	if (cmdline.window) {
+		if (!cmdline.sortkeys)
+			yourfault("--window requires server side sorting"
+				  " (--sort).");
+		if (cmdline.page_size)
+			yourfault("Conflicting options given:"
+				  " --page-size and --window.");
+		if (cmdline.discover || cmdline.basedns->len > 1)
+			yourfault("--window supports only one search base.");
+	}
+
 	if (cmdline.discover) {
 		if (cmdline.basedns->len > 0)
 			yourfault("Conflicting options given:"
@@ -1779,21 +2850,46 @@ main(int argc, const char **argv)
 			yourfault("Cannot edit entry templates noninteractively.");
 		if (!target_stream)
 			target_stream = stdout;
-		search(target_stream, ld, &cmdline, (void *) ctrls->pdata, 1,
-		       cmdline.mode == ldapvi_mode_out
-		       ? !cmdline.ldapvi
-		       : cmdline.ldif);
+		offsets = search(target_stream, ld, &cmdline,
+				 (void *) ctrls->pdata, 1,
+				 cmdline.mode == ldapvi_mode_out
+				 ? !cmdline.ldapvi
+				 : cmdline.ldif,
+				 0);
+		if (cmdline.index_file) {
+			if (fflush(target_stream) == EOF) syserr();
+			if (index_write(cmdline.index_file, target_stream,
+					offsets)
+			    == -1)
+				fputs("Warning: Cannot index output that is"
+				      " not a regular file.\n",
+				      stderr);
+		}
 		write_ldapvi_history();
 		exit(0);
 	}
 
+	if (cmdline.mode == ldapvi_mode_in && cmdline.noninteractive
+	    && !cmdline.ldapvi)
+	{
+		int rc = stream_changes(ld, &cmdline, ctrls, source_stream);
+		write_ldapvi_history();
+		return rc;
+	}
+
 	ensure_tmp_directory(dir);
 	clean = append(dir, "/clean");
 	data = append(dir, "/data");
 	sasl = append(dir, "/sasl");
 
+	if (cmdline.window && cmdline.mode == ldapvi_mode_edit
+	    && !cmdline.classes && !cmdline.noninteractive)
+		return edit_windows(
+			ld, &cmdline, parser, clean, data, sasl, ctrls, dir);
+
+	stamps = g_ptr_array_new();
 	offsets = main_write_files(
-		ld, &cmdline, clean, data, sasl, ctrls, source_stream,
+		ld, &cmdline, clean, data, sasl, ctrls, source_stream, stamps,
 		&nlines);
 
 	if (!cmdline.noninteractive) {
@@ -1813,12 +2909,18 @@ main(int argc, const char **argv)
 			write_ldapvi_history();
 			return 0;
 		}
-		commit(parser, ld, offsets, clean, data, (void *) ctrls->pdata,
-		       cmdline.verbose, 1, cmdline.continuous, &cmdline);
+		if (commit(parser, ld, offsets, clean, data,
+			   (void *) ctrls->pdata, cmdline.verbose, 1,
+			   cmdline.continuous, &cmdline)
+		    == 0)
+		{
+			write_ldapvi_history();
+			return 0;
+		}
 		fputs("Error in noninteractive mode, giving up.\n", stderr);
 		return 1;
 	}
 
-	return main_loop(
-		ld, &cmdline, parser, offsets, clean, data, ctrls, dir);
+	return main_loop(&ld, &cmdline, parser, offsets, stamps, clean, data,
+			 ctrls, dir, 0);
 }
@@ -0,0 +1,68 @@
+/* -*- show-trailing-whitespace: t; indent-tabs: t -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#define _GNU_SOURCE
+#include "common.h"
+
+/*
+ * Line reading shared by parse.c and parseldif.c.
+ *
+ * Attribute names are short and read character by character, but values
+ * make up most of the input, so they are read a line at a time.  getdelim
+ * searches the stdio buffer for the newline in one go and copies the line
+ * out in bulk.
+ */
+static char *line_buffer = 0;
+static size_t line_size = 0;
+
+/*
+ * Read the rest of the current line from S.  Set *LINE to its contents,
+ * which remain valid until the next call, and return its length, not
+ * counting the newline.  Return -1 if the file ends before the newline.
+ */
+int
+lex_line(FILE *s, char **line)
+{
+	ssize_t n = getdelim(&line_buffer, &line_size, '\n', s);
+
+	if (n == -1) {
+		if (ferror(s)) syserr();
+		return -1;
+	}
+	*line = line_buffer;
+	if (line_buffer[n - 1] != '\n')
+		return -1;
+	return n - 1;
+}
+
+/*
+ * After the end of a line, check whether the next line is a continuation
+ * line (starting with a space).  If so, consume the space and return 1.
+ * Else return 0.
+ */
+int
+lex_folded(FILE *s)
+{
+	int c = getc_unlocked(s);
+
+	if (c == ' ')
+		return 1;
+	if (c != EOF)
+		ungetc(c, s);
+	else if (ferror(s))
+		syserr();
+	return 0;
+}
@@ -83,6 +83,25 @@ fcopy(FILE *src, FILE *dst)
 	}
 }
 
+/*
+ * tigetstr, setting up the terminal on first use.  Runs that never
+ * display anything on the terminal don't need a terminal description,
+ * and without one (TERM unset or unknown) every capability is missing.
+ */
+char *
+terminal_string(char *capname)
+{
+	static int initialized = 0;
+	static int usable = 0;
+
+	if (!initialized) {
+		int err;
+		usable = setupterm(0, 1, &err) == OK;
+		initialized = 1;
+	}
+	return usable ? tigetstr(capname) : 0;
+}
+
 static int
 invalidp(char *ti)
 {
@@ -94,7 +113,7 @@ pipeview(int *fd)
 {
 	int childpid;
 	char *pg;
-	char *clear = tigetstr("clear");
+	char *clear = terminal_string("clear");
 	int fds[2];
 
 	pg = getenv("PAGER");
@@ -158,10 +177,21 @@ history_filename()
 	return home_filename(".ldapvi_history");
 }
 
+static int history_loaded = 0;
+
+/*
+ * Load the history file.  Called on the first prompt rather than at
+ * startup, so that runs without dialogs never read it.
+ */
 void
 read_ldapvi_history()
 {
-	char *filename = history_filename();
+	char *filename;
+
+	if (history_loaded)
+		return;
+	history_loaded = 1;
+	filename = history_filename();
 	using_history();
 	if (!filename)
 		return;
@@ -170,10 +200,15 @@ read_ldapvi_history()
 	free(filename);
 }
 
+/* Save the history, unless it was never loaded and hence is unchanged. */
 void
 write_ldapvi_history()
 {
-	char *filename = history_filename();
+	char *filename;
+
+	if (!history_loaded)
+		return;
+	filename = history_filename();
 	if (!filename)
 		return;
 	if (write_history(filename))
@@ -228,6 +263,7 @@ getline2(char *prompt, char *value, int password, int history)
 	if (password)
 		rl_redisplay_function = display_password;
 
+	read_ldapvi_history();
 	readline_default = value;
 	rl_startup_hook = cb_set_readline_default;
 	str = readline(prompt);
@@ -476,9 +512,9 @@ void
 dialog(char *header, tdialog *d, int n, int start)
 {
 	int i;
-	char *up = tigetstr("cuu1");
-	char *clreos = tigetstr("ed");
-	char *clear = tigetstr("clear");
+	char *up = terminal_string("cuu1");
+	char *clreos = terminal_string("ed");
+	char *clear = terminal_string("clear");
 #if 0
 	char *hsm = rl_variable_value("horizontal-scroll-mode");
 #endif
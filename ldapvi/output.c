@@ -0,0 +1,102 @@
+/* -*- show-trailing-whitespace: t; indent-tabs: t -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#define _GNU_SOURCE
+#include "common.h"
+
+/*
+ * Output streams for rendering search results.
+ *
+ * The stream handed out by output_open writes to the file descriptor of
+ * the target stream through a large buffer, and counts what it has
+ * written so that output_tell can compute file offsets without calling
+ * ftell (and hence lseek) for every entry.  Locking is left to the
+ * caller, since only one thread ever prints into the stream.
+ */
+#define OUTPUT_BUFSIZE (256 * 1024)
+
+static ssize_t
+output_write(void *cookie, const char *buf, size_t size)
+{
+	toutput *o = cookie;
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t n = write(o->fd, buf + done, size - done);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return done ? (ssize_t) done : -1;
+		}
+		done += n;
+	}
+	if (o->offset != -1)
+		o->offset += size;
+	stats_add(STAT_BYTES, size);
+	return size;
+}
+
+static cookie_io_functions_t output_functions = {
+	0, output_write, 0, 0
+};
+
+/*
+ * Return a stream for printing into TARGET.  Streams without a file
+ * descriptor (such as memory streams) are used directly.
+ */
+toutput *
+output_open(FILE *target)
+{
+	toutput *o = xalloc(sizeof(toutput));
+
+	if (fflush(target) == EOF) syserr();
+	o->target = target;
+	o->fd = fileno(target);
+	if (o->fd == -1) {
+		o->s = target;
+		o->offset = -1;
+		return o;
+	}
+	/* -1 for pipes and terminals, where offsets are not needed */
+	o->offset = ftell(target);
+	if ( !(o->s = fopencookie(o, "w", output_functions))) syserr();
+	if (setvbuf(o->s, 0, _IOFBF, OUTPUT_BUFSIZE)) syserr();
+	__fsetlocking(o->s, FSETLOCKING_BYCALLER);
+	return o;
+}
+
+/* The offset in the target file at which the next byte will be written. */
+long
+output_tell(toutput *o)
+{
+	if (o->fd == -1)
+		return ftell(o->s);
+	if (o->offset == -1)
+		return -1;
+	return o->offset + __fpending(o->s);
+}
+
+/*
+ * Write out everything buffered and free O.  The target stream stays
+ * open and continues where the output left off.
+ */
+void
+output_close(toutput *o)
+{
+	if (o->s != o->target)
+		if (fclose(o->s) == EOF) syserr();
+	free(o);
+}
@@ -57,22 +57,36 @@ read_lhs(FILE *s, GString *lhs)
 static int
 read_backslashed(FILE *s, GString *data)
 {
-	int c;
+	char *line;
+	int n;
+	int escaped_newline;
 
-	for (;;) {
-		switch ( c = getc_unlocked(s)) {
-		case '\n':
-			if (ferror(s)) syserr();
-			return 0;
-		case EOF:
-			goto error;
-		case '\\':
-			if ( (c = fgetc(s)) == EOF) goto error;
-			/* fall through */
-		default:
-			fast_g_string_append_c(data, c);
+	do {
+		char *ptr;
+		char *end;
+
+		if ( (n = lex_line(s, &line)) == -1) goto error;
+		ptr = line;
+		end = line + n;
+		escaped_newline = 0;
+		while (ptr < end) {
+			char *bs = memchr(ptr, '\\', end - ptr);
+			if (!bs) {
+				g_string_append_len(data, ptr, end - ptr);
+				break;
+			}
+			g_string_append_len(data, ptr, bs - ptr);
+			if (bs + 1 == end) {
+				/* the value continues on the next line */
+				g_string_append_c(data, '\n');
+				escaped_newline = 1;
+				break;
+			}
+			g_string_append_c(data, bs[1]);
+			ptr = bs + 2;
 		}
-	}
+	} while (escaped_newline);
+	return 0;
 
 error:
 	fputs("Error: Unexpected EOF.\n", stderr);
@@ -82,21 +96,17 @@ error:
 static int
 read_ldif_attrval(FILE *s, GString *data)
 {
-	int c;
+	char *line;
+	int n;
 
-	for (;;)
-		switch ( c = getc_unlocked(s)) {
-		case '\n':
-			if ( (c = fgetc(s)) == ' ') /* folded line */ break;
-			ungetc(c, s);
-			if (ferror(s)) syserr();
-			return 0;
-		case EOF:
+	do {
+		if ( (n = lex_line(s, &line)) == -1) {
 			fputs("Error: Unexpected EOF.\n", stderr);
 			return -1;
-		default:
-			fast_g_string_append_c(data, c);
 		}
+		g_string_append_len(data, line, n);
+	} while (lex_folded(s));
+	return 0;
 }
 
 static int
@@ -122,19 +132,15 @@ read_from_file(GString *data, char *name)
 static int
 skip_comment(FILE *s)
 {
-	int c;
+	char *line;
 
-	for (;;)
-		switch ( c = fgetc(s)) {
-		case EOF:
+	do
+		if (lex_line(s, &line) == -1) {
 			fputs("Error: Unexpected EOF.\n", stderr);
 			return -1;
-		case '\n':
-			if ( (c = fgetc(s)) == ' ') /* folded line */ break;
-			ungetc(c, s);
-			if (ferror(s)) syserr();
-			return 0;
 		}
+	while (lex_folded(s));
+	return 0;
 }
 
 static char *saltbag
@@ -104,28 +104,34 @@ ldif_read_encoding(FILE *s)
 	}
 }
 
+/*
+ * Strip the carriage return of a CRLF line ending.  Return -1 if the line
+ * contains any other carriage return.
+ */
+static int
+ldif_strip_cr(char *line, int *n)
+{
+	if (*n && line[*n - 1] == '\r')
+		(*n)--;
+	return memchr(line, '\r', *n) ? -1 : 0;
+}
+
 static int
 ldif_read_safe(FILE *s, GString *data)
 {
-	int c;
+	char *line;
+	int n;
 
-	for (;;)
-		switch ( c = getc_unlocked(s)) {
-		case '\r':
-			if (fgetc(s) != '\n')
-				return -1;
-			/* fall through */
-		case '\n':
-			if ( (c = fgetc(s)) == ' ') /* folded line */ break;
-			ungetc(c, s);
-			if (ferror(s)) syserr();
-			return 0;
-		case EOF:
+	do {
+		if ( (n = lex_line(s, &line)) == -1) {
 			fputs("Error: Unexpected EOF.\n", stderr);
 			return -1;
-		default:
-			fast_g_string_append_c(data, c);
 		}
+		if (ldif_strip_cr(line, &n) == -1)
+			return -1;
+		g_string_append_len(data, line, n);
+	} while (lex_folded(s));
+	return 0;
 }
 
 static int
@@ -151,23 +157,18 @@ ldif_read_from_file(GString *data, char *name)
 static int
 ldif_skip_comment(FILE *s)
 {
-	int c;
+	char *line;
+	int n;
 
-	for (;;)
-		switch ( c = fgetc(s)) {
-		case EOF:
+	do {
+		if ( (n = lex_line(s, &line)) == -1) {
 			fputs("Error: Unexpected EOF.\n", stderr);
 			return -1;
-		case '\r':
-			if (fgetc(s) != '\n')
-				return -1;
-			/* fall through */
-		case '\n':
-			if ( (c = fgetc(s)) == ' ') /* folded line */ break;
-			ungetc(c, s);
-			if (ferror(s)) syserr();
-			return 0;
 		}
+		if (ldif_strip_cr(line, &n) == -1)
+			return -1;
+	} while (lex_folded(s));
+	return 0;
 }
 
 /*
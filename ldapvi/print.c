@@ -22,118 +22,155 @@ t_print_binary_mode print_binary_mode = PRINT_UTF8;
 static void
 write_backslashed(FILE *s, char *ptr, int n)
 {
+	int start = 0;
 	int i;
+
 	for (i = 0; i < n; i++) {
 		char c = ptr[i];
-		if (c == '\n' || c == '\\') fputc('\\', s);
-		fputc(c, s);
+		if (c == '\n' || c == '\\') {
+			fwrite(ptr + start, 1, i - start, s);
+			fputc('\\', s);
+			start = i;
+		}
 	}
+	fwrite(ptr + start, 1, n - start, s);
 	if (ferror(s)) syserr();
 }
 
+/*
+ * Return the length of the valid UTF-8 multi-byte sequence at index I of
+ * STR (of length N), or 0 if there isn't one.
+ */
 static int
-utf8_string_p(unsigned char *str, int n)
+utf8_sequence_length(unsigned char *str, int i, int n)
 {
-	int i = 0;
-	while (i < n) {
-		unsigned char c = str[i++];
-		if (c >= 0xfe)
+	int start = i;
+	unsigned char c = str[i++];
+
+	if (c >= 0xfe)
+		return 0;
+	if (c >= 0xfc) {
+		unsigned char d;
+		if ((n - i < 5)
+		    || ((d=str[i++]) ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (c < 0xfd && d < 0x84))
 			return 0;
-		if (c >= 0xfc) {
-			unsigned char d;
-			if ((n - i < 5)
-			    || ((d=str[i++]) ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (c < 0xfd && d < 0x84))
-				return 0;
-		} else if (c >= 0xf8) {
-			unsigned char d;
-			if ((n - i < 4)
-			    || ((d=str[i++]) ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (c < 0xf9 && d < 0x88))
-				return 0;
-		} else if (c >= 0xf0) {
-			unsigned char d;
-			if ((n - i < 3)
-			    || ((d=str[i++]) ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (str[i++] ^ 0x80) >= 0x40
-			    || (c < 0xf1 && d < 0x90))
-				return 0;
-		} else if (c >= 0xe0) {
-			unsigned char d, e;
-			unsigned code;
-			if ((n - i < 2)
-			    || ((d=str[i++]) ^ 0x80) >= 0x40
-			    || ((e=str[i++]) ^ 0x80) >= 0x40
-			    || (c < 0xe1 && d < 0xa0))
-				return 0;
-			code = ((int) c & 0x0f) << 12
-				| ((int) d ^ 0x80) << 6
-				| ((int) e ^ 0x80);
-			if ((0xd800 <= code) && (code <= 0xdfff)
-			    || code == 0xfffe || code == 0xffff)
-				return 0;
-		} else if (c >= 0x80) {
-			unsigned char d;
-			if ((n - i < 1)
-			    || ((d=str[i++]) ^ 0x80) >= 0x40
-			    || (c < 0xc2))
-				return 0;
-		} else if (c == 0)
+	} else if (c >= 0xf8) {
+		unsigned char d;
+		if ((n - i < 4)
+		    || ((d=str[i++]) ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (c < 0xf9 && d < 0x88))
 			return 0;
-	}
-	return 1;
-}
-
-static int
-readable_string_p(char *str, int n)
-{
-	int i;
-	for (i = 0; i < n; i++) {
-		char c = str[i];
-		if (c < 32 && c != '\n' && c != '\t')
+	} else if (c >= 0xf0) {
+		unsigned char d;
+		if ((n - i < 3)
+		    || ((d=str[i++]) ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (str[i++] ^ 0x80) >= 0x40
+		    || (c < 0xf1 && d < 0x90))
+			return 0;
+	} else if (c >= 0xe0) {
+		unsigned char d, e;
+		unsigned code;
+		if ((n - i < 2)
+		    || ((d=str[i++]) ^ 0x80) >= 0x40
+		    || ((e=str[i++]) ^ 0x80) >= 0x40
+		    || (c < 0xe1 && d < 0xa0))
+			return 0;
+		code = ((int) c & 0x0f) << 12
+			| ((int) d ^ 0x80) << 6
+			| ((int) e ^ 0x80);
+		if ((0xd800 <= code) && (code <= 0xdfff)
+		    || code == 0xfffe || code == 0xffff)
+			return 0;
+	} else {
+		unsigned char d;
+		if ((n - i < 1)
+		    || ((d=str[i++]) ^ 0x80) >= 0x40
+		    || (c < 0xc2))
 			return 0;
 	}
-	return 1;
+	return i - start;
 }
 
+#define VALUE_UTF8 1		/* valid UTF-8 without null bytes */
+#define VALUE_READABLE 2	/* ASCII without control characters */
+#define VALUE_SAFE 4		/* a SAFE-STRING in LDIF syntax */
+
+#define ONES ((guint64) 0x0101010101010101ULL)
+#define HIGH_BITS (ONES * 0x80)
+
+/*
+ * Return the VALUE_ flags that apply to STR of length N, in a single pass.
+ * Runs of printable ASCII, which affect none of the flags, are skipped
+ * eight bytes at a time.
+ */
 static int
-safe_string_p(char *str, int n)
+classify_value(char *str, int n)
 {
-	unsigned char c;
-	int i;
+	unsigned char *ustr = (unsigned char *) str;
+	int flags = VALUE_UTF8 | VALUE_READABLE | VALUE_SAFE;
+	int i = 0;
 
-	if (n == 0) return 1;
+	if (n && (ustr[0] == ' ' || ustr[0] == ':' || ustr[0] == '<'))
+		flags &= ~VALUE_SAFE;
 
-	c = str[0];
-	if ((c == ' ') || (c == ':') || (c == '<'))
-		return 0;
+	while (i < n && flags) {
+		unsigned char c;
 
-	for (i = 0; i < n; i++) {
-		c = str[i];
-		if ((c == '\0') || (c == '\r') || (c == '\n') || (c >= 0x80))
-			return 0;
+		if (n - i >= 8) {
+			guint64 w;
+			memcpy(&w, ustr + i, 8);
+			/* no byte >= 0x80 and no byte < 0x20? */
+			if (!((w | ((w - ONES * 0x20) & ~w)) & HIGH_BITS)) {
+				i += 8;
+				continue;
+			}
+		}
+
+		c = ustr[i];
+		if (c >= 0x80) {
+			int len = utf8_sequence_length(ustr, i, n);
+			flags &= ~(VALUE_READABLE | VALUE_SAFE);
+			if (!len) {
+				flags &= ~VALUE_UTF8;
+				len = 1;
+			}
+			i += len;
+			continue;
+		}
+		if (c < 32) {
+			if (c != '\n' && c != '\t')
+				flags &= ~VALUE_READABLE;
+			if (c == 0)
+				flags &= ~(VALUE_UTF8 | VALUE_SAFE);
+			else if (c == '\r' || c == '\n')
+				flags &= ~VALUE_SAFE;
+		}
+		i++;
 	}
-	return 1;
+	return flags;
 }
 
 static void
 print_attrval(FILE *s, char *str, int len, int prefernocolon)
 {
+	int flags = classify_value(str, len);
 	int readablep;
+
 	switch (print_binary_mode) {
 	case PRINT_ASCII:
-		readablep = readable_string_p(str, len);
+		readablep = flags & VALUE_READABLE;
 		break;
 	case PRINT_UTF8:
-		readablep = utf8_string_p((unsigned char *) str, len);
+		readablep = flags & VALUE_UTF8;
 		break;
 	case PRINT_JUNK:
 		readablep = 1;
@@ -148,7 +185,7 @@ print_attrval(FILE *s, char *str, int len, int prefernocolon)
 	} else if (prefernocolon) {
 		fputc(' ', s);
 		write_backslashed(s, str, len);
-	} else if (!safe_string_p(str, len)) {
+	} else if (!(flags & VALUE_SAFE)) {
 		fputs(":; ", s);
 		write_backslashed(s, str, len);
 	} else {
@@ -333,7 +370,7 @@ print_ldif_line(FILE *s, char *ad, char *str, int len)
 	if (len == -1)
 		len = strlen(str);
 	fputs(ad, s);
-	if (safe_string_p(str, len)) {
+	if (classify_value(str, len) & VALUE_SAFE) {
 		fputs(": ", s);
 		fwrite(str, len, 1, s);
 	} else {
@@ -440,47 +477,177 @@ print_ldif_delete(FILE *s, char *dn)
 	if (ferror(s)) syserr();
 }
 
+/*
+ * The attributes of a search result entry, as decoded by message_decode.
+ * Names and values point into the BER element of the message and are not
+ * null-terminated; only the VALUES arrays themselves are allocated.  The
+ * message must therefore outlive the decoded copy, but printing the copy
+ * does not need the LDAP handle, so it is safe in another thread.
+ */
+typedef struct message_attribute {
+	struct berval ad;
+	struct berval *values;	/* terminated by a null bv_val */
+} message_attribute;
+
+struct decoded_message {
+	BerElement *ber;
+	struct berval dn;
+	GArray *attributes;
+	GString *name;		/* scratch buffer for null-terminated names */
+};
+
+static char *
+berval_string(GString *buf, struct berval *bv)
+{
+	g_string_truncate(buf, 0);
+	g_string_append_len(buf, bv->bv_val, bv->bv_len);
+	return buf->str;
+}
+
+/*
+ * Set up ENTROID for the object classes in VALUES, like search() used
+ * to do using ldap_get_values_len.  Errors end up in the comment.
+ */
+static void
+entroid_set_values(tentroid *entroid, struct berval *values, GString *buf)
+{
+	entroid_reset(entroid);
+	for (; values->bv_val; values++) {
+		char *name = berval_string(buf, values);
+		if (!entroid_request_class(entroid, name)) {
+			g_string_append(entroid->comment, "# ERROR: ");
+			g_string_append(entroid->comment, entroid->error->str);
+			return;
+		}
+	}
+	if (compute_entroid(entroid) == -1) {
+		g_string_append(entroid->comment, "# ERROR: ");
+		g_string_append(entroid->comment, entroid->error->str);
+	}
+}
+
+/*
+ * Decode ENTRY in a single pass over its BER element.  Attributes without
+ * values are dropped.
+ */
+tmessage *
+message_decode(LDAP *ld, LDAPMessage *entry)
+{
+	tmessage *m = xalloc(sizeof(tmessage));
+	message_attribute a;
+
+	if (ldap_get_dn_ber(ld, entry, &m->ber, &m->dn) != LDAP_SUCCESS)
+		ldaperr(ld, "ldap_get_dn_ber");
+	m->attributes = g_array_new(0, 0, sizeof(message_attribute));
+	m->name = g_string_sized_new(64);
+
+	for (;;) {
+		if (ldap_get_attribute_ber(ld, entry, m->ber, &a.ad, &a.values)
+		    != LDAP_SUCCESS)
+			ldaperr(ld, "ldap_get_attribute_ber");
+		if (!a.ad.bv_val)
+			break;
+		if (!a.values || !a.values->bv_val) {
+			if (a.values) ber_memfree(a.values);
+			continue;
+		}
+		g_array_append_val(m->attributes, a);
+	}
+	return m;
+}
+
 void
-print_ldapvi_message(FILE *s, LDAP *ld, LDAPMessage *entry, int key,
-		    tentroid *entroid)
+message_free(tmessage *m)
 {
-	char *dn, *ad;
-	BerElement *ber;
+	int i;
+
+	for (i = 0; i < m->attributes->len; i++) {
+		message_attribute *a
+			= &g_array_index(m->attributes, message_attribute, i);
+		ber_memfree(a->values);
+	}
+	g_array_free(m->attributes, 1);
+	g_string_free(m->name, 1);
+	ber_free(m->ber, 0);
+	free(m);
+}
+
+/*
+ * Hand the object classes of M to ENTROID (if any).  Return ENTROID, or
+ * NULL if ENTROID is NULL or the entry has no object classes, in which
+ * case there is nothing to comment on.
+ */
+static tentroid *
+message_entroid(tmessage *m, tentroid *entroid)
+{
+	int i;
+
+	if (!entroid)
+		return 0;
+	for (i = 0; i < m->attributes->len; i++) {
+		message_attribute *a
+			= &g_array_index(m->attributes, message_attribute, i);
+		if (a->ad.bv_len == sizeof("objectClass") - 1
+		    && !g_ascii_strncasecmp(a->ad.bv_val, "objectClass",
+					    a->ad.bv_len))
+		{
+			entroid_set_values(entroid, a->values, m->name);
+			return entroid;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Print decoded search result entry M in ldapvi syntax.  ENTROID, if
+ * non-null, is set up from the entry's object classes for the schema
+ * comments.
+ */
+void
+print_ldapvi_decoded(FILE *s, tmessage *m, int key, tentroid *entroid)
+{
+	int i;
+
+	entroid = message_entroid(m, entroid);
 
 	fprintf(s, "\n%d", key);
-	dn = ldap_get_dn(ld, entry);
-	print_attrval(s, dn, strlen(dn), 1);
-	ldap_memfree(dn);
+	print_attrval(s, m->dn.bv_val, m->dn.bv_len, 1);
 	fputc('\n', s);
 	if (entroid)
 		fputs(entroid->comment->str, s);
 
-	for (ad = ldap_first_attribute(ld, entry, &ber);
-	     ad;
-	     ad = ldap_next_attribute(ld, entry, ber))
-	{
-		struct berval **values = ldap_get_values_len(ld, entry, ad);
-		struct berval **ptr;
+	for (i = 0; i < m->attributes->len; i++) {
+		message_attribute *a
+			= &g_array_index(m->attributes, message_attribute, i);
+		struct berval *ptr;
 
-		if (!values) continue;
 		if (entroid)
-			entroid_remove_ad(entroid, ad);
-
-		for (ptr = values; *ptr; ptr++) {
-			fputs(ad, s);
-			print_attrval(s, (*ptr)->bv_val, (*ptr)->bv_len, 0);
+			entroid_remove_ad(entroid,
+					  berval_string(m->name, &a->ad));
+		for (ptr = a->values; ptr->bv_val; ptr++) {
+			fwrite(a->ad.bv_val, 1, a->ad.bv_len, s);
+			print_attrval(s, ptr->bv_val, ptr->bv_len, 0);
 			fputc('\n', s);
 		}
-		ldap_memfree(ad);
-		ldap_value_free_len(values);
 	}
-	ber_free(ber, 0);
 
 	if (entroid)
 		print_entroid_bottom(s, entroid);
 	if (ferror(s)) syserr();
 }
 
+/*
+ * Print search result ENTRY in ldapvi syntax, see print_ldapvi_decoded.
+ */
+void
+print_ldapvi_message(FILE *s, LDAP *ld, LDAPMessage *entry, int key,
+		    tentroid *entroid)
+{
+	tmessage *m = message_decode(ld, entry);
+	print_ldapvi_decoded(s, m, key, entroid);
+	message_free(m);
+}
+
 void
 print_ldif_entry(FILE *s, tentry *entry, char *key, tentroid *entroid)
 {
@@ -512,37 +679,50 @@ print_ldif_entry(FILE *s, tentry *entry, char *key, tentroid *entroid)
 		print_entroid_bottom(s, entroid);
 }
 
+/*
+ * Print decoded search result entry M as LDIF, with an ldapvi-key line
+ * unless KEY is -1.  ENTROID is used as in print_ldapvi_decoded.
+ */
 void
-print_ldif_message(FILE *s, LDAP *ld, LDAPMessage *entry, int key,
-		   tentroid *entroid)
+print_ldif_decoded(FILE *s, tmessage *m, int key, tentroid *entroid)
 {
-	char *dn, *ad;
-	BerElement *ber;
+	int i;
+
+	entroid = message_entroid(m, entroid);
 
 	fputc('\n', s);
 	if (entroid)
 		fputs(entroid->comment->str, s);
 
-	dn = ldap_get_dn(ld, entry);
-	print_ldif_line(s, "dn", dn, -1);
-	ldap_memfree(dn);
+	print_ldif_line(s, "dn", m->dn.bv_val, m->dn.bv_len);
 
 	if (key != -1)
 		fprintf(s, "ldapvi-key: %d\n", key);
 
-	for (ad = ldap_first_attribute(ld, entry, &ber);
-	     ad;
-	     ad = ldap_next_attribute(ld, entry, ber))
-	{
-		struct berval **values = ldap_get_values_len(ld, entry, ad);
+	for (i = 0; i < m->attributes->len; i++) {
+		message_attribute *a
+			= &g_array_index(m->attributes, message_attribute, i);
+		char *ad = berval_string(m->name, &a->ad);
+		struct berval *ptr;
+
 		if (entroid) entroid_remove_ad(entroid, ad);
-		print_ldif_bervals(s, ad, values);
-		ldap_memfree(ad);
-		ldap_value_free_len(values);
+		for (ptr = a->values; ptr->bv_val; ptr++)
+			print_ldif_line(s, ad, ptr->bv_val, ptr->bv_len);
 	}
-	ber_free(ber, 0);
 
 	if (entroid)
 		print_entroid_bottom(s, entroid);
 	if (ferror(s)) syserr();
 }
+
+/*
+ * Print search result ENTRY as LDIF, see print_ldif_decoded.
+ */
+void
+print_ldif_message(FILE *s, LDAP *ld, LDAPMessage *entry, int key,
+		   tentroid *entroid)
+{
+	tmessage *m = message_decode(ld, entry);
+	print_ldif_decoded(s, m, key, entroid);
+	message_free(m);
+}
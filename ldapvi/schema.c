@@ -119,9 +119,15 @@ free_type(gpointer key, gpointer value, gpointer data)
 	ldap_attributetype_free(value);
 }
 
+static void free_memo(gpointer key, gpointer value, gpointer data);
+
 void
 schema_free(tschema *schema)
 {
+	g_hash_table_foreach(schema->entroids, free_memo, 0);
+	g_hash_table_destroy(schema->entroids);
+	g_mutex_clear(&schema->lock);
+
 	g_hash_table_foreach_steal(schema->classes, aux_class_entry_p, 0);
 	g_hash_table_foreach_steal(schema->types, aux_type_entry_p, 0);
 
@@ -133,46 +139,181 @@ schema_free(tschema *schema)
 	free(schema);
 }
 
-tschema *
-schema_new(LDAP *ld)
+/*
+ * Schema cache.  Fetching the subschema entry takes a long time on
+ * servers with a large schema, so its definitions are kept in
+ * ~/.ldapvi_schema/, one file per server and subschema entry.  A file
+ * is used only while the modifyTimestamp and entryCSN of the subschema
+ * entry still match those it was written for.
+ *
+ * The file starts with SCHEMA_CACHE_MAGIC and the lines of the key,
+ * followed by the number of object classes, one definition per line,
+ * and then the same for attribute types.
+ */
+#define SCHEMA_CACHE_MAGIC "ldapvi schema cache 1"
+
+/* Return the next line of S without its newline, or 0 at the end. */
+static char *
+read_cache_line(FILE *s)
 {
-	LDAPMessage *result, *entry;
-	char **values;
-	char *subschema_dn;
-	int code;
-	const char *errp;
-	char *attrs[2] = {"subschemaSubentry", 0};
-	tschema *schema;
+	char *line;
+	int n = lex_line(s, &line);
 
-	if (ldap_search_s(ld, "", LDAP_SCOPE_BASE, 0, attrs, 0, &result)) {
-		ldap_perror(ld, "ldap_search");
+	if (n == -1)
 		return 0;
+	line[n] = 0;
+	return line;
+}
+
+static int
+read_definitions(FILE *s, GPtrArray *defs)
+{
+	char *line;
+	char *end;
+	long n;
+
+	if ( !(line = read_cache_line(s)))
+		return -1;
+	n = strtol(line, &end, 10);
+	if (!*line || *end || n < 0)
+		return -1;
+	while (n--) {
+		if ( !(line = read_cache_line(s)))
+			return -1;
+		g_ptr_array_add(defs, xdup(line));
 	}
-	if ( !(entry = ldap_first_entry(ld, result))) {
-		ldap_perror(ld, "ldap_first_entry");
+	return 0;
+}
+
+/*
+ * Read the definitions cached in S for KEY, a null-terminated array of
+ * strings, into CLASSES and TYPES.  Return 0 on success, -1 if S is
+ * not a cache file for this key.
+ */
+int
+schema_cache_read(FILE *s, char **key, GPtrArray *classes, GPtrArray *types)
+{
+	char *line;
+
+	line = read_cache_line(s);
+	if (!line || strcmp(line, SCHEMA_CACHE_MAGIC))
+		return -1;
+	for (; *key; key++)
+		if ( !(line = read_cache_line(s)) || strcmp(line, *key))
+			return -1;
+	if (read_definitions(s, classes) == -1)
+		return -1;
+	if (read_definitions(s, types) == -1)
+		return -1;
+	return 0;
+}
+
+static int
+write_definitions(FILE *s, char **defs)
+{
+	int n = 0;
+	int i;
+
+	if (defs)
+		while (defs[n]) n++;
+	fprintf(s, "%d\n", n);
+	for (i = 0; i < n; i++) {
+		if (strchr(defs[i], '\n'))
+			return -1;
+		fputs(defs[i], s);
+		fputc('\n', s);
+	}
+	return 0;
+}
+
+/*
+ * Write CLASSES and TYPES to S for KEY.  Return -1 if a definition
+ * cannot be represented in a cache file.
+ */
+int
+schema_cache_write(FILE *s, char **key, char **classes, char **types)
+{
+	fputs(SCHEMA_CACHE_MAGIC, s);
+	fputc('\n', s);
+	for (; *key; key++) {
+		if (strchr(*key, '\n'))
+			return -1;
+		fputs(*key, s);
+		fputc('\n', s);
+	}
+	if (write_definitions(s, classes) == -1)
+		return -1;
+	if (write_definitions(s, types) == -1)
+		return -1;
+	if (ferror(s)) syserr();
+	return 0;
+}
+
+/* The file for KEY, named after the server and subschema DN only. */
+static char *
+schema_cache_filename(char **key)
+{
+	char *dir = home_filename(".ldapvi_schema");
+	char *result;
+	guint hash = 0;
+
+	if (!dir)
+		return 0;
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		free(dir);
 		return 0;
 	}
-	values = ldap_get_values(ld, entry, "subschemaSubentry");
-	if (!values) {
-		fputs("subschemaSubentry attribute not found.", stderr);
-		ldap_msgfree(result);
+	hash = g_str_hash(key[0]) * 31 + g_str_hash(key[1]);
+	result = xalloc(strlen(dir) + 10);
+	sprintf(result, "%s/%08x", dir, hash);
+	free(dir);
+	return result;
+}
+
+/*
+ * Return a string identifying the current version of the subschema
+ * entry DN, or 0 if the server does not tell.
+ */
+static char *
+subschema_stamp(LDAP *ld, char *dn)
+{
+	LDAPMessage *result, *entry;
+	char *attrs[3] = {"modifyTimestamp", "entryCSN", 0};
+	GString *stamp = g_string_new("");
+	char **values;
+	int i;
+
+	if (ldap_search_s(ld, dn, LDAP_SCOPE_BASE, 0, attrs, 0, &result)) {
+		g_string_free(stamp, 1);
 		return 0;
 	}
-	subschema_dn = xdup(*values);
-	ldap_value_free(values);
+	if ( (entry = ldap_first_entry(ld, result)))
+		for (i = 0; attrs[i]; i++) {
+			values = ldap_get_values(ld, entry, attrs[i]);
+			if (!values)
+				continue;
+			if (stamp->len)
+				g_string_append_c(stamp, ' ');
+			g_string_append(stamp, *values);
+			ldap_value_free(values);
+		}
 	ldap_msgfree(result);
+	if (!stamp->len) {
+		g_string_free(stamp, 1);
+		return 0;
+	}
+	return g_string_free(stamp, 0);
+}
 
-	entry = get_entry(ld, subschema_dn, &result);
-	free(subschema_dn);
-	values = ldap_get_values(ld, entry, "objectClasses");
-
-	schema = xalloc(sizeof(tschema));
-	schema->classes = g_hash_table_new(strcasehash, strcaseequal);
-	schema->types = g_hash_table_new(strcasehash, strcaseequal);
+static void
+schema_add_definitions(tschema *schema, char **classes, char **types)
+{
+	int code;
+	const char *errp;
+	char **ptr;
 
-	if (values) {
-		char **ptr = values;
-		for (ptr = values; *ptr; ptr++) {
+	if (classes)
+		for (ptr = classes; *ptr; ptr++) {
 			LDAPObjectClass *cls
 				= ldap_str2objectclass(*ptr, &code, &errp, 0);
 			if (cls)
@@ -182,12 +323,8 @@ schema_new(LDAP *ld)
                                         "Warning: Cannot parse class: %s\n",
                                         ldap_scherr2str(code));
 		}
-		ldap_value_free(values);
-	}
-	values = ldap_get_values(ld, entry, "attributeTypes");
-	if (values) {
-		char **ptr = values;
-		for (ptr = values; *ptr; ptr++) {
+	if (types)
+		for (ptr = types; *ptr; ptr++) {
 			LDAPAttributeType *at
 				= ldap_str2attributetype(
 					*ptr, &code, &errp, 0);
@@ -198,9 +335,127 @@ schema_new(LDAP *ld)
                                         "Warning: Cannot parse type: %s\n",
                                         ldap_scherr2str(code));
 		}
-		ldap_value_free(values);
+}
+
+/*
+ * Try to fill SCHEMA from the cache file FILENAME.  Return 0 on
+ * success, -1 on a cache miss.
+ */
+static int
+schema_load_cache(tschema *schema, char *filename, char **key)
+{
+	GPtrArray *classes = g_ptr_array_new();
+	GPtrArray *types = g_ptr_array_new();
+	FILE *s = fopen(filename, "r");
+	int rc = -1;
+	int i;
+
+	if (s) {
+		rc = schema_cache_read(s, key, classes, types);
+		fclose(s);
+	}
+	if (rc == 0) {
+		g_ptr_array_add(classes, 0);
+		g_ptr_array_add(types, 0);
+		schema_add_definitions(schema,
+				       (char **) classes->pdata,
+				       (char **) types->pdata);
+	}
+	for (i = 0; i < classes->len; i++)
+		free(g_ptr_array_index(classes, i));
+	for (i = 0; i < types->len; i++)
+		free(g_ptr_array_index(types, i));
+	g_ptr_array_free(classes, 1);
+	g_ptr_array_free(types, 1);
+	return rc;
+}
+
+/*
+ * Replace the cache file atomically, so that concurrent ldapvi
+ * processes never see a partial file.  Failure is not an error.
+ */
+static void
+schema_save_cache(char *filename, char **key, char **classes, char **types)
+{
+	char *tmp = xalloc(strlen(filename) + 5);
+	FILE *s;
+	int rc;
+
+	sprintf(tmp, "%s.new", filename);
+	if ( (s = fopen(tmp, "w"))) {
+		rc = schema_cache_write(s, key, classes, types);
+		if (fclose(s) == EOF)
+			rc = -1;
+		if (rc == -1 || rename(tmp, filename) == -1)
+			unlink(tmp);
+	}
+	free(tmp);
+}
+
+tschema *
+schema_new(LDAP *ld)
+{
+	LDAPMessage *result, *entry;
+	char **values;
+	char **classes;
+	char **types;
+	char *subschema_dn;
+	char *attrs[2] = {"subschemaSubentry", 0};
+	char *key[4];
+	char *uri = 0;
+	char *filename = 0;
+	tschema *schema;
+
+	if (ldap_search_s(ld, "", LDAP_SCOPE_BASE, 0, attrs, 0, &result)) {
+		ldap_perror(ld, "ldap_search");
+		return 0;
+	}
+	if ( !(entry = ldap_first_entry(ld, result))) {
+		ldap_perror(ld, "ldap_first_entry");
+		return 0;
+	}
+	values = ldap_get_values(ld, entry, "subschemaSubentry");
+	if (!values) {
+		fputs("subschemaSubentry attribute not found.", stderr);
+		ldap_msgfree(result);
+		return 0;
 	}
+	subschema_dn = xdup(*values);
+	ldap_value_free(values);
 	ldap_msgfree(result);
+
+	schema = xalloc(sizeof(tschema));
+	schema->classes = g_hash_table_new(strcasehash, strcaseequal);
+	schema->types = g_hash_table_new(strcasehash, strcaseequal);
+	schema->entroids = g_hash_table_new(carray_hash, carray_equal);
+	g_mutex_init(&schema->lock);
+
+	ldap_get_option(ld, LDAP_OPT_URI, &uri);
+	key[0] = uri ? uri : "";
+	key[1] = subschema_dn;
+	key[2] = subschema_stamp(ld, subschema_dn);
+	key[3] = 0;
+	if (key[2]) {
+		filename = schema_cache_filename(key);
+		if (filename && !schema_load_cache(schema, filename, key))
+			goto done;
+	}
+
+	entry = get_entry(ld, subschema_dn, &result);
+	classes = ldap_get_values(ld, entry, "objectClasses");
+	types = ldap_get_values(ld, entry, "attributeTypes");
+	schema_add_definitions(schema, classes, types);
+	if (filename)
+		schema_save_cache(filename, key, classes, types);
+	if (classes) ldap_value_free(classes);
+	if (types) ldap_value_free(types);
+	ldap_msgfree(result);
+
+done:
+	free(filename);
+	free(key[2]);
+	if (uri) ldap_memfree(uri);
+	free(subschema_dn);
 	return schema;
 }
 
@@ -351,8 +606,8 @@ compute_entroid_1(tentroid *entroid, LDAPObjectClass *cls)
  * Return 0 on success, -1 else.
  * Error message, if any, in entroid->error.
  */
-int
-compute_entroid(tentroid *entroid)
+static int
+compute_entroid_uncached(tentroid *entroid)
 {
 	int i;
 	for (i = 0; i < entroid->classes->len; i++) {
@@ -366,3 +621,104 @@ compute_entroid(tentroid *entroid)
 				" no structural object class specified!\n");
 	return 0;
 }
+
+/*
+ * Entries of a search result share only a handful of objectclass
+ * combinations, so the schema remembers every entroid computed from
+ * scratch, keyed by the list of requested classes.  The memo holds what
+ * compute_entroid_uncached added to the entroid, which is copied into the
+ * caller's entroid on later hits.
+ */
+typedef struct entroid_memo {
+	int rc;
+	GPtrArray *classes;
+	GPtrArray *must;
+	GPtrArray *may;
+	LDAPObjectClass *structural;
+	char *comment;
+	char *error;
+} entroid_memo;
+
+static void
+copy_ptr_array(GPtrArray *dst, GPtrArray *src)
+{
+	g_ptr_array_set_size(dst, src->len);
+	memcpy(dst->pdata, src->pdata, src->len * sizeof(gpointer));
+}
+
+static GPtrArray *
+dup_ptr_array(GPtrArray *src)
+{
+	GPtrArray *result = g_ptr_array_sized_new(src->len);
+	copy_ptr_array(result, src);
+	return result;
+}
+
+static void
+free_memo(gpointer key, gpointer value, gpointer data)
+{
+	entroid_memo *memo = value;
+
+	g_array_free(key, 1);
+	g_ptr_array_free(memo->classes, 1);
+	g_ptr_array_free(memo->must, 1);
+	g_ptr_array_free(memo->may, 1);
+	free(memo->comment);
+	free(memo->error);
+	free(memo);
+}
+
+int
+compute_entroid(tentroid *entroid)
+{
+	tschema *schema = entroid->schema;
+	GArray *key;
+	entroid_memo *memo;
+	int comment_start = entroid->comment->len;
+	int rc;
+
+	/* only the state left by entroid_reset and requests is memoized */
+	if (entroid->must->len || entroid->may->len || entroid->structural)
+		return compute_entroid_uncached(entroid);
+
+	key = g_array_sized_new(
+		0, 0, 1, entroid->classes->len * sizeof(gpointer));
+	g_array_append_vals(key,
+			    entroid->classes->pdata,
+			    entroid->classes->len * sizeof(gpointer));
+
+	g_mutex_lock(&schema->lock);
+	memo = g_hash_table_lookup(schema->entroids, key);
+	g_mutex_unlock(&schema->lock);
+
+	if (memo) {
+		g_array_free(key, 1);
+		copy_ptr_array(entroid->classes, memo->classes);
+		copy_ptr_array(entroid->must, memo->must);
+		copy_ptr_array(entroid->may, memo->may);
+		entroid->structural = memo->structural;
+		g_string_append(entroid->comment, memo->comment);
+		if (memo->error)
+			g_string_assign(entroid->error, memo->error);
+		return memo->rc;
+	}
+
+	rc = compute_entroid_uncached(entroid);
+	memo = xalloc(sizeof(entroid_memo));
+	memo->rc = rc;
+	memo->classes = dup_ptr_array(entroid->classes);
+	memo->must = dup_ptr_array(entroid->must);
+	memo->may = dup_ptr_array(entroid->may);
+	memo->structural = entroid->structural;
+	memo->comment = xdup(entroid->comment->str + comment_start);
+	memo->error = rc ? xdup(entroid->error->str) : 0;
+
+	g_mutex_lock(&schema->lock);
+	if (g_hash_table_lookup(schema->entroids, key))
+		/* another thread was faster */
+		free_memo(key, memo, 0);
+	else
+		g_hash_table_insert(schema->entroids, key, memo);
+	g_mutex_unlock(&schema->lock);
+	return rc;
+}
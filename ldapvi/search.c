@@ -113,113 +113,607 @@ log_reference(LDAP *ld, LDAPMessage *reference, FILE *s)
 	ldap_value_free(refs);
 }
 
-static tentroid *
-entroid_set_message(LDAP *ld, tentroid *entroid, LDAPMessage *entry)
+/*
+ * Return a copy of CTRLS with CTRL added at the end.
+ */
+static LDAPControl **
+extend_controls(LDAPControl **ctrls, LDAPControl *ctrl)
 {
-	struct berval **values = ldap_get_values_len(ld, entry, "objectClass");
-	struct berval **ptr;
+	LDAPControl **result;
+	int n = 0;
+	int i;
 
-	if (!values || !*values)
-		return 0;
+	if (ctrls)
+		while (ctrls[n]) n++;
+	result = xalloc((n + 2) * sizeof(LDAPControl *));
+	for (i = 0; i < n; i++)
+		result[i] = ctrls[i];
+	result[n] = ctrl;
+	result[n + 1] = 0;
+	return result;
+}
+
+static LDAPControl **
+page_controls(LDAP *ld, LDAPControl **ctrls, int size, struct berval *cookie)
+{
+	LDAPControl *ctrl;
+
+	if (ldap_create_page_control(ld, size, cookie, 0, &ctrl))
+		ldaperr(ld, "ldap_create_page_control");
+	return extend_controls(ctrls, ctrl);
+}
+
+/* Free the result of extend_controls, including the added control. */
+static void
+free_extended_controls(LDAPControl **ctrls)
+{
+	LDAPControl **ptr;
+
+	for (ptr = ctrls; ptr[1]; ptr++)
+		;
+	ldap_control_free(*ptr);
+	free(ctrls);
+}
+
+/*
+ * Extract the paged results cookie from the search result message.
+ * Returns 1 if the server has more pages for us, 0 otherwise.
+ */
+static int
+next_page_cookie(LDAP *ld, LDAPMessage *result, struct berval *cookie)
+{
+	LDAPControl **sctrls = 0;
+	LDAPControl *ctrl;
+	ber_int_t count;
+	int err;
+	int more = 0;
+
+	if (ldap_parse_result(ld, result, &err, 0, 0, 0, &sctrls, 0))
+		ldaperr(ld, "ldap_parse_result");
+	if (cookie->bv_val) {
+		ldap_memfree(cookie->bv_val);
+		cookie->bv_val = 0;
+		cookie->bv_len = 0;
+	}
+	ctrl = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, sctrls, 0);
+	if (!err && ctrl) {
+		if (ldap_parse_pageresponse_control(ld, ctrl, &count, cookie))
+			ldaperr(ld, "ldap_parse_pageresponse_control");
+		more = cookie->bv_val && cookie->bv_len > 0;
+	}
+	if (sctrls) ldap_controls_free(sctrls);
+	return more;
+}
+
+/*
+ * Update W from the virtual list view response control of the search
+ * result message.
+ */
+static void
+next_window(LDAP *ld, LDAPMessage *result, twindow *w)
+{
+	LDAPControl **sctrls = 0;
+	LDAPControl *ctrl;
+	ber_int_t target;
+	ber_int_t count;
+	struct berval *context = 0;
+	int err;
+	int vlverr;
+
+	if (ldap_parse_result(ld, result, &err, 0, 0, 0, &sctrls, 0))
+		ldaperr(ld, "ldap_parse_result");
+	ctrl = ldap_control_find(LDAP_CONTROL_VLVRESPONSE, sctrls, 0);
+	if (!err && ctrl) {
+		if (ldap_parse_vlvresponse_control(
+			    ld, ctrl, &target, &count, &context, &vlverr))
+			ldaperr(ld, "ldap_parse_vlvresponse_control");
+		if (vlverr) {
+			fprintf(stderr, "Virtual list view failed: %s\n",
+				ldap_err2string(vlverr));
+			exit(1);
+		}
+		w->target = target;
+		w->count = count;
+		if (context) {
+			if (w->context) ber_bvfree(w->context);
+			w->context = context;
+		}
+	} else if (!err) {
+		fputs("Error: Server ignored the virtual list view"
+		      " control.\n",
+		      stderr);
+		exit(1);
+	}
+	if (sctrls) ldap_controls_free(sctrls);
+}
+
+/*
+ * State of a multi-base search.  All base searches are sent at once and
+ * their responses are read with LDAP_RES_ANY as they arrive.  Only the
+ * first unfinished base (the "head") is written to the file directly;
+ * messages for later bases are queued until every base before them is
+ * complete, so that keys and offsets come out in the same order as if
+ * the searches had been run one after another.  With --page-size, the
+ * next page of a later base is only requested once it becomes the head,
+ * so that no more than one page per base is queued.
+ */
+typedef struct search_base {
+	char *dn;
+	int msgid;		/* outstanding request, or -1 */
+	struct berval cookie;	/* paged results cookie */
+	int deferred;		/* next page not requested yet */
+	GPtrArray *queue;	/* messages waiting for their turn */
+	int start;		/* first key of this base */
+} search_base;
+
+struct render_pool;
+
+typedef struct search_state {
+	toutput *out;
+	FILE *s;
+	LDAP *ld;
+	GArray *offsets;
+	GPtrArray *stamps;	/* parallel to offsets, or 0 */
+	cmdline *cmdline;
+	LDAPControl **ctrls;
+	int notty;
+	int ldif;
+	tentroid *entroid;
+	int n;
+	search_base *bases;
+	int nbases;
+	int head;
+	struct render_pool *pool; /* with --render-threads, else 0 */
+	twindow *window;	/* with --window, else 0 */
+} search_state;
+
+/*
+ * With --render-threads, entries are formatted by worker threads while
+ * the main thread keeps reading from the connection.  Every entry is
+ * printed into a buffer of its own, and the main thread writes the
+ * buffers to the file in key order, so that the result is the same as
+ * with inline rendering.  References and search results wait until all
+ * entries before them have been written.
+ */
+#define RENDER_WINDOW 64	/* entries in flight per thread */
+
+typedef struct render_job {
+	LDAPMessage *entry;
+	tmessage *message;	/* ENTRY, decoded by the main thread */
+	int key;
+	char *buf;
+	size_t len;
+	int done;		/* protected by pool->lock */
+} render_job;
+
+typedef struct render_pool {
+	search_state *st;
+	GThread **threads;
+	int nthreads;
+	GAsyncQueue *jobs;	/* jobs waiting for a worker */
+	GPtrArray *pending;	/* jobs not written yet, in key order */
+	GMutex lock;
+	GCond done;
+} render_pool;
+
+static void
+send_search(search_state *st, search_base *b)
+{
+	cmdline *cmdline = st->cmdline;
+	LDAPControl **page;
+
+	/* with --page-size, each round trip asks for one page */
+	if (cmdline->page_size)
+		page = page_controls(
+			st->ld, st->ctrls, cmdline->page_size, &b->cookie);
+	else
+		page = 0;
+	if (ldap_search_ext(
+		    st->ld, b->dn,
+		    cmdline->scope, cmdline->filter, cmdline->attrs,
+		    0, page ? page : st->ctrls, 0, 0, 0, &b->msgid))
+		ldaperr(st->ld, "ldap_search");
+	if (page)
+		free_extended_controls(page);
+}
+
+static void
+start_base(search_state *st, search_base *b)
+{
+	b->start = st->n;
+	if (!st->cmdline->quiet && st->nbases > 1)
+		fprintf(stderr, "Searching in: %s\n", b->dn);
+}
 
-	entroid_reset(entroid);
-	for (ptr = values; *ptr; ptr++) {
-		struct berval *value = *ptr;
-		LDAPObjectClass *cls
-			= entroid_request_class(entroid, value->bv_val);
-		if (!cls) {
-			g_string_append(entroid->comment, "# ERROR: ");
-			g_string_append(entroid->comment, entroid->error->str);
+/*
+ * Return the entryCSN or, failing that, the modifyTimestamp of ENTRY as
+ * a string "ad=value", or NULL if the server has sent neither.
+ */
+char *
+entry_stamp(LDAP *ld, LDAPMessage *entry)
+{
+	static char *ads[] = {"entryCSN", "modifyTimestamp", 0};
+	char **ad;
+
+	for (ad = ads; *ad; ad++) {
+		struct berval **values = ldap_get_values_len(ld, entry, *ad);
+		char *stamp;
+		int n;
+
+		if (!values)
+			continue;
+		if (!*values) {
 			ldap_value_free_len(values);
-			return entroid;
+			continue;
 		}
+		n = strlen(*ad);
+		stamp = xalloc(n + values[0]->bv_len + 2);
+		memcpy(stamp, *ad, n);
+		stamp[n] = '=';
+		memcpy(stamp + n + 1, values[0]->bv_val, values[0]->bv_len);
+		stamp[n + 1 + values[0]->bv_len] = 0;
+		ldap_value_free_len(values);
+		return stamp;
 	}
-	ldap_value_free_len(values);
+	return 0;
+}
+
+static void
+record_offset(search_state *st, LDAPMessage *entry)
+{
+	long offset = output_tell(st->out);
+	if (offset == -1 && !st->notty) syserr();
+	g_array_append_val(st->offsets, offset);
+	if (st->stamps)
+		g_ptr_array_add(st->stamps, entry_stamp(st->ld, entry));
+}
+
+/*
+ * Print decoded entry MESSAGE with key KEY into S, using ENTROID (if any)
+ * for schema comments.  Worker threads pass a stream and an entroid of
+ * their own.
+ *
+ * libldap keeps the error code of each call in the LDAP handle, so only
+ * the main thread may decode messages; workers print the decoded copy.
+ */
+static void
+render_entry(search_state *st, FILE *s, tentroid *entroid,
+	     tmessage *message, int key)
+{
+	guint64 start = stats_now();
 
-	if (compute_entroid(entroid) == -1) {
-		g_string_append(entroid->comment, "# ERROR: ");
-		g_string_append(entroid->comment, entroid->error->str);
-		return entroid;
+	if (st->ldif)
+		print_ldif_decoded(s, message, st->notty ? -1 : key, entroid);
+	else
+		print_ldapvi_decoded(s, message, key, entroid);
+	stats_time(STAT_RENDER, start);
+}
+
+static gpointer
+render_worker(gpointer data)
+{
+	render_pool *pool = data;
+	search_state *st = pool->st;
+	tentroid *entroid = 0;
+	render_job *job;
+
+	if (st->entroid)
+		entroid = entroid_new(st->entroid->schema);
+	/* the pool itself is pushed to tell a worker to stop */
+	while ( (job = g_async_queue_pop(pool->jobs)) != (void *) pool) {
+		FILE *s = open_memstream(&job->buf, &job->len);
+		if (!s) syserr();
+		render_entry(st, s, entroid, job->message, job->key);
+		if (fclose(s) == EOF) syserr();
+		message_free(job->message);
+
+		g_mutex_lock(&pool->lock);
+		job->done = 1;
+		g_cond_broadcast(&pool->done);
+		g_mutex_unlock(&pool->lock);
 	}
-	return entroid;
+	if (entroid)
+		entroid_free(entroid);
+	return 0;
 }
 
-void
-search_subtree(FILE *s, LDAP *ld, GArray *offsets, char *base,
-	       cmdline *cmdline, LDAPControl **ctrls, int notty, int ldif,
-	       tschema *schema)
+static render_pool *
+render_pool_new(search_state *st, int nthreads)
 {
-	int msgid;
-	LDAPMessage *result, *entry;
-	int start = offsets->len;
-	int n = start;
-	long offset;
-	tentroid *entroid;
-	tentroid *e;
+	render_pool *pool = xalloc(sizeof(render_pool));
+	int i;
 
-	if (schema)
-		entroid = entroid_new(schema);
+	pool->st = st;
+	pool->nthreads = nthreads;
+	pool->jobs = g_async_queue_new();
+	pool->pending = g_ptr_array_new();
+	g_mutex_init(&pool->lock);
+	g_cond_init(&pool->done);
+	pool->threads = xalloc(nthreads * sizeof(GThread *));
+	for (i = 0; i < nthreads; i++)
+		pool->threads[i] = g_thread_new("render", render_worker, pool);
+	return pool;
+}
+
+static void
+render_pool_free(render_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->nthreads; i++)
+		g_async_queue_push(pool->jobs, pool);
+	for (i = 0; i < pool->nthreads; i++)
+		g_thread_join(pool->threads[i]);
+	free(pool->threads);
+	g_async_queue_unref(pool->jobs);
+	g_ptr_array_free(pool->pending, 1);
+	g_mutex_clear(&pool->lock);
+	g_cond_clear(&pool->done);
+	free(pool);
+}
+
+static void
+write_job(render_pool *pool, render_job *job)
+{
+	search_state *st = pool->st;
+
+	record_offset(st, job->entry);
+	fwrite(job->buf, 1, job->len, st->s);
+	if (ferror(st->s)) syserr();
+	free(job->buf);
+	if (!st->cmdline->quiet && !st->notty)
+		update_progress(st->ld, job->key + 1, job->entry);
+	ldap_msgfree(job->entry);
+	free(job);
+}
+
+/*
+ * Write the finished jobs at the front of the queue, waiting for more
+ * to finish until no more than KEEP jobs are left.
+ */
+static void
+write_rendered(render_pool *pool, unsigned int keep)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->pending->len; i++) {
+		render_job *job = g_ptr_array_index(pool->pending, i);
+		int done;
+
+		g_mutex_lock(&pool->lock);
+		while (!job->done && pool->pending->len - i > keep)
+			g_cond_wait(&pool->done, &pool->lock);
+		done = job->done;
+		g_mutex_unlock(&pool->lock);
+		if (!done)
+			break;
+		write_job(pool, job);
+	}
+	g_ptr_array_remove_range(pool->pending, 0, i);
+}
+
+static void
+submit_entry(render_pool *pool, LDAPMessage *entry, int key)
+{
+	render_job *job = xalloc(sizeof(render_job));
+
+	job->entry = entry;
+	job->message = message_decode(pool->st->ld, entry);
+	job->key = key;
+	job->buf = 0;
+	job->len = 0;
+	job->done = 0;
+	g_ptr_array_add(pool->pending, job);
+	g_async_queue_push(pool->jobs, job);
+	write_rendered(pool, pool->nthreads * RENDER_WINDOW);
+}
+
+/*
+ * Write one message of the head base to the file.  Returns 1 if this
+ * was the final search result of the base, 0 otherwise.
+ */
+static int
+render_message(search_state *st, search_base *b, LDAPMessage *result)
+{
+	LDAP *ld = st->ld;
+	cmdline *cmdline = st->cmdline;
+	LDAPMessage *entry;
+	tmessage *message;
+
+	switch (ldap_msgtype(result)) {
+	case LDAP_RES_SEARCH_ENTRY:
+		entry = ldap_first_entry(ld, result);
+		if (st->pool) {
+			submit_entry(st->pool, entry, st->n++);
+			return 0;
+		}
+		record_offset(st, entry);
+		message = message_decode(ld, entry);
+		render_entry(st, st->s, st->entroid, message, st->n);
+		message_free(message);
+		st->n++;
+		if (!cmdline->quiet && !st->notty)
+			update_progress(ld, st->n, entry);
+		ldap_msgfree(entry);
+		return 0;
+	case LDAP_RES_SEARCH_REFERENCE:
+		if (st->pool)
+			write_rendered(st->pool, 0);
+		log_reference(ld, result, st->s);
+		ldap_msgfree(result);
+		return 0;
+	case LDAP_RES_SEARCH_RESULT:
+		if (st->pool)
+			write_rendered(st->pool, 0);
+		if (!st->notty) {
+			update_progress(ld, st->n, 0);
+			putchar('\n');
+		}
+		handle_result(ld, result, b->start, st->n, !cmdline->quiet,
+			      st->notty);
+		ldap_msgfree(result);
+		return 1;
+	default:
+		abort();
+	}
+}
+
+/*
+ * The head base is complete.  Move on to the next one and write
+ * whatever has been queued for it already, repeating as long as the new
+ * head turns out to be finished, too.
+ */
+static void
+advance_head(search_state *st)
+{
+	while (++st->head < st->nbases) {
+		search_base *b = &st->bases[st->head];
+		int done = 0;
+		int i;
+
+		start_base(st, b);
+		for (i = 0; i < b->queue->len; i++)
+			done = render_message(
+				st, b, g_ptr_array_index(b->queue, i));
+		g_ptr_array_set_size(b->queue, 0);
+		if (b->deferred) {
+			b->deferred = 0;
+			send_search(st, b);
+		}
+		if (!done)
+			break;
+	}
+}
+
+static search_base *
+find_base(search_state *st, int msgid)
+{
+	int i;
+	for (i = st->head; i < st->nbases; i++)
+		if (st->bases[i].msgid == msgid)
+			return &st->bases[i];
+	return 0;
+}
+
+static void
+search_bases(FILE *s, LDAP *ld, GArray *offsets, GPtrArray *stamps,
+	     char **dns, int ndns,
+	     cmdline *cmdline, LDAPControl **ctrls, int notty, int ldif,
+	     tschema *schema, twindow *window)
+{
+	search_state st;
+	LDAPMessage *result;
+	guint64 start = stats_now();
+	guint first = offsets->len;
+	int i;
+
+	st.out = output_open(s);
+	st.s = st.out->s;
+	st.ld = ld;
+	st.offsets = offsets;
+	st.stamps = stamps;
+	st.cmdline = cmdline;
+	st.ctrls = ctrls;
+	st.notty = notty;
+	st.ldif = ldif;
+	st.entroid = schema ? entroid_new(schema) : 0;
+	st.n = offsets->len;
+	st.bases = xalloc(ndns * sizeof(search_base));
+	st.nbases = ndns;
+	st.head = 0;
+	st.window = window;
+	if (cmdline->render_threads > 0)
+		st.pool = render_pool_new(&st, cmdline->render_threads);
 	else
-		entroid = 0;
+		st.pool = 0;
 
-	if (ldap_search_ext(
-		    ld, base,
-		    cmdline->scope, cmdline->filter, cmdline->attrs,
-		    0, ctrls, 0, 0, 0, &msgid))
-		ldaperr(ld, "ldap_search");
+	for (i = 0; i < ndns; i++) {
+		search_base *b = &st.bases[i];
+		b->dn = dns[i];
+		b->cookie.bv_len = 0;
+		b->cookie.bv_val = 0;
+		b->deferred = 0;
+		b->queue = g_ptr_array_new();
+		send_search(&st, b);
+	}
+	start_base(&st, &st.bases[0]);
 
-	while (n >= 0)
-		switch (ldap_result(ld, msgid, 0, 0, &result)) {
-		case -1:
-		case 0:
+	while (st.head < st.nbases) {
+		search_base *b;
+		guint64 wait = stats_now();
+		int type;
+
+		type = ldap_result(ld, LDAP_RES_ANY, LDAP_MSG_ONE, 0, &result);
+		stats_time(STAT_LDAP_RESULT, wait);
+		if (type == -1 || type == 0)
 			ldaperr(ld, "ldap_result");
-		case LDAP_RES_SEARCH_ENTRY:
-			entry = ldap_first_entry(ld, result);
-			offset = ftell(s);
-			if (offset == -1 && !notty) syserr();
-			g_array_append_val(offsets, offset);
-			if (entroid)
-				e = entroid_set_message(ld, entroid, entry);
-			else
-				e = 0;
-			if (ldif)
-				print_ldif_message(
-					s, ld, entry, notty ? -1 : n, e);
-			else
-				print_ldapvi_message(s, ld, entry, n, e);
-			n++;
-			if (!cmdline->quiet && !notty)
-				update_progress(ld, n, entry);
-			ldap_msgfree(entry);
-			break;
-		case LDAP_RES_SEARCH_REFERENCE:
-			log_reference(ld, result, s);
+		if ( !(b = find_base(&st, ldap_msgid(result)))) {
 			ldap_msgfree(result);
-			break;
-		case LDAP_RES_SEARCH_RESULT:
-			if (!notty) {
-				update_progress(ld, n, 0);
-				putchar('\n');
+			continue;
+		}
+		if (type == LDAP_RES_SEARCH_RESULT) {
+			if (cmdline->page_size
+			    && next_page_cookie(ld, result, &b->cookie))
+			{
+				/* this intermediate result carries no
+				 * data; ask for the next page right away
+				 * if it can be written */
+				ldap_msgfree(result);
+				if (b == &st.bases[st.head])
+					send_search(&st, b);
+				else {
+					b->msgid = -1;
+					b->deferred = 1;
+				}
+				continue;
 			}
-			handle_result(ld, result, start, n, !cmdline->quiet,
-				      notty);
-			n = -1;
-			ldap_msgfree(result);
-			break;
-		default:
-			abort();
+			b->msgid = -1;
+			if (st.window)
+				next_window(ld, result, st.window);
 		}
-	if (entroid)
-		entroid_free(entroid);
+		if (b == &st.bases[st.head]) {
+			if (render_message(&st, b, result))
+				advance_head(&st);
+		} else
+			g_ptr_array_add(b->queue, result);
+	}
+
+	for (i = 0; i < ndns; i++) {
+		search_base *b = &st.bases[i];
+		if (b->cookie.bv_val)
+			ldap_memfree(b->cookie.bv_val);
+		g_ptr_array_free(b->queue, 1);
+	}
+	free(st.bases);
+	if (st.pool)
+		render_pool_free(st.pool);
+	output_close(st.out);
+	if (st.entroid)
+		entroid_free(st.entroid);
+	stats_add(STAT_ENTRIES, offsets->len - first);
+	stats_time(STAT_SEARCH, start);
+}
+
+void
+search_subtree(FILE *s, LDAP *ld, GArray *offsets, char *base,
+	       cmdline *cmdline, LDAPControl **ctrls, int notty, int ldif,
+	       tschema *schema)
+{
+	search_bases(s, ld, offsets, 0, &base, 1, cmdline, ctrls, notty,
+		     ldif, schema, 0);
 }
 
+/*
+ * Search as requested on the command line and write the results to S.
+ * Return the offsets of the entries.  If STAMPS is non-null, also add
+ * the entry_stamp() of each entry to it.
+ */
 GArray *
 search(FILE *s, LDAP *ld, cmdline *cmdline, LDAPControl **ctrls, int notty,
-       int ldif)
+       int ldif, GPtrArray *stamps)
 {
 	GArray *offsets = g_array_new(0, 0, sizeof(long));
 	GPtrArray *basedns = cmdline->basedns;
-	int i;
 	tschema *schema;
 
 	if (cmdline->schema_comments) {
@@ -232,17 +726,14 @@ search(FILE *s, LDAP *ld, cmdline *cmdline, LDAPControl **ctrls, int notty,
 	} else
 		schema = 0;
 
-	if (basedns->len == 0)
-		search_subtree(s, ld, offsets, 0, cmdline, ctrls, notty, ldif,
-			       schema);
-	else
-		for (i = 0; i < basedns->len; i++) {
-			char *base = g_ptr_array_index(basedns, i);
-			if (!cmdline->quiet && (basedns->len > 1))
-				fprintf(stderr, "Searching in: %s\n", base);
-			search_subtree(s, ld, offsets, base, cmdline, ctrls,
-				       notty, ldif, schema);
-		}
+	if (basedns->len == 0) {
+		char *base = 0;
+		search_bases(s, ld, offsets, stamps, &base, 1, cmdline, ctrls,
+			     notty, ldif, schema, 0);
+	} else
+		search_bases(s, ld, offsets, stamps,
+			     (char **) basedns->pdata, basedns->len,
+			     cmdline, ctrls, notty, ldif, schema, 0);
 
 	if (!offsets->len) {
 		if (!cmdline->noninteractive) {
@@ -259,6 +750,154 @@ search(FILE *s, LDAP *ld, cmdline *cmdline, LDAPControl **ctrls, int notty,
 	return offsets;
 }
 
+/*
+ * Like search(), but retrieve only the window of W->size entries starting
+ * at position W->target (counting from 1) of the sorted results, using
+ * the virtual list view control (draft-ietf-ldapext-ldapv3-vlv).  The
+ * control requires server side sorting, and only the first search base
+ * is used.
+ *
+ * W is updated from the server's response: W->target is the actual
+ * position of the first entry, W->count the server's estimate of the
+ * number of entries in the whole list.  Returns the offsets, which are
+ * empty if the window lies beyond the end of the list.  STAMPS is as for
+ * search().
+ */
+GArray *
+search_window(FILE *s, LDAP *ld, cmdline *cmdline, LDAPControl **ctrls,
+	      twindow *w, GPtrArray *stamps)
+{
+	GArray *offsets = g_array_new(0, 0, sizeof(long));
+	GPtrArray *basedns = cmdline->basedns;
+	char *base = basedns->len ? g_ptr_array_index(basedns, 0) : 0;
+	LDAPVLVInfo vlv;
+	LDAPControl *ctrl;
+	LDAPControl **wctrls;
+	tschema *schema;
+
+	if (cmdline->schema_comments) {
+		schema = schema_new(ld);
+		if (!schema) {
+			fputs("Error: Failed to read schema, giving up.",
+			      stderr);
+			exit(1);
+		}
+	} else
+		schema = 0;
+
+	vlv.ldvlv_version = 1;
+	vlv.ldvlv_before_count = 0;
+	vlv.ldvlv_after_count = w->size - 1;
+	vlv.ldvlv_offset = w->target;
+	vlv.ldvlv_count = w->count;
+	vlv.ldvlv_attrvalue = 0;
+	vlv.ldvlv_context = w->context;
+	vlv.ldvlv_extradata = 0;
+	if (ldap_create_vlv_control(ld, &vlv, &ctrl))
+		ldaperr(ld, "ldap_create_vlv_control");
+	wctrls = extend_controls(ctrls, ctrl);
+
+	search_bases(s, ld, offsets, stamps, &base, 1, cmdline, wctrls, 0,
+		     cmdline->ldif, schema, w);
+
+	free_extended_controls(wctrls);
+	if (schema)
+		schema_free(schema);
+	return offsets;
+}
+
+/*
+ * Find the entries that have changed on the server since STAMPS were
+ * recorded by search(), using a filter on entryCSN and modifyTimestamp,
+ * so that only changed entries are sent.
+ *
+ * Returns a table mapping the lower-cased DN of every entry found to its
+ * current stamp, or NULL if no stamps have been recorded or the search
+ * has failed.
+ */
+GHashTable *
+search_changes(LDAP *ld, cmdline *cmdline, LDAPControl **ctrls,
+	       GPtrArray *stamps)
+{
+	static char *ads[] = {"entryCSN", "modifyTimestamp", 0};
+	char *newest[2] = {0, 0};
+	GPtrArray *basedns = cmdline->basedns;
+	char *filter = cmdline->filter ? cmdline->filter : "(objectclass=*)";
+	GHashTable *result;
+	GString *f;
+	int i, j;
+
+	for (i = 0; i < stamps->len; i++) {
+		char *stamp = g_ptr_array_index(stamps, i);
+		if (!stamp)
+			continue;
+		for (j = 0; ads[j]; j++) {
+			int n = strlen(ads[j]);
+			if (!strncmp(stamp, ads[j], n) && stamp[n] == '=') {
+				/* both syntaxes sort as strings */
+				char *value = stamp + n + 1;
+				if (!newest[j] || strcmp(value, newest[j]) > 0)
+					newest[j] = value;
+				break;
+			}
+		}
+	}
+	if (!newest[0] && !newest[1])
+		return 0;
+
+	f = g_string_new("(&");
+	if (*filter == '(')
+		g_string_append(f, filter);
+	else
+		g_string_append_printf(f, "(%s)", filter);
+	g_string_append(f, "(|");
+	for (j = 0; ads[j]; j++)
+		if (newest[j])
+			g_string_append_printf(
+				f, "(%s>=%s)", ads[j], newest[j]);
+	g_string_append(f, "))");
+
+	result = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+	for (i = 0; i < (basedns->len ? basedns->len : 1); i++) {
+		char *base = basedns->len ? g_ptr_array_index(basedns, i) : 0;
+		LDAPMessage *msg;
+		int msgid;
+		int type;
+		int err;
+
+		if (ldap_search_ext(ld, base, cmdline->scope, f->str, ads, 0,
+				    ctrls, 0, 0, 0, &msgid))
+			ldaperr(ld, "ldap_search");
+		while ( (type = ldap_result(ld, msgid, LDAP_MSG_ONE, 0, &msg))
+			!= LDAP_RES_SEARCH_RESULT)
+		{
+			if (type == -1 || type == 0)
+				ldaperr(ld, "ldap_result");
+			if (type == LDAP_RES_SEARCH_ENTRY) {
+				LDAPMessage *entry = ldap_first_entry(ld, msg);
+				char *dn = ldap_get_dn(ld, entry);
+				g_hash_table_replace(
+					result,
+					g_ascii_strdown(dn, -1),
+					entry_stamp(ld, entry));
+				ldap_memfree(dn);
+			}
+			ldap_msgfree(msg);
+		}
+		if (ldap_parse_result(ld, msg, &err, 0, 0, 0, 0, 1))
+			ldaperr(ld, "ldap_parse_result");
+		if (err) {
+			fprintf(stderr, "Search failed: %s\n",
+				ldap_err2string(err));
+			g_hash_table_destroy(result);
+			result = 0;
+			break;
+		}
+	}
+	g_string_free(f, 1);
+	return result;
+}
+
 LDAPMessage *
 get_entry(LDAP *ld, char *dn, LDAPMessage **result)
 {
@@ -0,0 +1,267 @@
+/* -*- show-trailing-whitespace: t; indent-tabs: t -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#define _GNU_SOURCE
+#include <time.h>
+#include "common.h"
+
+/*
+ * Counters and timers for --stats.
+ *
+ * Everything is a no-op until stats_enable() has been called: stats_now()
+ * returns 0 then, and stats_time() ignores a start time of 0, so that
+ * instrumented code costs one test of a global variable per call.
+ *
+ * Durations are kept in a histogram per timer rather than as samples,
+ * so that memory use does not grow with the number of entries.  Values
+ * below 8ns get a bucket each; above that, every power of two is split
+ * into 8 buckets, which bounds the error of a percentile at 12.5%.
+ */
+#define STATS_SUB 8
+#define STATS_BUCKETS (64 * STATS_SUB)
+
+typedef struct stats_timer {
+	guint64 count;
+	guint64 total;		/* ns */
+	guint64 max;		/* ns */
+	guint64 buckets[STATS_BUCKETS];
+} stats_timer;
+
+static char *timer_names[STAT_NTIMERS] = {
+	"search",
+	"ldap_result",
+	"render",
+	"parse",
+	"compare_entries",
+	"ldap_add",
+	"ldap_modify",
+	"ldap_delete",
+	"ldap_rename"
+};
+
+int stats_enabled = 0;
+static int stats_json;
+static stats_timer timers[STAT_NTIMERS];
+static guint64 counters[STAT_NCOUNTERS];
+static GMutex stats_lock;	/* render threads record, too */
+
+/*
+ * Start collecting statistics, discarding any collected before.  With
+ * JSON, stats_report prints JSON instead of a table.
+ */
+void
+stats_enable(int json)
+{
+	memset(timers, 0, sizeof(timers));
+	memset(counters, 0, sizeof(counters));
+	stats_json = json;
+	stats_enabled = 1;
+}
+
+/* The current time in nanoseconds, or 0 if statistics are disabled. */
+guint64
+stats_now(void)
+{
+	struct timespec ts;
+
+	if (!stats_enabled)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec + 1;
+}
+
+static int
+bucket_of(guint64 ns)
+{
+	int e;
+
+	if (ns < STATS_SUB)
+		return ns;
+	for (e = 3; e < 63 && ns >> (e + 1); e++)
+		;
+	return (e - 2) * STATS_SUB + ((ns >> (e - 3)) & (STATS_SUB - 1));
+}
+
+static guint64
+bucket_start(int i)
+{
+	if (i < STATS_SUB)
+		return i;
+	return (guint64) (STATS_SUB + i % STATS_SUB) << (i / STATS_SUB - 1);
+}
+
+void
+stats_record(enum stat_timer t, guint64 ns)
+{
+	stats_timer *timer = &timers[t];
+
+	g_mutex_lock(&stats_lock);
+	timer->count++;
+	timer->total += ns;
+	if (ns > timer->max)
+		timer->max = ns;
+	timer->buckets[bucket_of(ns)]++;
+	g_mutex_unlock(&stats_lock);
+}
+
+/* Record the time since START, as returned by stats_now(), for T. */
+void
+stats_time(enum stat_timer t, guint64 start)
+{
+	if (start)
+		stats_record(t, stats_now() - start);
+}
+
+void
+stats_add(enum stat_counter c, guint64 n)
+{
+	if (!stats_enabled)
+		return;
+	g_mutex_lock(&stats_lock);
+	counters[c] += n;
+	g_mutex_unlock(&stats_lock);
+}
+
+/*
+ * The duration that fraction Q of the recordings for T did not exceed,
+ * to the precision of the histogram, in ns.
+ */
+guint64
+stats_percentile(enum stat_timer t, double q)
+{
+	stats_timer *timer = &timers[t];
+	guint64 rank = q * timer->count;
+	guint64 seen = 0;
+	int i;
+
+	if (!timer->count)
+		return 0;
+	if (rank >= timer->count)
+		return timer->max;
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		seen += timer->buckets[i];
+		if (seen > rank)
+			break;
+	}
+	return MIN(bucket_start(i), timer->max);
+}
+
+static double
+rate(guint64 n, guint64 ns)
+{
+	return ns ? n / (ns / 1e9) : 0.0;
+}
+
+static double
+ratio(guint64 a, guint64 b)
+{
+	return a + b ? (double) a / (a + b) : 0.0;
+}
+
+static void
+report_text(FILE *s)
+{
+	guint64 entries = counters[STAT_ENTRIES];
+	guint64 hits = counters[STAT_FASTCMP_HITS];
+	guint64 misses = counters[STAT_FASTCMP_MISSES];
+	guint64 search = timers[STAT_SEARCH].total;
+	int i;
+
+	fputs("Statistics:\n", s);
+	fprintf(s, "  entries read:   %llu in %.3f s (%.1f entries/s)\n",
+		(unsigned long long) entries, search / 1e9,
+		rate(entries, search));
+	fprintf(s, "  bytes written:  %llu\n",
+		(unsigned long long) counters[STAT_BYTES]);
+	fprintf(s, "  fastcmp:        %llu hits, %llu misses (%.1f%% hits)\n",
+		(unsigned long long) hits, (unsigned long long) misses,
+		100 * ratio(hits, misses));
+	fprintf(s, "  %-16s %9s %11s %9s %9s %9s %9s\n",
+		"timer", "count", "total ms",
+		"p50 us", "p90 us", "p99 us", "max us");
+	for (i = 0; i < STAT_NTIMERS; i++) {
+		stats_timer *timer = &timers[i];
+		if (!timer->count)
+			continue;
+		fprintf(s, "  %-16s %9llu %11.3f %9.1f %9.1f %9.1f %9.1f\n",
+			timer_names[i],
+			(unsigned long long) timer->count,
+			timer->total / 1e6,
+			stats_percentile(i, 0.5) / 1e3,
+			stats_percentile(i, 0.9) / 1e3,
+			stats_percentile(i, 0.99) / 1e3,
+			timer->max / 1e3);
+	}
+}
+
+static void
+report_json(FILE *s)
+{
+	guint64 entries = counters[STAT_ENTRIES];
+	guint64 hits = counters[STAT_FASTCMP_HITS];
+	guint64 misses = counters[STAT_FASTCMP_MISSES];
+	guint64 search = timers[STAT_SEARCH].total;
+	int first = 1;
+	int i;
+
+	fprintf(s, "{\"entries\": %llu, \"search_seconds\": %.6f,"
+		" \"entries_per_second\": %.1f, \"bytes_written\": %llu,"
+		" \"fastcmp\": {\"hits\": %llu, \"misses\": %llu,"
+		" \"hit_ratio\": %.4f}, \"timers\": {",
+		(unsigned long long) entries, search / 1e9,
+		rate(entries, search),
+		(unsigned long long) counters[STAT_BYTES],
+		(unsigned long long) hits, (unsigned long long) misses,
+		ratio(hits, misses));
+	for (i = 0; i < STAT_NTIMERS; i++) {
+		stats_timer *timer = &timers[i];
+		if (!timer->count)
+			continue;
+		fprintf(s, "%s\"%s\": {\"count\": %llu, \"total_ns\": %llu,"
+			" \"p50_ns\": %llu, \"p90_ns\": %llu,"
+			" \"p99_ns\": %llu, \"max_ns\": %llu}",
+			first ? "" : ", ",
+			timer_names[i],
+			(unsigned long long) timer->count,
+			(unsigned long long) timer->total,
+			(unsigned long long) stats_percentile(i, 0.5),
+			(unsigned long long) stats_percentile(i, 0.9),
+			(unsigned long long) stats_percentile(i, 0.99),
+			(unsigned long long) timer->max);
+		first = 0;
+	}
+	fputs("}}\n", s);
+}
+
+/* Print what has been collected to S. */
+void
+stats_print(FILE *s)
+{
+	g_mutex_lock(&stats_lock);
+	if (stats_json)
+		report_json(s);
+	else
+		report_text(s);
+	g_mutex_unlock(&stats_lock);
+}
+
+/* For atexit: print to stderr, which stays free of search results. */
+void
+stats_report(void)
+{
+	if (stats_enabled)
+		stats_print(stderr);
+}
@@ -304,6 +304,48 @@ static int test_cli_base_overrides_default_profile(void)
 }
 
 
+/*
+ * Test 10: --index with --out --ldapvi is kept.
+ */
+static int test_index_with_out_ldapvi(void)
+{
+	cmdline result;
+	GPtrArray *ctrls = g_ptr_array_new();
+	const char *argv[] = {"ldapvi", "--out", "--ldapvi",
+			      "--index", "dump.idx", NULL};
+
+	setup_no_profile();
+	run_parse(argv, 5, &result, ctrls);
+
+	ASSERT_STREQ(result.index_file, "dump.idx");
+
+	g_ptr_array_free(ctrls, 1);
+	teardown();
+	return 1;
+}
+
+
+/*
+ * Test 11: --index outside of --out is ignored (with a warning).
+ */
+static int test_index_ignored_when_editing(void)
+{
+	cmdline result;
+	GPtrArray *ctrls = g_ptr_array_new();
+	const char *argv[] = {"ldapvi", "--ldapvi", "--index", "dump.idx",
+			      NULL};
+
+	setup_no_profile();
+	run_parse(argv, 4, &result, ctrls);
+
+	ASSERT_NULL(result.index_file);
+
+	g_ptr_array_free(ctrls, 1);
+	teardown();
+	return 1;
+}
+
+
 /*
  * run_arguments_tests
  */
@@ -325,4 +367,8 @@ void run_arguments_tests(void)
 	TEST(cli_base_overrides_multiple_profile_bases);
 	TEST(multiple_cli_bases_override_profile);
 	TEST(cli_base_overrides_default_profile);
+
+	printf("\nGroup 4: --index\n");
+	TEST(index_with_out_ldapvi);
+	TEST(index_ignored_when_editing);
 }
@@ -111,6 +111,53 @@ static int test_attribute_cmp_different(void)
 	return 1;
 }
 
+static int test_attribute_cmp_ignores_case(void)
+{
+	tattribute *a = attribute_new(xdup("telephoneNumber;lang-de"));
+	tattribute *b = attribute_new(xdup("TELEPHONENUMBER;Lang-DE"));
+	tattribute *c = attribute_new(xdup("telephoneNumber"));
+	ASSERT_INT_EQ(attribute_cmp(a, b), 0);
+	ASSERT(attribute_cmp(a, c) != 0);
+	ASSERT_INT_EQ(ad_intern("TelephoneNumber"), c->a.id);
+	attribute_free(a);
+	attribute_free(b);
+	attribute_free(c);
+	return 1;
+}
+
+static int test_attribute_cmp_keeps_aliases_apart(void)
+{
+	tattribute *a = attribute_new(xdup("sn;x-a"));
+	tattribute *b = attribute_new(xdup("SN;X-A"));
+	tattribute *c = attribute_new(xdup("surname;x-a"));
+
+	ASSERT_INT_EQ(attribute_cmp(a, b), 0);
+	/* the schema's other names are not merged */
+	ASSERT(attribute_cmp(a, c) != 0);
+	ASSERT_INT_EQ(attribute_cmp(a, c), -attribute_cmp(c, a));
+	/* the attribute keeps the name it was created with */
+	ASSERT_STREQ(attribute_ad(b), "SN;X-A");
+	attribute_free(a);
+	attribute_free(b);
+	attribute_free(c);
+	return 1;
+}
+
+static int test_attribute_matchable(void)
+{
+	tattribute *a = attribute_new(xdup("JPEGPhoto;binary"));
+	tattribute *b = attribute_new(xdup("0.9.2342.19200300.100.1.55"));
+	tattribute *c = attribute_new(xdup("cn;lang-en"));
+
+	ASSERT(!attribute_matchable(a));
+	ASSERT(!attribute_matchable(b));
+	ASSERT(attribute_matchable(c));
+	attribute_free(a);
+	attribute_free(b);
+	attribute_free(c);
+	return 1;
+}
+
 
 /*
  * Group 4: entry_find_attribute
@@ -146,6 +193,46 @@ static int test_find_attribute_existing(void)
 	return 1;
 }
 
+static int test_find_attribute_wide_entry(void)
+{
+	tentry *e = make_entry("cn=test,dc=com");
+	char name[16];
+	int i;
+	for (i = 0; i < 100; i++) {
+		sprintf(name, "a%d", i);
+		entry_find_attribute(e, name, 1);
+	}
+	ASSERT_INT_EQ(entry_attributes(e)->len, 100);
+	ASSERT_STREQ(attribute_ad(entry_find_attribute(e, "a77", 0)), "a77");
+	ASSERT_NULL(entry_find_attribute(e, "b1", 0));
+	ASSERT_NOT_NULL(entry_find_attribute(e, "b1", 1));
+	ASSERT(entry_find_attribute(e, "b1", 1)
+	       == g_ptr_array_index(entry_attributes(e), 100));
+	ASSERT_INT_EQ(entry_attributes(e)->len, 101);
+	entry_free(e);
+	return 1;
+}
+
+static int test_find_attribute_ignores_case(void)
+{
+	tentry *e = make_entry("cn=test,dc=com");
+	tattribute *a = entry_find_attribute(e, "objectClass", 1);
+	char name[16];
+	int i;
+	ASSERT(entry_find_attribute(e, "OBJECTCLASS", 0) == a);
+	ASSERT(entry_find_attribute(e, "objectclass", 1) == a);
+	ASSERT_INT_EQ(entry_attributes(e)->len, 1);
+	/* same with an index */
+	for (i = 0; i < 20; i++) {
+		sprintf(name, "a%d", i);
+		entry_find_attribute(e, name, 1);
+	}
+	ASSERT(entry_find_attribute(e, "ObjectClass", 0) == a);
+	ASSERT(entry_find_attribute(e, "A7", 0)
+	       == entry_find_attribute(e, "a7", 0));
+	entry_free(e);
+	return 1;
+}
 
 /*
  * Group 5: attribute values
@@ -190,6 +277,67 @@ static int test_remove_value_not_found(void)
 	return 1;
 }
 
+static int test_find_value_many_values(void)
+{
+	tattribute *a = attribute_new(xdup("member"));
+	char value[16];
+	int i;
+	for (i = 0; i < 100; i++) {
+		sprintf(value, "v%d", i);
+		attribute_append_value(a, value, strlen(value));
+	}
+	ASSERT_INT_EQ(attribute_find_value(a, "v42", 3), 42);
+	ASSERT_INT_EQ(attribute_find_value(a, "v4", 2), 4);
+	ASSERT_INT_EQ(attribute_find_value(a, "v100", 4), -1);
+	attribute_append_value(a, "v100", 4);
+	ASSERT_INT_EQ(attribute_find_value(a, "v100", 4), 100);
+	/* the last value moves into the gap */
+	ASSERT_INT_EQ(attribute_remove_value(a, "v42", 3), 0);
+	ASSERT_INT_EQ(attribute_find_value(a, "v42", 3), -1);
+	ASSERT_INT_EQ(attribute_find_value(a, "v100", 4), 42);
+	ASSERT_INT_EQ(attribute_find_value(a, "v99", 3), 99);
+	attribute_free(a);
+	return 1;
+}
+static int test_values_recycled(void)
+{
+	tentry *e = make_entry("cn=test,dc=com");
+	tattribute *a = entry_find_attribute(e, "cn", 1);
+	GArray *v;
+	attribute_append_value(a, "a long value", 12);
+	entry_free(e);
+
+	/* storage freed above is reused, but must come back empty */
+	e = make_entry("cn=other,dc=com");
+	ASSERT_INT_EQ(entry_attributes(e)->len, 0);
+	a = entry_find_attribute(e, "sn", 1);
+	ASSERT_INT_EQ(attribute_values(a)->len, 0);
+	attribute_append_value(a, "x", 1);
+	v = g_ptr_array_index(attribute_values(a), 0);
+	ASSERT_INT_EQ(v->len, 1);
+	ASSERT(!memcmp(v->data, "x", 1));
+	ASSERT_STREQ(entry_dn(e), "cn=other,dc=com");
+	entry_free(e);
+	return 1;
+}
+static int test_recycled_value_terminated(void)
+{
+	tentry *e = make_entry("cn=test,dc=com");
+	tattribute *a = entry_find_attribute(e, "cn", 1);
+	GArray *v;
+	attribute_append_value(a, "a long value", 12);
+	entry_free(e);
+
+	/* the recycled value must not show the rest of "a long value" */
+	e = make_entry("cn=other,dc=com");
+	a = entry_find_attribute(e, "sn", 1);
+	attribute_append_value(a, "x", 1);
+	v = g_ptr_array_index(attribute_values(a), 0);
+	ASSERT_INT_EQ(v->len, 1);
+	ASSERT_STREQ(v->data, "x");
+	entry_free(e);
+	return 1;
+}
 
 /*
  * Group 6: named_array_ptr_cmp
@@ -273,13 +421,12 @@ static int test_attribute2mods(void)
 	ASSERT_NOT_NULL(m->mod_bvalues[1]);
 	ASSERT_INT_EQ((int) m->mod_bvalues[1]->bv_len, 7);
 	ASSERT_NULL(m->mod_bvalues[2]);
-	/* free mod */
-	free(m->mod_type);
-	xfree_berval(m->mod_bvalues[0]);
-	xfree_berval(m->mod_bvalues[1]);
-	free(m->mod_bvalues);
-	free(m);
+	/* the values do not depend on the attribute */
 	attribute_free(a);
+	ASSERT(memcmp(m->mod_bvalues[1]->bv_val, "c@d.com", 7) == 0);
+	ASSERT_INT_EQ(m->mod_bvalues[1]->bv_val[7], 0);
+	/* one block */
+	free(m);
 	return 1;
 }
 
@@ -296,11 +443,83 @@ static int test_entry2mods(void)
 	ASSERT_NULL(mods[2]);
 	ASSERT_STREQ(mods[0]->mod_type, "cn");
 	ASSERT_STREQ(mods[1]->mod_type, "sn");
-	ldap_mods_free(mods, 1);
+	mods_free(mods);
+	entry_free(e);
+	return 1;
+}
+
+static int test_copy_mods(void)
+{
+	LDAPMod **mods, **copy;
+	tentry *e = make_entry("cn=test,dc=com");
+	add_attr_value(e, "cn", "test");
+	add_attr_value(e, "sn", "value");
+	mods = entry2mods(e);
+	mods[1]->mod_op |= LDAP_MOD_REPLACE;
+	copy = copy_mods(mods);
+	ASSERT_NOT_NULL(copy[0]);
+	ASSERT_NOT_NULL(copy[1]);
+	ASSERT_NULL(copy[2]);
+	ASSERT_INT_EQ(copy[1]->mod_op, LDAP_MOD_BVALUES | LDAP_MOD_REPLACE);
+	ASSERT_STREQ(copy[1]->mod_type, "sn");
+	ASSERT(copy[1]->mod_type != mods[1]->mod_type);
+	ASSERT(copy[1]->mod_bvalues[0] != mods[1]->mod_bvalues[0]);
+	ASSERT_INT_EQ((int) copy[1]->mod_bvalues[0]->bv_len, 5);
+	ASSERT(memcmp(copy[1]->mod_bvalues[0]->bv_val, "value", 5) == 0);
+	ASSERT_NULL(copy[1]->mod_bvalues[1]);
+	mods_free(mods);
+	mods_free(copy);
 	entry_free(e);
 	return 1;
 }
 
+static int test_copy_mods_without_values(void)
+{
+	LDAPMod *m = xalloc(sizeof(LDAPMod));
+	LDAPMod *mods[2];
+	LDAPMod **copy;
+
+	m->mod_op = LDAP_MOD_DELETE | LDAP_MOD_BVALUES;
+	m->mod_type = "description";
+	m->mod_bvalues = 0;
+	mods[0] = m;
+	mods[1] = 0;
+	copy = copy_mods(mods);
+	ASSERT_INT_EQ(copy[0]->mod_op, LDAP_MOD_DELETE | LDAP_MOD_BVALUES);
+	ASSERT_STREQ(copy[0]->mod_type, "description");
+	ASSERT_NULL(copy[0]->mod_bvalues);
+	ASSERT_NULL(copy[1]);
+	mods_free(copy);
+	free(m);
+	return 1;
+}
+
+static int test_values2mod(void)
+{
+	GPtrArray *values = g_ptr_array_new();
+	GArray *v1 = g_array_new(0, 0, 1);
+	GArray *v2 = g_array_new(0, 0, 1);
+	LDAPMod *m;
+
+	g_array_append_vals(v1, "x", 1);
+	g_array_append_vals(v2, "\0yz", 3);
+	g_ptr_array_add(values, v1);
+	g_ptr_array_add(values, v2);
+	m = values2mod(LDAP_MOD_ADD, "seeAlso", values);
+	ASSERT_INT_EQ(m->mod_op, LDAP_MOD_ADD | LDAP_MOD_BVALUES);
+	ASSERT_STREQ(m->mod_type, "seeAlso");
+	ASSERT_INT_EQ((int) m->mod_bvalues[1]->bv_len, 3);
+	ASSERT(memcmp(m->mod_bvalues[1]->bv_val, "\0yz", 3) == 0);
+	ASSERT(m->mod_bvalues[1]->bv_val
+	       == m->mod_bvalues[0]->bv_val + 2);
+	ASSERT_NULL(m->mod_bvalues[2]);
+	free(m);
+	g_array_free(v1, 1);
+	g_array_free(v2, 1);
+	g_ptr_array_free(values, 1);
+	return 1;
+}
+
 
 /*
  * run_data_tests
@@ -322,17 +541,25 @@ void run_data_tests(void)
 	TEST(attribute_new_sets_ad);
 	TEST(attribute_cmp_equal);
 	TEST(attribute_cmp_different);
+	TEST(attribute_cmp_ignores_case);
+	TEST(attribute_cmp_keeps_aliases_apart);
+	TEST(attribute_matchable);
 
 	printf("\nGroup 4: entry_find_attribute\n");
 	TEST(find_attribute_creates);
 	TEST(find_attribute_no_create);
 	TEST(find_attribute_existing);
+	TEST(find_attribute_wide_entry);
+	TEST(find_attribute_ignores_case);
 
 	printf("\nGroup 5: attribute values\n");
 	TEST(append_and_find_value);
 	TEST(find_value_not_found);
 	TEST(remove_value_success);
 	TEST(remove_value_not_found);
+	TEST(find_value_many_values);
+	TEST(values_recycled);
+	TEST(recycled_value_terminated);
 
 	printf("\nGroup 6: named_array_ptr_cmp\n");
 	TEST(named_array_ptr_cmp_sorts);
@@ -345,4 +572,7 @@ void run_data_tests(void)
 	printf("\nGroup 8: attribute2mods and entry2mods\n");
 	TEST(attribute2mods);
 	TEST(entry2mods);
+	TEST(copy_mods);
+	TEST(copy_mods_without_values);
+	TEST(values2mod);
 }
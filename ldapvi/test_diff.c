@@ -2,6 +2,7 @@
  * Tests for diff.c - the stream comparison engine.
  */
 #define _GNU_SOURCE
+#include <sys/resource.h>
 #include "common.h"
 #include "config.h"
 #include "test_harness.h"
@@ -9,6 +10,8 @@
 /* Forward declarations for diff.c functions */
 void long_array_invert(GArray *array, int i);
 int fastcmp(FILE *s, FILE *t, long p, long q, long n);
+int mapcmp(tmapping *ms, tmapping *mt, FILE *s, FILE *t,
+	   long p, long q, long n);
 int frob_ava(tentry *entry, int mode, char *ad, char *data, int n);
 int frob_rdn(tentry *entry, char *dn, int mode);
 int validate_rename(tentry *clean, tentry *data, int *deleteoldrdn);
@@ -17,6 +20,7 @@ int process_immediate(tparser *p, thandler *handler, void *userdata,
 int compare_streams(tparser *p, thandler *handler, void *userdata,
 		    GArray *offsets, FILE *clean, FILE *data,
 		    long *error_position, long *syntax_error_position);
+char *dump_key(char *dn);
 
 
 /*
@@ -94,6 +98,7 @@ typedef struct {
 	char *dn2;       /* new dn for change/rename0 */
 	int deleteoldrdn; /* for rename0 */
 	int num_mods;
+	int mod_ops[8];  /* mod_op without LDAP_MOD_BVALUES, for change */
 } mock_call;
 
 typedef struct {
@@ -121,7 +126,10 @@ mock_change(int n, char *olddn, char *newdn, LDAPMod **mods, void *userdata)
 	c->dn = xdup(olddn);
 	c->dn2 = xdup(newdn);
 	c->num_mods = 0;
-	if (mods) for (int i = 0; mods[i]; i++) c->num_mods++;
+	if (mods) for (int i = 0; mods[i]; i++) {
+		if (i < 8) c->mod_ops[i] = mods[i]->mod_op & ~LDAP_MOD_BVALUES;
+		c->num_mods++;
+	}
 	if (m->num_calls == m->fail_on_call) { m->num_calls++; return -1; }
 	m->num_calls++;
 	return 0;
@@ -304,6 +312,56 @@ static int test_fastcmp_restores_position(void)
 	return 1;
 }
 
+static int test_mapcmp_mapped(void)
+{
+	FILE *s = make_tmpfile("XXXXXhello world");
+	FILE *t = make_tmpfile("YYhello earth");
+	tmapping ms, mt;
+	map_stream(s, &ms);
+	map_stream(t, &mt);
+	ASSERT_NOT_NULL(ms.base);
+	ASSERT_NOT_NULL(mt.base);
+	ASSERT_INT_EQ(mapcmp(&ms, &mt, s, t, 5, 2, 6), 0);
+	ASSERT_INT_EQ(mapcmp(&ms, &mt, s, t, 5, 2, 11), 1);
+	unmap_stream(&ms);
+	unmap_stream(&mt);
+	ASSERT_NULL(ms.base);
+	fclose(s);
+	fclose(t);
+	return 1;
+}
+
+static int test_mapcmp_beyond_mapping(void)
+{
+	FILE *s = make_tmpfile("hello");
+	FILE *t = make_tmpfile("hello world");
+	tmapping ms, mt;
+	map_stream(s, &ms);
+	map_stream(t, &mt);
+	/* appended after mapping: must be read through the stream */
+	fseek(s, 0, SEEK_END);
+	fputs(" world", s);
+	fflush(s);
+	ASSERT_INT_EQ(mapcmp(&ms, &mt, s, t, 0, 0, 11), 0);
+	unmap_stream(&ms);
+	unmap_stream(&mt);
+	fclose(s);
+	fclose(t);
+	return 1;
+}
+
+static int test_map_stream_empty(void)
+{
+	FILE *s = make_tmpfile("");
+	tmapping ms;
+	map_stream(s, &ms);
+	ASSERT_NULL(ms.base);
+	ASSERT_INT_EQ(ms.size, 0);
+	unmap_stream(&ms);
+	fclose(s);
+	return 1;
+}
+
 
 /* ===================================================================
  * Tests for frob_ava
@@ -615,6 +673,226 @@ static int test_compare_streams_modify_attr(void)
 	return 1;
 }
 
+static int test_compare_streams_cached_change(void)
+{
+	const char *clean_ldif =
+		"\ndn: cn=foo,dc=example,dc=com\n"
+		"ldapvi-key: 0\n"
+		"cn: foo\n"
+		"sn: old\n"
+		"\n";
+
+	const char *data_ldif =
+		"\ndn: cn=foo,dc=example,dc=com\n"
+		"ldapvi-key: 0\n"
+		"cn: foo\n"
+		"sn: new\n"
+		"\n";
+
+	GArray *offsets;
+	FILE *clean = make_clean_file(clean_ldif, &offsets);
+	FILE *data = make_tmpfile(data_ldif);
+
+	mock_state m;
+	long errpos = 0, synpos = 0;
+	int rc;
+	int i;
+
+	/* the second run replays the cached comparison */
+	for (i = 0; i < 2; i++) {
+		mock_init(&m);
+		rewind(data);
+		rc = compare_streams(&ldif_parser, &mock_handler, &m,
+				     offsets, clean, data, &errpos, &synpos);
+		ASSERT_INT_EQ(rc, 0);
+		ASSERT_INT_EQ(m.num_calls, 1);
+		ASSERT_INT_EQ(m.calls[0].type, CALL_CHANGE);
+		ASSERT_STREQ(m.calls[0].dn2, "cn=foo,dc=example,dc=com");
+		ASSERT_INT_EQ(m.calls[0].num_mods, 1);
+		mock_free(&m);
+	}
+
+	/* same length, different bytes: must not hit the cache */
+	fseek(data, strlen(data_ldif) - strlen("foo\nsn: new\n\n"), SEEK_SET);
+	fputs("fox", data);
+	fflush(data);
+	mock_init(&m);
+	rewind(data);
+	rc = compare_streams(&ldif_parser, &mock_handler, &m,
+			     offsets, clean, data, &errpos, &synpos);
+	ASSERT_INT_EQ(rc, 0);
+	ASSERT_INT_EQ(m.num_calls, 1);
+	ASSERT_INT_EQ(m.calls[0].num_mods, 2);
+
+	mock_free(&m);
+	fclose(clean);
+	fclose(data);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+static int
+compare_member_values(const char *old_values, const char *new_values,
+		      mock_state *m)
+{
+	GString *clean_ldif = g_string_new(
+		"\ndn: cn=g,dc=example,dc=com\nldapvi-key: 0\ncn: g\n");
+	GString *data_ldif = g_string_new(
+		"\ndn: cn=g,dc=example,dc=com\nldapvi-key: 0\ncn: g\n");
+	const char *p;
+	GArray *offsets;
+	FILE *clean, *data;
+	long errpos = 0, synpos = 0;
+	int rc;
+
+	for (p = old_values; *p; p++)
+		g_string_append_printf(clean_ldif, "member: %c\n", *p);
+	for (p = new_values; *p; p++)
+		g_string_append_printf(data_ldif, "member: %c\n", *p);
+	g_string_append(clean_ldif, "\n");
+	g_string_append(data_ldif, "\n");
+
+	clean = make_clean_file(clean_ldif->str, &offsets);
+	data = make_tmpfile(data_ldif->str);
+	mock_init(m);
+	rc = compare_streams(&ldif_parser, &mock_handler, m,
+			     offsets, clean, data, &errpos, &synpos);
+	fclose(clean);
+	fclose(data);
+	g_array_free(offsets, 1);
+	g_string_free(clean_ldif, 1);
+	g_string_free(data_ldif, 1);
+	return rc;
+}
+
+static int test_compare_streams_delete_one_value(void)
+{
+	mock_state m;
+	ASSERT_INT_EQ(compare_member_values("abcdef", "abdef", &m), 0);
+	ASSERT_INT_EQ(m.num_calls, 1);
+	ASSERT_INT_EQ(m.calls[0].num_mods, 1);
+	ASSERT_INT_EQ(m.calls[0].mod_ops[0], LDAP_MOD_DELETE);
+	mock_free(&m);
+	return 1;
+}
+
+static int test_compare_streams_add_and_delete_values(void)
+{
+	mock_state m;
+	ASSERT_INT_EQ(compare_member_values("abcdef", "acdefxy", &m), 0);
+	ASSERT_INT_EQ(m.num_calls, 1);
+	ASSERT_INT_EQ(m.calls[0].num_mods, 2);
+	ASSERT_INT_EQ(m.calls[0].mod_ops[0], LDAP_MOD_DELETE);
+	ASSERT_INT_EQ(m.calls[0].mod_ops[1], LDAP_MOD_ADD);
+	mock_free(&m);
+	return 1;
+}
+
+static int test_compare_streams_reordered_values(void)
+{
+	/* the new order can only be expressed by replacing the values */
+	mock_state m;
+	ASSERT_INT_EQ(compare_member_values("abcdef", "abcdfe", &m), 0);
+	ASSERT_INT_EQ(m.num_calls, 1);
+	ASSERT_INT_EQ(m.calls[0].num_mods, 1);
+	ASSERT_INT_EQ(m.calls[0].mod_ops[0], LDAP_MOD_REPLACE);
+	mock_free(&m);
+	return 1;
+}
+
+static int test_compare_streams_replace_when_shorter(void)
+{
+	mock_state m;
+	ASSERT_INT_EQ(compare_member_values("a", "b", &m), 0);
+	ASSERT_INT_EQ(m.num_calls, 1);
+	ASSERT_INT_EQ(m.calls[0].num_mods, 1);
+	ASSERT_INT_EQ(m.calls[0].mod_ops[0], LDAP_MOD_REPLACE);
+	mock_free(&m);
+	return 1;
+}
+
+static int
+compare_ldif(const char *clean_ldif, const char *data_ldif, mock_state *m)
+{
+	GArray *offsets;
+	FILE *clean = make_clean_file(clean_ldif, &offsets);
+	FILE *data = make_tmpfile(data_ldif);
+	long errpos = 0, synpos = 0;
+	int rc;
+
+	mock_init(m);
+	rc = compare_streams(&ldif_parser, &mock_handler, m,
+			     offsets, clean, data, &errpos, &synpos);
+	fclose(clean);
+	fclose(data);
+	g_array_free(offsets, 1);
+	return rc;
+}
+
+static int test_compare_streams_replace_binary_values(void)
+{
+	/* JPEG headers are not UTF-8: no matching rule to delete them by */
+	mock_state m;
+	ASSERT_INT_EQ(compare_ldif(
+		"\ndn: cn=g,dc=example,dc=com\nldapvi-key: 0\ncn: g\n"
+		"jpegPhoto:: /9j/4A==\njpegPhoto:: /9j/4Q==\n"
+		"jpegPhoto:: /9j/4g==\n\n",
+		"\ndn: cn=g,dc=example,dc=com\nldapvi-key: 0\ncn: g\n"
+		"jpegPhoto:: /9j/4A==\njpegPhoto:: /9j/4g==\n\n",
+		&m), 0);
+	ASSERT_INT_EQ(m.num_calls, 1);
+	ASSERT_INT_EQ(m.calls[0].num_mods, 1);
+	ASSERT_INT_EQ(m.calls[0].mod_ops[0], LDAP_MOD_REPLACE);
+	mock_free(&m);
+	return 1;
+}
+
+static int test_compare_streams_replace_unmatchable(void)
+{
+	/* audio has no EQUALITY rule, whether or not the values are text */
+	mock_state m;
+	ASSERT_INT_EQ(compare_ldif(
+		"\ndn: cn=g,dc=example,dc=com\nldapvi-key: 0\ncn: g\n"
+		"Audio;lang-en: a\nAudio;lang-en: b\nAudio;lang-en: c\n\n",
+		"\ndn: cn=g,dc=example,dc=com\nldapvi-key: 0\ncn: g\n"
+		"Audio;lang-en: a\nAudio;lang-en: c\n\n",
+		&m), 0);
+	ASSERT_INT_EQ(m.num_calls, 1);
+	ASSERT_INT_EQ(m.calls[0].num_mods, 1);
+	ASSERT_INT_EQ(m.calls[0].mod_ops[0], LDAP_MOD_REPLACE);
+	mock_free(&m);
+	return 1;
+}
+
+static int test_compare_streams_attribute_case_change(void)
+{
+	/* attribute descriptions are case-insensitive */
+	const char *clean_ldif =
+		"\ndn: cn=g,dc=example,dc=com\nldapvi-key: 0\n"
+		"cn: g\nmember: a\n\n";
+	const char *data_ldif =
+		"\ndn: cn=g,dc=example,dc=com\nldapvi-key: 0\n"
+		"CN: g\nMember: a\n\n";
+	mock_state m;
+	GArray *offsets;
+	FILE *clean = make_clean_file(clean_ldif, &offsets);
+	FILE *data = make_tmpfile(data_ldif);
+	long errpos = 0, synpos = 0;
+	int rc;
+
+	mock_init(&m);
+	rc = compare_streams(&ldif_parser, &mock_handler, &m,
+			     offsets, clean, data, &errpos, &synpos);
+	ASSERT_INT_EQ(rc, 0);
+	ASSERT_INT_EQ(m.num_calls, 0);
+
+	mock_free(&m);
+	fclose(clean);
+	fclose(data);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
 static int test_compare_streams_add_attr(void)
 {
 	const char *clean_ldif =
@@ -768,6 +1046,52 @@ static int test_compare_streams_delete_one_of_two(void)
 	return 1;
 }
 
+static int test_compare_streams_delete_children_first(void)
+{
+	const char *clean_ldif =
+		"\ndn: ou=a,dc=example,dc=com\n"
+		"ldapvi-key: 0\n"
+		"ou: a\n"
+		"\n"
+		"\ndn: cn=x,ou=b,ou=a,dc=example,dc=com\n"
+		"ldapvi-key: 1\n"
+		"cn: x\n"
+		"\n"
+		"\ndn: ou=b,ou=a,dc=example,dc=com\n"
+		"ldapvi-key: 2\n"
+		"ou: b\n"
+		"\n"
+		"\ndn: cn=y,ou=a,dc=example,dc=com\n"
+		"ldapvi-key: 3\n"
+		"cn: y\n"
+		"\n";
+
+	GArray *offsets;
+	FILE *clean = make_clean_file(clean_ldif, &offsets);
+	FILE *data = make_tmpfile("");
+
+	mock_state m;
+	mock_init(&m);
+	long errpos = 0, synpos = 0;
+
+	int rc = compare_streams(&ldif_parser, &mock_handler, &m,
+				 offsets, clean, data, &errpos, &synpos);
+	ASSERT_INT_EQ(rc, 0);
+	/* deepest first, in key order within the same depth */
+	ASSERT_INT_EQ(m.num_calls, 4);
+	ASSERT_INT_EQ(m.calls[0].n, 1);
+	ASSERT_INT_EQ(m.calls[1].n, 2);
+	ASSERT_INT_EQ(m.calls[2].n, 3);
+	ASSERT_INT_EQ(m.calls[3].n, 0);
+	ASSERT_STREQ(m.calls[3].dn, "ou=a,dc=example,dc=com");
+
+	mock_free(&m);
+	fclose(clean);
+	fclose(data);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
 static int test_compare_streams_add_new_entry(void)
 {
 	const char *clean_ldif =
@@ -1223,6 +1547,350 @@ static int test_compare_streams_duplicate_key(void)
 }
 
 
+/* ===================================================================
+ * index files
+ * =================================================================== */
+
+static const char *index_ldif =
+	"\n"
+	"dn: cn=a,dc=example,dc=com\n"
+	"ldapvi-key: 0\n"
+	"cn: a\n"
+	"\n"
+	"dn: cn=b,dc=example,dc=com\n"
+	"ldapvi-key: 1\n"
+	"cn: b\n";
+
+static char *
+make_index_name(void)
+{
+	char *name = xdup("/tmp/test_index_XXXXXX");
+	int fd = mkstemp(name);
+	if (fd == -1) { perror("mkstemp"); abort(); }
+	close(fd);
+	return name;
+}
+
+static int test_index_roundtrip(void)
+{
+	GArray *offsets;
+	GArray *result;
+	FILE *f = make_clean_file(index_ldif, &offsets);
+	char *name = make_index_name();
+
+	ASSERT_INT_EQ(index_write(name, f, offsets), 0);
+	result = index_read(name, f);
+	ASSERT_NOT_NULL(result);
+	ASSERT_INT_EQ(result->len, 2);
+	ASSERT_INT_EQ(g_array_index(result, long, 0),
+		      g_array_index(offsets, long, 0));
+	ASSERT_INT_EQ(g_array_index(result, long, 1),
+		      g_array_index(offsets, long, 1));
+
+	unlink(name);
+	free(name);
+	fclose(f);
+	g_array_free(offsets, 1);
+	g_array_free(result, 1);
+	return 1;
+}
+
+static int test_index_stale(void)
+{
+	GArray *offsets;
+	FILE *f = make_clean_file(index_ldif, &offsets);
+	char *name = make_index_name();
+
+	ASSERT_INT_EQ(index_write(name, f, offsets), 0);
+	fseek(f, 0, SEEK_END);
+	fputs("\n", f);
+	fflush(f);
+	ASSERT_NULL(index_read(name, f));
+
+	unlink(name);
+	free(name);
+	fclose(f);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+static int test_index_missing(void)
+{
+	FILE *f = make_tmpfile(index_ldif);
+
+	ASSERT_NULL(index_read("/nonexistent/ldapvi.idx", f));
+	fclose(f);
+	return 1;
+}
+
+static int test_index_garbage(void)
+{
+	GArray *offsets;
+	FILE *f = make_clean_file(index_ldif, &offsets);
+	char *name = make_index_name();
+	FILE *g = fopen(name, "w");
+
+	ASSERT_NOT_NULL(g);
+	fputs("this is not an index\n", g);
+	fclose(g);
+	ASSERT_NULL(index_read(name, f));
+
+	unlink(name);
+	free(name);
+	fclose(f);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+static int test_index_write_pipe(void)
+{
+	GArray *offsets = g_array_new(0, 0, sizeof(long));
+	int fds[2];
+	FILE *p;
+
+	ASSERT_INT_EQ(pipe(fds), 0);
+	p = fdopen(fds[1], "w");
+	ASSERT_INT_EQ(index_write("/nonexistent/ldapvi.idx", p, offsets), -1);
+	fclose(p);
+	close(fds[0]);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+
+/* ===================================================================
+ * compare_dumps
+ * =================================================================== */
+
+static const char *dump_a =
+	"dn: cn=x,ou=a,dc=com\n"
+	"cn: x\n"
+	"\n"
+	"dn: dc=com\n"
+	"dc: com\n"
+	"\n"
+	"dn: cn=same,dc=com\n"
+	"cn: same\n"
+	"\n"
+	"dn: ou=a,dc=com\n"
+	"ou: a\n"
+	"\n"
+	"dn: cn=mod,dc=com\n"
+	"cn: mod\n"
+	"sn: old\n";
+
+static const char *dump_b =
+	"dn: cn=Mod, dc=com\n"
+	"cn: mod\n"
+	"sn: new\n"
+	"\n"
+	"dn: cn=y,ou=b,dc=com\n"
+	"cn: y\n"
+	"\n"
+	"dn: CN=same,DC=com\n"
+	"cn: same\n"
+	"\n"
+	"dn: ou=b,dc=com\n"
+	"ou: b\n"
+	"\n"
+	"dn: dc=com\n"
+	"dc: com\n";
+
+static int test_dump_key(void)
+{
+	char *key = dump_key("cn=Foo, dc=Example,dc=com");
+	ASSERT_NOT_NULL(key);
+	ASSERT_STREQ(key, "dc=com\001dc=example\001cn=foo");
+	free(key);
+	key = dump_key("");
+	ASSERT_STREQ(key, "");
+	free(key);
+	ASSERT_NULL(dump_key("not a dn"));
+	return 1;
+}
+
+static int
+check_dump_changes(long limit)
+{
+	FILE *a = make_tmpfile(dump_a);
+	FILE *b = make_tmpfile(dump_b);
+	mock_state m;
+	int rc;
+
+	mock_init(&m);
+	rc = compare_dumps(&ldif_parser, &mock_handler, &m, a, b, limit);
+	ASSERT_INT_EQ(rc, 0);
+	ASSERT_INT_EQ(m.num_calls, 5);
+	/* in DN order, superiors added first, subordinates deleted first */
+	ASSERT_INT_EQ(m.calls[0].type, CALL_CHANGE);
+	ASSERT_STREQ(m.calls[0].dn, "cn=mod,dc=com");
+	ASSERT_INT_EQ(m.calls[1].type, CALL_DELETE);
+	ASSERT_STREQ(m.calls[1].dn, "cn=x,ou=a,dc=com");
+	ASSERT_INT_EQ(m.calls[2].type, CALL_DELETE);
+	ASSERT_STREQ(m.calls[2].dn, "ou=a,dc=com");
+	ASSERT_INT_EQ(m.calls[3].type, CALL_ADD);
+	ASSERT_STREQ(m.calls[3].dn, "ou=b,dc=com");
+	ASSERT_INT_EQ(m.calls[4].type, CALL_ADD);
+	ASSERT_STREQ(m.calls[4].dn, "cn=y,ou=b,dc=com");
+
+	mock_free(&m);
+	fclose(a);
+	fclose(b);
+	return 1;
+}
+
+static int test_compare_dumps_changes(void)
+{
+	return check_dump_changes(DUMP_SORT_LIMIT);
+}
+
+static int test_compare_dumps_runs(void)
+{
+	/* every entry in a run of its own */
+	return check_dump_changes(1);
+}
+
+static int test_compare_dumps_many_runs(void)
+{
+	GString *x = g_string_new("");
+	GString *y = g_string_new("dn: dc=com\ndc: com\n\n");
+	struct rlimit saved, rl;
+	FILE *a, *b;
+	mock_state m;
+	int i, rc;
+
+	/* 400 runs per dump, in reverse order */
+	for (i = 399; i >= 0; i--) {
+		g_string_append_printf(x, "dn: cn=e%03d,dc=com\ncn: e%03d\n\n",
+				       i, i);
+		if (i == 7)
+			continue;
+		g_string_append_printf(y, "dn: cn=e%03d,dc=com\ncn: e%03d\n%s\n",
+				       i, i, i == 150 ? "sn: new\n" : "");
+	}
+	g_string_append(x, "dn: dc=com\ndc: com\n");
+	a = make_tmpfile(x->str);
+	b = make_tmpfile(y->str);
+	g_string_free(x, 1);
+	g_string_free(y, 1);
+
+	/* far fewer descriptors than runs */
+	ASSERT_INT_EQ(getrlimit(RLIMIT_NOFILE, &saved), 0);
+	rl = saved;
+	rl.rlim_cur = 64;
+	ASSERT_INT_EQ(setrlimit(RLIMIT_NOFILE, &rl), 0);
+	mock_init(&m);
+	rc = compare_dumps(&ldif_parser, &mock_handler, &m, a, b, 1);
+	ASSERT_INT_EQ(setrlimit(RLIMIT_NOFILE, &saved), 0);
+
+	ASSERT_INT_EQ(rc, 0);
+	ASSERT_INT_EQ(m.num_calls, 2);
+	ASSERT_INT_EQ(m.calls[0].type, CALL_DELETE);
+	ASSERT_STREQ(m.calls[0].dn, "cn=e007,dc=com");
+	ASSERT_INT_EQ(m.calls[1].type, CALL_CHANGE);
+	ASSERT_STREQ(m.calls[1].dn, "cn=e150,dc=com");
+
+	mock_free(&m);
+	fclose(a);
+	fclose(b);
+	return 1;
+}
+
+static int test_compare_dumps_unchanged(void)
+{
+	FILE *a = make_tmpfile(dump_b);
+	FILE *b = make_tmpfile(
+		"dn: dc=com\n"
+		"dc: com\n"
+		"\n"
+		"dn: ou=b,dc=com\n"
+		"ou: b\n"
+		"\n"
+		"dn: cn=y,ou=b,dc=com\n"
+		"cn: y\n"
+		"\n"
+		"dn: cn=same,dc=com\n"
+		"cn: same\n"
+		"\n"
+		"dn: cn=mod,dc=com\n"
+		"cn: mod\n"
+		"sn: new\n");
+	mock_state m;
+
+	mock_init(&m);
+	ASSERT_INT_EQ(compare_dumps(&ldif_parser, &mock_handler, &m,
+				    a, b, 30),
+		      0);
+	ASSERT_INT_EQ(m.num_calls, 0);
+
+	mock_free(&m);
+	fclose(a);
+	fclose(b);
+	return 1;
+}
+
+static int test_compare_dumps_duplicate(void)
+{
+	FILE *a = make_tmpfile(dump_a);
+	FILE *b = make_tmpfile(
+		"dn: dc=com\n"
+		"dc: com\n"
+		"\n"
+		"dn: DC=com\n"
+		"dc: com\n");
+	mock_state m;
+
+	mock_init(&m);
+	ASSERT_INT_EQ(compare_dumps(&ldif_parser, &mock_handler, &m,
+				    a, b, 1),
+		      -1);
+
+	mock_free(&m);
+	fclose(a);
+	fclose(b);
+	return 1;
+}
+
+static int test_compare_dumps_changerecord(void)
+{
+	FILE *a = make_tmpfile(dump_a);
+	FILE *b = make_tmpfile(
+		"dn: dc=com\n"
+		"changetype: delete\n");
+	mock_state m;
+
+	mock_init(&m);
+	ASSERT_INT_EQ(compare_dumps(&ldif_parser, &mock_handler, &m,
+				    a, b, DUMP_SORT_LIMIT),
+		      -1);
+	ASSERT_INT_EQ(m.num_calls, 0);
+
+	mock_free(&m);
+	fclose(a);
+	fclose(b);
+	return 1;
+}
+
+static int test_compare_dumps_handler_fails(void)
+{
+	FILE *a = make_tmpfile(dump_a);
+	FILE *b = make_tmpfile(dump_b);
+	mock_state m;
+
+	mock_init(&m);
+	m.fail_on_call = 0;
+	ASSERT_INT_EQ(compare_dumps(&ldif_parser, &mock_handler, &m,
+				    a, b, DUMP_SORT_LIMIT),
+		      -2);
+	ASSERT_INT_EQ(m.num_calls, 1);
+
+	mock_free(&m);
+	fclose(a);
+	fclose(b);
+	return 1;
+}
+
+
 /* ===================================================================
  * run_diff_tests
  * =================================================================== */
@@ -1242,6 +1910,9 @@ void run_diff_tests(void)
 	TEST(fastcmp_short_read);
 	TEST(fastcmp_offset);
 	TEST(fastcmp_restores_position);
+	TEST(mapcmp_mapped);
+	TEST(mapcmp_beyond_mapping);
+	TEST(map_stream_empty);
 
 	printf("\nfrob_ava:\n");
 	TEST(frob_ava_check_found);
@@ -1269,10 +1940,19 @@ void run_diff_tests(void)
 	TEST(compare_streams_unchanged);
 	TEST(compare_streams_unchanged_multi);
 	TEST(compare_streams_modify_attr);
+	TEST(compare_streams_cached_change);
+	TEST(compare_streams_delete_one_value);
+	TEST(compare_streams_add_and_delete_values);
+	TEST(compare_streams_reordered_values);
+	TEST(compare_streams_replace_when_shorter);
+	TEST(compare_streams_replace_binary_values);
+	TEST(compare_streams_replace_unmatchable);
+	TEST(compare_streams_attribute_case_change);
 	TEST(compare_streams_add_attr);
 	TEST(compare_streams_remove_attr);
 	TEST(compare_streams_delete_entry);
 	TEST(compare_streams_delete_one_of_two);
+	TEST(compare_streams_delete_children_first);
 	TEST(compare_streams_add_new_entry);
 	TEST(compare_streams_rename);
 	TEST(compare_streams_offsets_restored);
@@ -1292,4 +1972,21 @@ void run_diff_tests(void)
 	printf("\nerror conditions:\n");
 	TEST(compare_streams_invalid_numeric_key);
 	TEST(compare_streams_duplicate_key);
+
+	printf("\nindex files:\n");
+	TEST(index_roundtrip);
+	TEST(index_stale);
+	TEST(index_missing);
+	TEST(index_garbage);
+	TEST(index_write_pipe);
+
+	printf("\ncompare_dumps:\n");
+	TEST(dump_key);
+	TEST(compare_dumps_changes);
+	TEST(compare_dumps_runs);
+	TEST(compare_dumps_many_runs);
+	TEST(compare_dumps_unchanged);
+	TEST(compare_dumps_duplicate);
+	TEST(compare_dumps_changerecord);
+	TEST(compare_dumps_handler_fails);
 }
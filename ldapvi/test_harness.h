@@ -56,5 +56,6 @@ void run_print_tests(void);
 void run_data_tests(void);
 void run_schema_tests(void);
 void run_arguments_tests(void);
+void run_stats_tests(void);
 
 #endif
@@ -24,6 +24,8 @@ int main(void)
 	run_schema_tests();
 	printf("\n");
 	run_arguments_tests();
+	printf("\n");
+	run_stats_tests();
 
 	printf("\n=== %d tests: %d passed, %d failed ===\n",
 	       tests_run, tests_passed, tests_failed);
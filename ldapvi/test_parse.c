@@ -428,6 +428,52 @@ static int test_backslash_embedded_backslash(void)
 	return 1;
 }
 
+static int test_backslash_long_value(void)
+{
+	/* a value longer than any initial line buffer, escapes at the end */
+	GString *input = g_string_new("add cn=foo,dc=example,dc=com\ncn ");
+	FILE *f;
+	char *key = 0;
+	tentry *entry = 0;
+	tattribute *a;
+	int rc;
+	int i;
+
+	for (i = 0; i < 10000; i++)
+		g_string_append_c(input, 'a' + i % 26);
+	g_string_append(input, "\\\\\n\n");
+	f = make_input(input->str);
+	rc = read_entry(f, -1, &key, &entry, 0);
+	fclose(f);
+
+	ASSERT_INT_EQ(rc, 0);
+	a = find_attr(entry, "cn");
+	ASSERT_NOT_NULL(a);
+	ASSERT_INT_EQ(attr_val_len(a, 0), 10001);
+	ASSERT(memcmp(attr_val_data(a, 0), input->str + 32, 10000) == 0);
+	ASSERT(attr_val_data(a, 0)[10000] == '\\');
+
+	free(key);
+	entry_free(entry);
+	g_string_free(input, 1);
+	return 1;
+}
+
+static int test_backslash_unexpected_eof(void)
+{
+	FILE *f = make_input(
+		"add cn=foo,dc=example,dc=com\n"
+		"cn foo\\\n"
+		"bar");
+	char *key = 0;
+	tentry *entry = 0;
+	int rc = read_entry(f, -1, &key, &entry, 0);
+	fclose(f);
+	ASSERT_INT_EQ(rc, -1);
+	free(key);
+	return 1;
+}
+
 static int test_semicolon_encoding(void)
 {
 	FILE *f = make_input(
@@ -1374,6 +1420,8 @@ void run_parse_tests(void)
 	TEST(backslash_plain_value);
 	TEST(backslash_embedded_newline);
 	TEST(backslash_embedded_backslash);
+	TEST(backslash_long_value);
+	TEST(backslash_unexpected_eof);
 	TEST(semicolon_encoding);
 
 	printf("\nGroup 6: Base64 encoding\n");
@@ -523,6 +523,60 @@ static int test_base64_nul_termination(void)
 	return 1;
 }
 
+static int test_base64_large_roundtrip(void)
+{
+	/* Large enough for several of print_base64's internal blocks. */
+	size_t n = 10000;
+	unsigned char *data = malloc(n);
+	unsigned char *decoded = malloc(n + 1);
+	GString *encoded = g_string_new("");
+	char *printed;
+	size_t printed_len;
+	FILE *s;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		data[i] = (i * 131) ^ (i >> 5);
+
+	g_string_append_base64(encoded, data, n);
+	s = open_memstream(&printed, &printed_len);
+	print_base64(data, n, s);
+	fclose(s);
+	ASSERT_INT_EQ(printed_len, encoded->len);
+	ASSERT(memcmp(printed, encoded->str, printed_len) == 0);
+
+	/* Folded every 76 characters */
+	ASSERT(strncmp(encoded->str + 76, "\n ", 2) == 0);
+	ASSERT(strncmp(encoded->str + 2 * 76 + 2, "\n ", 2) == 0);
+	ASSERT(strchr(encoded->str, '\n') == encoded->str + 76);
+
+	ASSERT_INT_EQ(read_base64(encoded->str, decoded, n + 1), n);
+	ASSERT(memcmp(decoded, data, n) == 0);
+
+	/* Decoding in place, as the parsers do */
+	ASSERT_INT_EQ(read_base64(encoded->str,
+				  (unsigned char *) encoded->str,
+				  encoded->len),
+		      n);
+	ASSERT(memcmp(encoded->str, data, n) == 0);
+
+	free(printed);
+	g_string_free(encoded, 1);
+	free(data);
+	free(decoded);
+	return 1;
+}
+
+static int test_base64_target_too_small(void)
+{
+	unsigned char buf[8];
+
+	ASSERT_INT_EQ(read_base64("Zm9vYmFy", buf, 5), -1);
+	ASSERT_INT_EQ(read_base64("Zm9v YmFy", buf, 5), -1);
+	ASSERT_INT_EQ(read_base64("Zm9v YmE=", buf, 6), 5);
+	ASSERT(memcmp(buf, "fooba", 5) == 0);
+	return 1;
+}
 
 /*
  * Group 7: ldapvi-key extension
@@ -1346,6 +1400,44 @@ static int test_crlf_line_endings(void)
 	return 1;
 }
 
+static int test_crlf_folded_value(void)
+{
+	FILE *f = make_input(
+		"dn: cn=foo,dc=example,dc=com\r\n"
+		"description: one\r\n"
+		" two\r\n"
+		"\r\n");
+	char *key = 0;
+	tentry *entry = 0;
+	tattribute *a;
+	int rc = ldif_read_entry(f, -1, &key, &entry, 0);
+	fclose(f);
+	ASSERT_INT_EQ(rc, 0);
+	a = find_attr(entry, "description");
+	ASSERT_NOT_NULL(a);
+	ASSERT_INT_EQ(attr_val_len(a, 0), 6);
+	ASSERT(memcmp(attr_val_data(a, 0), "onetwo", 6) == 0);
+
+	free(key);
+	entry_free(entry);
+	return 1;
+}
+
+static int test_bare_cr_in_value(void)
+{
+	FILE *f = make_input(
+		"dn: cn=foo,dc=example,dc=com\n"
+		"description: one\rtwo\n"
+		"\n");
+	char *key = 0;
+	tentry *entry = 0;
+	int rc = ldif_read_entry(f, -1, &key, &entry, 0);
+	fclose(f);
+	ASSERT_INT_EQ(rc, -1);
+	free(key);
+	return 1;
+}
+
 static int test_file_url_unknown_scheme(void)
 {
 	FILE *f = make_input(
@@ -1400,6 +1492,8 @@ void run_parseldif_tests(void)
 	TEST(base64_dn);
 	TEST(base64_dn_no_padding);
 	TEST(base64_nul_termination);
+	TEST(base64_large_roundtrip);
+	TEST(base64_target_too_small);
 
 	printf("\nGroup 7: ldapvi-key extension\n");
 	TEST(ldapvi_key_custom);
@@ -1460,5 +1554,7 @@ void run_parseldif_tests(void)
 	TEST(peek_does_not_consume_body);
 	TEST(extra_spaces_after_colon);
 	TEST(crlf_line_endings);
+	TEST(crlf_folded_value);
+	TEST(bare_cr_in_value);
 	TEST(file_url_unknown_scheme);
 }
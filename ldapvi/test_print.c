@@ -198,6 +198,28 @@ static int test_ldapvi_entry_space_prefix(void)
 	return 1;
 }
 
+static int test_ldapvi_entry_long_values(void)
+{
+	char *buf;
+	tentry *e = make_entry("cn=foo,dc=example,dc=com");
+	/* special bytes just before, across and after 8-byte boundaries */
+	add_value(e, "a", "abcdefghijklmnopqrstuvwxyz", 26);
+	add_value(e, "b", "abcdefg\xc3\xa9hijklmnop", 18);
+	add_value(e, "c", "abcdefghijklmnop\x00", 17);
+	add_value(e, "d", "abcdefghijklmno\xc3", 16);
+	add_value(e, "e", "abcdefghij\\klmn\nopqrst", 22);
+	g_entry = e; g_key = "add";
+	print_binary_mode = PRINT_UTF8;
+	buf = capture(do_print_ldapvi_entry, 0);
+	ASSERT(strstr(buf, "\na: abcdefghijklmnopqrstuvwxyz\n") != 0);
+	ASSERT(strstr(buf, "\nb:; abcdefg\xc3\xa9hijklmnop\n") != 0);
+	ASSERT(strstr(buf, "\nc:: ") != 0);
+	ASSERT(strstr(buf, "\nd:: ") != 0);
+	ASSERT(strstr(buf, "\ne:; abcdefghij\\\\klmn\\\nopqrst\n") != 0);
+	free(buf);
+	entry_free(e);
+	return 1;
+}
 
 /*
  * Group 2: print_ldapvi_modify
@@ -696,6 +718,7 @@ void run_print_tests(void)
 	TEST(ldapvi_entry_binary_value);
 	TEST(ldapvi_entry_newline_value);
 	TEST(ldapvi_entry_space_prefix);
+	TEST(ldapvi_entry_long_values);
 
 	printf("\nGroup 2: print_ldapvi_modify\n");
 	TEST(ldapvi_modify_add);
@@ -5,6 +5,11 @@
 #include "common.h"
 #include "test_harness.h"
 
+/* Not declared in common.h but have external linkage in schema.c */
+int schema_cache_read(
+	FILE *s, char **key, GPtrArray *classes, GPtrArray *types);
+int schema_cache_write(FILE *s, char **key, char **classes, char **types);
+
 /*
  * Case-insensitive hash functions (mirrors schema.c's static functions)
  */
@@ -60,6 +65,8 @@ make_test_schema(void)
 	tschema *s = xalloc(sizeof(tschema));
 	s->classes = g_hash_table_new(test_strcasehash, test_strcaseequal);
 	s->types = g_hash_table_new(test_strcasehash, test_strcaseequal);
+	s->entroids = g_hash_table_new(carray_hash, carray_equal);
+	g_mutex_init(&s->lock);
 
 	add_test_attributetype(s->types,
 		"( 2.5.4.0 NAME 'objectClass' )");
@@ -347,6 +354,43 @@ static int test_compute_entroid_unknown_class(void)
 	return 1;
 }
 
+static int test_compute_entroid_memoized(void)
+{
+	tschema *s = make_test_schema();
+	tentroid *first = entroid_new(s);
+	tentroid *second = entroid_new(s);
+	int i;
+
+	entroid_request_class(first, "person");
+	ASSERT_INT_EQ(compute_entroid(first), 0);
+	ASSERT_INT_EQ(g_hash_table_size(s->entroids), 1);
+	/* changes to one entroid must not leak into the memo */
+	ASSERT(entroid_remove_ad(first, "cn"));
+
+	entroid_request_class(second, "PERSON");
+	ASSERT_INT_EQ(compute_entroid(second), 0);
+	ASSERT_INT_EQ(g_hash_table_size(s->entroids), 1);
+	ASSERT(second->structural == first->structural);
+	ASSERT_INT_EQ(second->classes->len, first->classes->len);
+	ASSERT_INT_EQ(second->must->len, first->must->len + 1);
+	ASSERT_INT_EQ(second->may->len, first->may->len);
+	for (i = 0; i < second->may->len; i++)
+		ASSERT(g_ptr_array_index(second->may, i)
+		       == g_ptr_array_index(first->may, i));
+	ASSERT_STREQ(second->comment->str, first->comment->str);
+
+	/* a different class list is computed separately */
+	entroid_reset(second);
+	entroid_request_class(second, "top");
+	ASSERT_INT_EQ(compute_entroid(second), 0);
+	ASSERT_INT_EQ(g_hash_table_size(s->entroids), 2);
+	ASSERT_NULL(second->structural);
+
+	entroid_free(first);
+	entroid_free(second);
+	schema_free(s);
+	return 1;
+}
 
 /*
  * Group 7: entroid_remove_ad
@@ -419,6 +463,100 @@ static int test_strcasehash_case_insensitive(void)
 }
 
 
+
+/*
+ * Group 9: schema cache files
+ */
+static void
+free_definitions(GPtrArray *defs)
+{
+	int i;
+	for (i = 0; i < defs->len; i++)
+		free(g_ptr_array_index(defs, i));
+	g_ptr_array_free(defs, 1);
+}
+
+static int test_schema_cache_roundtrip(void)
+{
+	char *key[] = {"ldap://localhost", "cn=Subschema",
+		       "20260101000000Z", 0};
+	char *classes[] = {
+		"( 2.5.6.6 NAME 'person' SUP top STRUCTURAL MUST cn )",
+		0};
+	char *types[] = {
+		"( 2.5.4.3 NAME 'cn' SUP name )",
+		"( 2.5.4.4 NAME 'sn' SUP name )",
+		0};
+	GPtrArray *read_classes = g_ptr_array_new();
+	GPtrArray *read_types = g_ptr_array_new();
+	FILE *s = tmpfile();
+
+	ASSERT_INT_EQ(schema_cache_write(s, key, classes, types), 0);
+	rewind(s);
+	ASSERT_INT_EQ(schema_cache_read(s, key, read_classes, read_types), 0);
+	ASSERT_INT_EQ(read_classes->len, 1);
+	ASSERT_INT_EQ(read_types->len, 2);
+	ASSERT_STREQ(g_ptr_array_index(read_classes, 0), classes[0]);
+	ASSERT_STREQ(g_ptr_array_index(read_types, 1), types[1]);
+
+	fclose(s);
+	free_definitions(read_classes);
+	free_definitions(read_types);
+	return 1;
+}
+
+static int test_schema_cache_stale(void)
+{
+	char *key[] = {"ldap://localhost", "cn=Subschema",
+		       "20260101000000Z", 0};
+	char *newer[] = {"ldap://localhost", "cn=Subschema",
+			 "20260201000000Z", 0};
+	char *types[] = {"( 2.5.4.3 NAME 'cn' SUP name )", 0};
+	GPtrArray *read_classes = g_ptr_array_new();
+	GPtrArray *read_types = g_ptr_array_new();
+	FILE *s = tmpfile();
+
+	ASSERT_INT_EQ(schema_cache_write(s, key, 0, types), 0);
+	rewind(s);
+	ASSERT_INT_EQ(
+		schema_cache_read(s, newer, read_classes, read_types), -1);
+	ASSERT_INT_EQ(read_types->len, 0);
+
+	fclose(s);
+	free_definitions(read_classes);
+	free_definitions(read_types);
+	return 1;
+}
+
+static int test_schema_cache_truncated(void)
+{
+	char *key[] = {"ldap://localhost", "cn=Subschema", "1", 0};
+	GPtrArray *read_classes = g_ptr_array_new();
+	GPtrArray *read_types = g_ptr_array_new();
+	const char *data =
+		"ldapvi schema cache 1\nldap://localhost\ncn=Subschema\n1\n"
+		"0\n2\n( 2.5.4.3 NAME 'cn' SUP name )\n";
+	FILE *s = fmemopen((void *) data, strlen(data), "r");
+
+	ASSERT_INT_EQ(schema_cache_read(s, key, read_classes, read_types), -1);
+
+	fclose(s);
+	free_definitions(read_classes);
+	free_definitions(read_types);
+	return 1;
+}
+
+static int test_schema_cache_rejects_newline(void)
+{
+	char *key[] = {"ldap://localhost", "cn=Subschema", "1", 0};
+	char *types[] = {"( 2.5.4.3 NAME 'cn'\n SUP name )", 0};
+	FILE *s = tmpfile();
+
+	ASSERT_INT_EQ(schema_cache_write(s, key, 0, types), -1);
+	fclose(s);
+	return 1;
+}
+
 /*
  * run_schema_tests
  */
@@ -454,6 +592,7 @@ void run_schema_tests(void)
 	TEST(compute_entroid_person);
 	TEST(compute_entroid_no_structural_warning);
 	TEST(compute_entroid_unknown_class);
+	TEST(compute_entroid_memoized);
 
 	printf("\nGroup 7: entroid_remove_ad\n");
 	TEST(entroid_remove_ad_from_must);
@@ -462,4 +601,10 @@ void run_schema_tests(void)
 
 	printf("\nGroup 8: strcasehash\n");
 	TEST(strcasehash_case_insensitive);
+
+	printf("\nGroup 9: schema cache files\n");
+	TEST(schema_cache_roundtrip);
+	TEST(schema_cache_stale);
+	TEST(schema_cache_truncated);
+	TEST(schema_cache_rejects_newline);
 }
@@ -1,6 +1,6 @@
 /* -*- show-trailing-whitespace: t; indent-tabs: t -*-
  * Tests for search.c - get_entry, discover_naming_contexts,
- * handle_result, log_reference, search_subtree.
+ * handle_result, log_reference, search_subtree, search.
  *
  * This is a separate test binary that does NOT link -lldap.
  * All LDAP functions are stubbed in test_search_stubs.c.
@@ -38,6 +38,22 @@ extern char **stub_refs;
 extern char stub_choose_result;
 extern int *stub_result_types;
 extern int stub_result_type_idx;
+extern char **stub_page_cookies;
+extern int stub_page_cookie_idx;
+extern int stub_search_calls;
+extern char *stub_search_filter;
+extern struct berval **stub_bvalues;
+extern int stub_page_size;
+extern int stub_search_after_results;
+extern char *stub_page_request_cookie;
+extern int *stub_result_msgids;
+extern int stub_last_msgid;
+extern LDAPVLVInfo stub_vlv_request;
+extern int stub_vlv_response;
+extern int stub_vlv_target;
+extern int stub_vlv_count;
+extern GThread *stub_main_thread;
+extern int stub_foreign_decodes;
 
 
 /*
@@ -245,6 +261,20 @@ reset_stubs(void)
 	stub_result_types = 0;
 	stub_result_type_idx = 0;
 	stub_choose_result = 'y';
+	stub_page_cookies = 0;
+	stub_page_cookie_idx = 0;
+	stub_search_calls = 0;
+	stub_search_after_results = 0;
+	stub_page_size = 0;
+	stub_result_msgids = 0;
+	stub_last_msgid = 0;
+	memset(&stub_vlv_request, 0, sizeof(stub_vlv_request));
+	stub_vlv_response = 0;
+	stub_vlv_target = 0;
+	stub_vlv_count = 0;
+	stub_bvalues = 0;
+	stub_main_thread = g_thread_self();
+	stub_foreign_decodes = 0;
 }
 
 static int test_search_subtree_one_entry(void)
@@ -377,6 +407,481 @@ static int test_search_subtree_appends_offsets(void)
 	return 1;
 }
 
+static int test_search_subtree_offsets_in_file(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_RESULT};
+	GArray *offsets = g_array_new(0, 0, sizeof(long));
+	FILE *s = tmpfile();
+	char buf[64];
+	size_t n;
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+
+	reset_stubs();
+	stub_result_types = seq;
+
+	/* still buffered in s when the search starts */
+	fputs("header\n", s);
+	search_subtree(s, TEST_LD, offsets, "dc=example,dc=com",
+		       &cmd, 0, 0, 0, 0);
+	fputs("trailer\n", s);
+
+	/* offsets are counted from the start of the file */
+	ASSERT_INT_EQ(offsets->len, 2);
+	ASSERT_INT_EQ(g_array_index(offsets, long, 0), 7);
+	ASSERT_INT_EQ(g_array_index(offsets, long, 1), 11);
+	ASSERT_INT_EQ(ftell(s), 23);
+
+	rewind(s);
+	n = fread(buf, 1, sizeof(buf) - 1, s);
+	buf[n] = 0;
+	ASSERT_STREQ(buf, "header\n0 1\n1 1\ntrailer\n");
+
+	fclose(s);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+/*
+ * Group 6: search_subtree with --page-size
+ */
+static int test_search_subtree_unpaged_single_request(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_RESULT};
+	GArray *offsets = g_array_new(0, 0, sizeof(long));
+	FILE *s = tmpfile();
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+
+	reset_stubs();
+	stub_result_types = seq;
+
+	search_subtree(s, TEST_LD, offsets, "dc=example,dc=com",
+		       &cmd, 0, 1, 0, 0);
+
+	ASSERT_INT_EQ(stub_search_calls, 1);
+	ASSERT_INT_EQ(stub_page_size, 0);
+
+	fclose(s);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+static int test_search_subtree_paged_follows_cookie(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_RESULT,
+		     LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_RESULT};
+	char *cookies[] = {"page2", ""};
+	GArray *offsets = g_array_new(0, 0, sizeof(long));
+	FILE *s = tmpfile();
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.page_size = 2;
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_page_cookies = cookies;
+
+	search_subtree(s, TEST_LD, offsets, "dc=example,dc=com",
+		       &cmd, 0, 1, 0, 0);
+
+	/* offsets keep growing across pages */
+	ASSERT_INT_EQ(offsets->len, 3);
+	ASSERT_INT_EQ(stub_search_calls, 2);
+	ASSERT_INT_EQ(stub_page_size, 2);
+	ASSERT_STREQ(stub_page_request_cookie, "page2");
+	ASSERT_INT_EQ(stub_page_cookie_idx, 2);
+
+	fclose(s);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+static int test_search_subtree_paged_without_response_control(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_RESULT};
+	GArray *offsets = g_array_new(0, 0, sizeof(long));
+	FILE *s = tmpfile();
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.page_size = 10;
+
+	/* server ignored the (non-critical) control: a single page */
+	reset_stubs();
+	stub_result_types = seq;
+
+	search_subtree(s, TEST_LD, offsets, "dc=example,dc=com",
+		       &cmd, 0, 1, 0, 0);
+
+	ASSERT_INT_EQ(offsets->len, 1);
+	ASSERT_INT_EQ(stub_search_calls, 1);
+
+	fclose(s);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+static int test_search_subtree_paged_stops_on_error(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_RESULT};
+	char *cookies[] = {"more", ""};
+	GArray *offsets = g_array_new(0, 0, sizeof(long));
+	FILE *s = tmpfile();
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.page_size = 1;
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_page_cookies = cookies;
+	stub_parse_result_err = LDAP_SIZELIMIT_EXCEEDED;
+	stub_choose_result = 'y';
+
+	search_subtree(s, TEST_LD, offsets, "dc=example,dc=com",
+		       &cmd, 0, 0, 0, 0);
+
+	ASSERT_INT_EQ(offsets->len, 1);
+	ASSERT_INT_EQ(stub_search_calls, 1);
+
+	fclose(s);
+	g_array_free(offsets, 1);
+	return 1;
+}
+
+
+/*
+ * Group 7: search across several bases
+ */
+static int test_search_bases_keep_base_order(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_RESULT, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_RESULT,
+		     LDAP_RES_SEARCH_RESULT};
+	int ids[] = {2, 1, 2, 3, 1, 1, 3};
+	char *buf = 0;
+	size_t bufsz = 0;
+	FILE *s = open_memstream(&buf, &bufsz);
+	GArray *offsets;
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.basedns = g_ptr_array_new();
+	g_ptr_array_add(cmd.basedns, "dc=a");
+	g_ptr_array_add(cmd.basedns, "dc=b");
+	g_ptr_array_add(cmd.basedns, "dc=c");
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_result_msgids = ids;
+
+	offsets = search(s, TEST_LD, &cmd, 0, 0, 0, 0);
+	fclose(s);
+
+	/* all three searches were sent before any result was read */
+	ASSERT_INT_EQ(stub_search_calls, 3);
+	/* entries are written base by base, whatever the arrival order */
+	ASSERT_STREQ(buf, "0 1\n1 1\n2 2\n3 3\n");
+	ASSERT_INT_EQ(offsets->len, 4);
+	ASSERT_INT_EQ(g_array_index(offsets, long, 0), 0);
+	ASSERT_INT_EQ(g_array_index(offsets, long, 1), 4);
+	ASSERT_INT_EQ(g_array_index(offsets, long, 2), 8);
+	ASSERT_INT_EQ(g_array_index(offsets, long, 3), 12);
+
+	free(buf);
+	g_array_free(offsets, 1);
+	g_ptr_array_free(cmd.basedns, 1);
+	return 1;
+}
+
+static int test_search_bases_paged_concurrently(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_RESULT, LDAP_RES_SEARCH_RESULT,
+		     LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_RESULT};
+	int ids[] = {1, 2, 2, 1, 3, 3};
+	char *cookies[] = {"b2", "", ""};
+	char *buf = 0;
+	size_t bufsz = 0;
+	FILE *s = open_memstream(&buf, &bufsz);
+	GArray *offsets;
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.page_size = 1;
+	cmd.basedns = g_ptr_array_new();
+	g_ptr_array_add(cmd.basedns, "dc=a");
+	g_ptr_array_add(cmd.basedns, "dc=b");
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_result_msgids = ids;
+	stub_page_cookies = cookies;
+
+	offsets = search(s, TEST_LD, &cmd, 0, 0, 0, 0);
+	fclose(s);
+
+	/* the first pages were requested at once, but the second page of
+	 * dc=b only after dc=a was done */
+	ASSERT_INT_EQ(stub_search_calls, 3);
+	ASSERT_INT_EQ(stub_search_after_results, 4);
+	ASSERT_STREQ(buf, "0 1\n1 2\n2 3\n");
+	ASSERT_INT_EQ(offsets->len, 3);
+
+	free(buf);
+	g_array_free(offsets, 1);
+	g_ptr_array_free(cmd.basedns, 1);
+	return 1;
+}
+
+
+/*
+ * Group 8: --render-threads
+ */
+static int test_search_render_threads_keep_order(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_REFERENCE,
+		     LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_RESULT};
+	char *refs[] = {"ldap://other.example.com", 0};
+	char *inline_buf, *threaded_buf;
+	size_t inline_len, threaded_len;
+	GArray *inline_offsets = g_array_new(0, 0, sizeof(long));
+	GArray *threaded_offsets = g_array_new(0, 0, sizeof(long));
+	FILE *s;
+	int i;
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_refs = refs;
+	s = open_memstream(&inline_buf, &inline_len);
+	search_subtree(s, TEST_LD, inline_offsets, "dc=example,dc=com",
+		       &cmd, 0, 1, 0, 0);
+	fclose(s);
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_refs = refs;
+	cmd.render_threads = 3;
+	s = open_memstream(&threaded_buf, &threaded_len);
+	search_subtree(s, TEST_LD, threaded_offsets, "dc=example,dc=com",
+		       &cmd, 0, 1, 0, 0);
+	fclose(s);
+
+	ASSERT_STREQ(threaded_buf, inline_buf);
+	/* the workers must not use the LDAP handle */
+	ASSERT_INT_EQ(stub_foreign_decodes, 0);
+	ASSERT_INT_EQ(threaded_offsets->len, 5);
+	ASSERT_INT_EQ(inline_offsets->len, 5);
+	for (i = 0; i < 5; i++)
+		ASSERT_INT_EQ(g_array_index(threaded_offsets, long, i),
+			      g_array_index(inline_offsets, long, i));
+
+	free(inline_buf);
+	free(threaded_buf);
+	g_array_free(inline_offsets, 1);
+	g_array_free(threaded_offsets, 1);
+	return 1;
+}
+
+/*
+ * Group 9: search_window
+ */
+static int test_search_window_requests_window(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_RESULT};
+	char *buf = 0;
+	size_t bufsz = 0;
+	FILE *s = open_memstream(&buf, &bufsz);
+	GArray *offsets;
+	twindow w;
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.basedns = g_ptr_array_new();
+	g_ptr_array_add(cmd.basedns, "dc=a");
+	w.target = 11;
+	w.size = 5;
+	w.count = 100;
+	w.context = 0;
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_vlv_response = 1;
+	stub_vlv_target = 11;
+	stub_vlv_count = 12;
+
+	offsets = search_window(s, TEST_LD, &cmd, 0, &w, 0);
+	fclose(s);
+
+	ASSERT_INT_EQ(stub_search_calls, 1);
+	ASSERT_INT_EQ(stub_vlv_request.ldvlv_offset, 11);
+	ASSERT_INT_EQ(stub_vlv_request.ldvlv_before_count, 0);
+	ASSERT_INT_EQ(stub_vlv_request.ldvlv_after_count, 4);
+	ASSERT_INT_EQ(stub_vlv_request.ldvlv_count, 100);
+	/* every window is a file of its own, numbered from 0 */
+	ASSERT_STREQ(buf, "0 1\n1 1\n");
+	ASSERT_INT_EQ(offsets->len, 2);
+	ASSERT_INT_EQ(w.target, 11);
+	ASSERT_INT_EQ(w.count, 12);
+
+	free(buf);
+	g_array_free(offsets, 1);
+	g_ptr_array_free(cmd.basedns, 1);
+	return 1;
+}
+
+static int test_search_window_beyond_end(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_RESULT};
+	GArray *offsets;
+	FILE *s = tmpfile();
+	twindow w;
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.basedns = g_ptr_array_new();
+	w.target = 21;
+	w.size = 10;
+	w.count = 0;
+	w.context = 0;
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_vlv_response = 1;
+	stub_vlv_target = 21;
+	stub_vlv_count = 20;
+
+	offsets = search_window(s, TEST_LD, &cmd, 0, &w, 0);
+
+	/* unlike search(), an empty window is not an error */
+	ASSERT_INT_EQ(offsets->len, 0);
+	ASSERT_INT_EQ(stub_vlv_request.ldvlv_count, 0);
+	ASSERT_INT_EQ(w.count, 20);
+
+	fclose(s);
+	g_array_free(offsets, 1);
+	g_ptr_array_free(cmd.basedns, 1);
+	return 1;
+}
+
+
+/*
+ * Group 10: entry stamps
+ */
+#define CSN1 "20260101000000.000001Z#000000#000#000000"
+#define CSN2 "20260301000000.000001Z#000000#000#000000"
+#define CSN3 "20260401000000.000001Z#000000#000#000000"
+
+static int test_search_records_stamps(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_ENTRY,
+		     LDAP_RES_SEARCH_RESULT};
+	struct berval csn = {sizeof(CSN1) - 1, CSN1};
+	struct berval *values[] = {&csn, 0};
+	GPtrArray *stamps = g_ptr_array_new();
+	GArray *offsets;
+	FILE *s = tmpfile();
+	int i;
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.basedns = g_ptr_array_new();
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_bvalues = values;
+
+	offsets = search(s, TEST_LD, &cmd, 0, 0, 0, stamps);
+
+	/* one stamp per offset */
+	ASSERT_INT_EQ(offsets->len, 2);
+	ASSERT_INT_EQ(stamps->len, 2);
+	for (i = 0; i < 2; i++) {
+		char *stamp = g_ptr_array_index(stamps, i);
+		ASSERT_INT_EQ(strlen(stamp), strlen("entryCSN=" CSN1));
+		ASSERT_STREQ(stamp, "entryCSN=" CSN1);
+	}
+
+	fclose(s);
+	g_array_free(offsets, 1);
+	for (i = 0; i < stamps->len; i++)
+		free(g_ptr_array_index(stamps, i));
+	g_ptr_array_free(stamps, 1);
+	g_ptr_array_free(cmd.basedns, 1);
+	return 1;
+}
+
+static int test_search_changes_filters_on_newest_stamp(void)
+{
+	int seq[] = {LDAP_RES_SEARCH_ENTRY, LDAP_RES_SEARCH_RESULT};
+	struct berval csn = {sizeof(CSN3) - 1, CSN3};
+	struct berval *values[] = {&csn, 0};
+	GPtrArray *stamps = g_ptr_array_new();
+	GHashTable *changed;
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.quiet = 1;
+	cmd.basedns = g_ptr_array_new();
+	cmd.filter = "objectclass=person";
+	g_ptr_array_add(stamps, "entryCSN=" CSN1);
+	g_ptr_array_add(stamps, 0);
+	g_ptr_array_add(stamps, "entryCSN=" CSN2);
+	g_ptr_array_add(stamps, "modifyTimestamp=20260201000000Z");
+
+	reset_stubs();
+	stub_result_types = seq;
+	stub_bvalues = values;
+
+	changed = search_changes(TEST_LD, &cmd, 0, stamps);
+
+	ASSERT_NOT_NULL(changed);
+	ASSERT_INT_EQ(stub_search_calls, 1);
+	ASSERT_STREQ(stub_search_filter,
+		     "(&(objectclass=person)"
+		     "(|(entryCSN>=" CSN2 ")"
+		     "(modifyTimestamp>=20260201000000Z)))");
+	ASSERT_INT_EQ(g_hash_table_size(changed), 1);
+	ASSERT_STREQ(g_hash_table_lookup(changed,
+					 "cn=test,dc=example,dc=com"),
+		     "entryCSN=" CSN3);
+
+	g_hash_table_destroy(changed);
+	g_ptr_array_free(stamps, 1);
+	g_ptr_array_free(cmd.basedns, 1);
+	return 1;
+}
+
+static int test_search_changes_without_stamps(void)
+{
+	GPtrArray *stamps = g_ptr_array_new();
+	cmdline cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.basedns = g_ptr_array_new();
+	g_ptr_array_add(stamps, 0);
+
+	reset_stubs();
+
+	ASSERT(search_changes(TEST_LD, &cmd, 0, stamps) == 0);
+	ASSERT_INT_EQ(stub_search_calls, 0);
+
+	g_ptr_array_free(stamps, 1);
+	g_ptr_array_free(cmd.basedns, 1);
+	return 1;
+}
+
 
 /*
  * main
@@ -412,6 +917,29 @@ main(void)
 	TEST(search_subtree_no_entries);
 	TEST(search_subtree_with_reference);
 	TEST(search_subtree_appends_offsets);
+	TEST(search_subtree_offsets_in_file);
+
+	printf("\nGroup 6: search_subtree with --page-size\n");
+	TEST(search_subtree_unpaged_single_request);
+	TEST(search_subtree_paged_follows_cookie);
+	TEST(search_subtree_paged_without_response_control);
+	TEST(search_subtree_paged_stops_on_error);
+
+	printf("\nGroup 7: search across several bases\n");
+	TEST(search_bases_keep_base_order);
+	TEST(search_bases_paged_concurrently);
+
+	printf("\nGroup 8: --render-threads\n");
+	TEST(search_render_threads_keep_order);
+
+	printf("\nGroup 9: search_window\n");
+	TEST(search_window_requests_window);
+	TEST(search_window_beyond_end);
+
+	printf("\nGroup 10: entry stamps\n");
+	TEST(search_records_stamps);
+	TEST(search_changes_filters_on_newest_stamp);
+	TEST(search_changes_without_stamps);
 
 	printf("\n%d tests: %d passed, %d failed\n",
 	       tests_run, tests_passed, tests_failed);
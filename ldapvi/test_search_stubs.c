@@ -30,6 +30,30 @@ struct berval **stub_bvalues = 0;
 int *stub_result_types = 0;
 int stub_result_type_idx = 0;
 
+/* message ids for the ldap_result sequence (NULL = latest request) */
+int *stub_result_msgids = 0;
+int stub_last_msgid = 0;
+
+/*
+ * Messages returned by ldap_result remember their type and message id,
+ * so that the search code can tell concurrent requests apart.
+ */
+#define STUB_MESSAGES 64
+struct stub_message {
+	int type;
+	int msgid;
+};
+static struct stub_message stub_messages[STUB_MESSAGES];
+
+static struct stub_message *
+stub_message(LDAPMessage *msg)
+{
+	struct stub_message *m = (struct stub_message *) msg;
+	if (m >= stub_messages && m < stub_messages + STUB_MESSAGES)
+		return m;
+	return 0;
+}
+
 /* ldap_parse_result */
 int stub_parse_result_rc = 0;
 int stub_parse_result_err = 0;
@@ -45,6 +69,23 @@ char *stub_errstring = "Success";
 /* choose */
 char stub_choose_result = 'y';
 
+/* paged results: one cookie per page, "" marks the last page */
+char **stub_page_cookies = 0;
+int stub_page_cookie_idx = 0;
+int stub_search_calls = 0;
+int stub_search_after_results = 0; /* results read before last search */
+char *stub_search_filter = 0;
+int stub_page_size = 0;
+char *stub_page_request_cookie = 0;
+static int stub_dummy_control;
+
+/* virtual list view: the last request, and the response to send */
+LDAPVLVInfo stub_vlv_request;
+int stub_vlv_response = 0;
+int stub_vlv_target = 0;
+int stub_vlv_count = 0;
+int stub_vlv_error = 0;
+
 
 /*
  * LDAP function stubs
@@ -65,10 +106,14 @@ ldap_search_ext(LDAP *ld, const char *base, int scope, const char *filter,
 		LDAPControl **clientctrls, struct timeval *timeout,
 		int sizelimit, int *msgidp)
 {
-	(void)ld; (void)base; (void)scope; (void)filter;
+	(void)ld; (void)base; (void)scope;
 	(void)attrs; (void)attrsonly; (void)serverctrls;
 	(void)clientctrls; (void)timeout; (void)sizelimit;
-	if (msgidp) *msgidp = 1;
+	stub_search_calls++;
+	stub_search_after_results = stub_result_type_idx;
+	free(stub_search_filter);
+	stub_search_filter = filter ? strdup(filter) : 0;
+	if (msgidp) *msgidp = ++stub_last_msgid;
 	return 0;
 }
 
@@ -76,17 +121,39 @@ int
 ldap_result(LDAP *ld, int msgid, int all, struct timeval *timeout,
 	    LDAPMessage **result)
 {
+	struct stub_message *m;
+	int i = stub_result_type_idx++;
 	(void)ld; (void)msgid; (void)all; (void)timeout;
-	*result = stub_result;
-	if (stub_result_types)
-		return stub_result_types[stub_result_type_idx++];
-	return LDAP_RES_SEARCH_RESULT;
+
+	m = &stub_messages[i % STUB_MESSAGES];
+	m->type = stub_result_types
+		? stub_result_types[i]
+		: LDAP_RES_SEARCH_RESULT;
+	m->msgid = stub_result_msgids ? stub_result_msgids[i] : stub_last_msgid;
+	*result = (LDAPMessage *) m;
+	return m->type;
+}
+
+int
+ldap_msgtype(LDAPMessage *msg)
+{
+	struct stub_message *m = stub_message(msg);
+	return m ? m->type : LDAP_RES_SEARCH_RESULT;
+}
+
+int
+ldap_msgid(LDAPMessage *msg)
+{
+	struct stub_message *m = stub_message(msg);
+	return m ? m->msgid : 1;
 }
 
 LDAPMessage *
 ldap_first_entry(LDAP *ld, LDAPMessage *chain)
 {
-	(void)ld; (void)chain;
+	(void)ld;
+	if (stub_message(chain))
+		return chain;
 	return stub_entry;
 }
 
@@ -133,6 +200,72 @@ ldap_parse_reference(LDAP *ld, LDAPMessage *ref, char ***referralsp,
 	return 0;
 }
 
+int
+ldap_create_page_control(LDAP *ld, ber_int_t pagesize,
+			 struct berval *cookie, int iscritical,
+			 LDAPControl **ctrlp)
+{
+	(void)ld; (void)iscritical;
+	stub_page_size = pagesize;
+	free(stub_page_request_cookie);
+	stub_page_request_cookie = 0;
+	if (cookie && cookie->bv_val)
+		stub_page_request_cookie
+			= strndup(cookie->bv_val, cookie->bv_len);
+	*ctrlp = (LDAPControl *) &stub_dummy_control;
+	return 0;
+}
+
+LDAPControl *
+ldap_control_find(const char *oid, LDAPControl **ctrls,
+		  LDAPControl ***nextctrlp)
+{
+	(void)ctrls; (void)nextctrlp;
+	if (!strcmp(oid, LDAP_CONTROL_VLVRESPONSE)
+	    ? !stub_vlv_response
+	    : !stub_page_cookies)
+		return 0;
+	return (LDAPControl *) &stub_dummy_control;
+}
+
+int
+ldap_parse_pageresponse_control(LDAP *ld, LDAPControl *ctrl,
+				ber_int_t *countp, struct berval *cookie)
+{
+	char *str = stub_page_cookies[stub_page_cookie_idx++];
+	(void)ld; (void)ctrl;
+	if (countp) *countp = 0;
+	cookie->bv_len = strlen(str);
+	cookie->bv_val = cookie->bv_len ? xdup(str) : 0;
+	return 0;
+}
+
+int
+ldap_create_vlv_control(LDAP *ld, LDAPVLVInfo *info, LDAPControl **ctrlp)
+{
+	(void)ld;
+	stub_vlv_request = *info;
+	*ctrlp = (LDAPControl *) &stub_dummy_control;
+	return 0;
+}
+
+int
+ldap_parse_vlvresponse_control(LDAP *ld, LDAPControl *ctrl,
+			       ber_int_t *target, ber_int_t *count,
+			       struct berval **context, int *errcode)
+{
+	(void)ld; (void)ctrl;
+	*target = stub_vlv_target;
+	*count = stub_vlv_count;
+	*context = 0;
+	*errcode = stub_vlv_error;
+	return 0;
+}
+
+void ber_bvfree(struct berval *bv) { (void)bv; }
+void ldap_control_free(LDAPControl *ctrl) { (void)ctrl; }
+void ldap_controls_free(LDAPControl **ctrls) { (void)ctrls; }
+
 void ldap_value_free(char **vals) { (void)vals; }
 void ldap_value_free_len(struct berval **vals) { (void)vals; }
 int ldap_msgfree(LDAPMessage *lm) { (void)lm; return 0; }
@@ -162,13 +295,42 @@ int compute_entroid(tentroid *e) { (void)e; return 0; }
 /*
  * Print function stubs
  */
-void print_ldif_message(FILE *s, LDAP *ld, LDAPMessage *entry,
-			int key, tentroid *e)
-{ (void)s; (void)ld; (void)entry; (void)key; (void)e; }
+/*
+ * The print stubs write "key msgid" for each entry, so that tests can
+ * check which request an entry came from and where it ended up.
+ * Decoding counts calls from threads other than stub_main_thread, which
+ * would race with the main thread on the LDAP handle.
+ */
+struct decoded_message {
+	int msgid;
+};
+
+GThread *stub_main_thread = 0;
+int stub_foreign_decodes = 0;
+
+tmessage *message_decode(LDAP *ld, LDAPMessage *entry)
+{
+	tmessage *m = xalloc(sizeof(tmessage));
+	(void)ld;
+	if (g_thread_self() != stub_main_thread)
+		stub_foreign_decodes++;
+	m->msgid = ldap_msgid(entry);
+	return m;
+}
 
-void print_ldapvi_message(FILE *s, LDAP *ld, LDAPMessage *entry,
-			  int key, tentroid *e)
-{ (void)s; (void)ld; (void)entry; (void)key; (void)e; }
+void message_free(tmessage *m) { free(m); }
+
+void print_ldif_decoded(FILE *s, tmessage *m, int key, tentroid *e)
+{
+	(void)e;
+	fprintf(s, "%d %d\n", key, m->msgid);
+}
+
+void print_ldapvi_decoded(FILE *s, tmessage *m, int key, tentroid *e)
+{
+	(void)e;
+	fprintf(s, "%d %d\n", key, m->msgid);
+}
 
 
 /*
@@ -181,11 +343,13 @@ void do_syserr(char *file, int line) { (void)file; (void)line; }
 /*
  * Misc function stubs / real implementations
  */
+/* like the real xalloc, this does not clear the memory; the junk makes
+ * reliance on zeroed memory show up in the tests */
 void *xalloc(size_t size)
 {
 	void *p = malloc(size);
 	if (!p) { perror("malloc"); abort(); }
-	memset(p, 0, size);
+	memset(p, 0xa5, size);
 	return p;
 }
 
@@ -0,0 +1,155 @@
+/* -*- show-trailing-whitespace: t; indent-tabs: t -*-
+ * Tests for stats.c - the counters and timers behind --stats.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "test_harness.h"
+
+static char *
+report(void)
+{
+	char *buf;
+	size_t len;
+	FILE *s = open_memstream(&buf, &len);
+
+	if (!s) abort();
+	stats_print(s);
+	fclose(s);
+	return buf;
+}
+
+/*
+ * Group 1: disabled statistics
+ */
+static int
+test_disabled_records_nothing(void)
+{
+	char *text;
+
+	stats_enable(0);
+	stats_enabled = 0;
+	ASSERT_INT_EQ(stats_now(), 0);
+	stats_time(STAT_SEARCH, stats_now());
+	stats_add(STAT_ENTRIES, 10);
+	ASSERT_INT_EQ(stats_percentile(STAT_SEARCH, 1.0), 0);
+	text = report();
+	ASSERT(strstr(text, "entries read:   0 ") != 0);
+	ASSERT(strstr(text, "search ") == 0);
+	free(text);
+	return 1;
+}
+
+static int
+test_enabled_clock_nonzero(void)
+{
+	guint64 start;
+
+	stats_enable(0);
+	start = stats_now();
+	ASSERT(start != 0);
+	ASSERT(stats_now() >= start);
+	stats_enabled = 0;
+	return 1;
+}
+
+/*
+ * Group 2: percentiles
+ */
+static int
+test_percentiles(void)
+{
+	int i;
+
+	stats_enable(0);
+	/* 1..100 us */
+	for (i = 1; i <= 100; i++)
+		stats_record(STAT_PARSE, i * 1000);
+	ASSERT(stats_percentile(STAT_PARSE, 0.5) <= 51000);
+	ASSERT(stats_percentile(STAT_PARSE, 0.5) >= 51000 * 7 / 8);
+	ASSERT(stats_percentile(STAT_PARSE, 0.99) <= 100000);
+	ASSERT(stats_percentile(STAT_PARSE, 0.99) >= 90000 * 7 / 8);
+	ASSERT_INT_EQ(stats_percentile(STAT_PARSE, 1.0), 100000);
+	ASSERT_INT_EQ(stats_percentile(STAT_COMPARE, 0.5), 0);
+	stats_enabled = 0;
+	return 1;
+}
+
+static int
+test_small_durations_exact(void)
+{
+	stats_enable(0);
+	stats_record(STAT_RENDER, 3);
+	stats_record(STAT_RENDER, 5);
+	ASSERT_INT_EQ(stats_percentile(STAT_RENDER, 0.0), 3);
+	ASSERT_INT_EQ(stats_percentile(STAT_RENDER, 0.5), 5);
+	stats_enabled = 0;
+	return 1;
+}
+
+/*
+ * Group 3: reports
+ */
+static int
+test_report_text(void)
+{
+	char *text;
+
+	stats_enable(0);
+	stats_add(STAT_FASTCMP_HITS, 3);
+	stats_add(STAT_FASTCMP_MISSES, 1);
+	stats_record(STAT_ADD, 2000);
+	text = report();
+	ASSERT(strstr(text, "3 hits, 1 misses (75.0% hits)") != 0);
+	ASSERT(strstr(text, "ldap_add") != 0);
+	ASSERT(strstr(text, "ldap_delete") == 0);
+	free(text);
+	stats_enabled = 0;
+	return 1;
+}
+
+static int
+test_report_json(void)
+{
+	char *json;
+
+	stats_enable(1);
+	stats_add(STAT_ENTRIES, 2);
+	stats_add(STAT_BYTES, 100);
+	stats_add(STAT_FASTCMP_HITS, 1);
+	stats_add(STAT_FASTCMP_MISSES, 1);
+	stats_record(STAT_SEARCH, 1000000000);
+	json = report();
+	ASSERT(json[0] == '{');
+	ASSERT(strstr(json, "\"entries\": 2,") != 0);
+	ASSERT(strstr(json, "\"entries_per_second\": 2.0,") != 0);
+	ASSERT(strstr(json, "\"bytes_written\": 100,") != 0);
+	ASSERT(strstr(json, "\"hit_ratio\": 0.5000}") != 0);
+	ASSERT(strstr(json, "\"search\": {\"count\": 1,") != 0);
+	ASSERT(strstr(json, "\"max_ns\": 1000000000}}}\n") != 0);
+	free(json);
+	stats_enabled = 0;
+	return 1;
+}
+
+/*
+ * run_stats_tests
+ */
+void run_stats_tests(void)
+{
+	printf("=== stats.c test suite ===\n\n");
+
+	printf("Group 1: disabled statistics\n");
+	TEST(disabled_records_nothing);
+	TEST(enabled_clock_nonzero);
+
+	printf("\nGroup 2: percentiles\n");
+	TEST(percentiles);
+	TEST(small_durations_exact);
+
+	printf("\nGroup 3: reports\n");
+	TEST(report_text);
+	TEST(report_json);
+}